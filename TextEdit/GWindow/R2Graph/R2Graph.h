@@ -426,57 +426,47 @@ public:
     // Compute an intersection the rectangle and the line (p1, p2).
     // Result: the line (c1, c2).
     // Return value: true, if nonempty, false otherwise.
+    // (Liang-Barsky: the parameter t of p1 + (p2 - p1)*t is cut
+    // by the four sides; the ends inside are not changed.)
     bool clip(
         const R2Point& p1, const R2Point& p2,
         R2Point& c1, R2Point& c2
     ) const {
-        c1 = p1; c2 = p2;
-        double r;
-
-        if (c1.x < getXMin() && c2.x < getXMin()) return 0;
-        if (c1.x < getXMin()) {
-            // Assert: c2.x >= getXMin()
-            r = (c2.x - getXMin()) / (c2.x - c1.x);
-            c1 = c2 + (c1-c2)*r;
-        }
-        if (c2.x < getXMin()) {
-            r = (c1.x - getXMin()) / (c1.x - c2.x);
-            c2 = c1 + (c2-c1)*r;
-        }
-
-        if (c1.x > getXMax() && c2.x > getXMax()) return 0;
-        if (c1.x > getXMax()) {
-            r = (getXMax() - c2.x) / (c1.x - c2.x);
-            c1 = c2 + (c1-c2)*r;
-        }
-        if (c2.x > getXMax()) {
-            r = (getXMax() - c1.x) / (c2.x - c1.x);
-            c2 = c1 + (c2-c1)*r;
-        }
-
-        //-------------------
+        double dx = p2.x - p1.x, dy = p2.y - p1.y;
+        double t0 = 0., t1 = 1.;
+        if (
+            !clipParameter(-dx, p1.x - getXMin(), t0, t1) ||
+            !clipParameter(dx, getXMax() - p1.x, t0, t1) ||
+            !clipParameter(-dy, p1.y - getYMin(), t0, t1) ||
+            !clipParameter(dy, getYMax() - p1.y, t0, t1)
+        )
+            return false;
 
-        if (c1.y < getYMin() && c2.y < getYMin()) return 0;
-        if (c1.y < getYMin()) {
-            // Assert: c2.y >= getYMin()
-            r = (c2.y - getYMin()) / (c2.y - c1.y);
-            c1 = c2 + (c1-c2)*r;
-        }
-        if (c2.y < getYMin()) {
-            r = (c1.y - getYMin()) / (c1.y - c2.y);
-            c2 = c1 + (c2-c1)*r;
-        }
+        c1 = p1; c2 = p2;
+        if (t0 > 0.)
+            c1 = R2Point(p1.x + dx*t0, p1.y + dy*t0);
+        if (t1 < 1.)
+            c2 = R2Point(p1.x + dx*t1, p1.y + dy*t1);
+        return true;
+    }
 
-        if (c1.y > getYMax() && c2.y > getYMax()) return 0;
-        if (c1.y > getYMax()) {
-            r = (getYMax() - c2.y) / (c1.y - c2.y);
-            c1 = c2 + (c1-c2)*r;
-        }
-        if (c2.y > getYMax()) {
-            r = (getYMax() - c1.y) / (c2.y - c1.y);
-            c2 = c1 + (c2-c1)*r;
+private:
+    // The side p*t <= q of the rectangle narrows [t0, t1]
+    static bool clipParameter(double p, double q, double& t0, double& t1) {
+        if (p == 0.)
+            return (q >= 0.);       // Parallel to the side
+        double r = q / p;
+        if (p < 0.) {
+            if (r > t1)
+                return false;
+            if (r > t0)
+                t0 = r;
+        } else {
+            if (r < t0)
+                return false;
+            if (r < t1)
+                t1 = r;
         }
-
         return true;
     }
 };
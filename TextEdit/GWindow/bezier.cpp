@@ -166,15 +166,13 @@ void MyWindow::drawBezierCurve(
 ) {
     if (numPoints <= 1)
         return;
-    double t = 0.;
-    double dt = 0.02;
-    moveTo(q[0]);
-    t += dt;
-    while (t < 1.) {
-        drawLineTo(bezierCurve(numPoints, q, t), offscreenDrawing);
-        t += dt;
-    }
-    drawLineTo(q[numPoints - 1], offscreenDrawing);
+    // The points of the curve are mapped to the window all at once
+    const int numSteps = 50;        // dt = 0.02
+    R2Point curve[numSteps + 1];
+    for (int i = 0; i < numSteps; ++i)
+        curve[i] = bezierCurve(numPoints, q, double(i) / numSteps);
+    curve[numSteps] = q[numPoints - 1];
+    drawPolyline(curve, numSteps + 1, offscreenDrawing);
 }
 
 R2Point MyWindow::bezierCurve(
@@ -202,7 +200,7 @@ R2Point MyWindow::bezierCurve(
 void MyWindow::onKeyPress(XEvent& event) {
     KeySym key;
     char keyName[256];
-    int nameLen = XLookupString(&(event.xkey), keyName, 255, &key, 0);
+    int nameLen = lookupString(&(event.xkey), keyName, 255, &key);
     printf("KeyPress: keycode=0x%x, state=0x%x, KeySym=0x%x\n",
         event.xkey.keycode, event.xkey.state, (int) key);
     if (nameLen > 0) {
@@ -239,12 +237,14 @@ void MyWindow::onButtonPress(XEvent& event) {
             nodeCatched = true;
             nodeIndicated = false;
             catchedNodeIdx = node;
-            if (catchCursor == 0) {
-                catchCursor = XCreateFontCursor(
-                    m_Display, XC_cross
-                );
+            if (m_Display != 0) {       // No cursors in the headless mode
+                if (catchCursor == 0) {
+                    catchCursor = XCreateFontCursor(
+                        m_Display, XC_cross
+                    );
+                }
+                XDefineCursor(m_Display, m_Window, catchCursor);
             }
-            XDefineCursor(m_Display, m_Window, catchCursor);
         }
     }
 }
@@ -263,7 +263,8 @@ void MyWindow::onButtonRelease(XEvent& event) {
     if (nodeCatched) {
         printf("Node is release.\n");
         nodeCatched = false;
-        XUndefineCursor(m_Display, m_Window);
+        if (m_Display != 0)
+            XUndefineCursor(m_Display, m_Window);
         p[catchedNodeIdx] = t;
         catchedNodeIdx = (-1);
     } else {
@@ -293,7 +294,8 @@ void MyWindow::onMotionNotify(XEvent& event) {
         if (node < 0 || dist > CATCH_DIST) {
             printf("Stopped node indication.\n");
             nodeIndicated = false;
-            XUndefineCursor(m_Display, m_Window);
+            if (m_Display != 0)
+                XUndefineCursor(m_Display, m_Window);
         }
     } else if (nodeCatched) {
         dragNode(t);
@@ -303,12 +305,14 @@ void MyWindow::onMotionNotify(XEvent& event) {
             printf("Started node indication.\n");
             nodeIndicated = true;
             catchedNodeIdx = node;
-            if (indicateCursor == 0) {
-                indicateCursor = XCreateFontCursor(
-                    m_Display, XC_hand1
-                );
+            if (m_Display != 0) {
+                if (indicateCursor == 0) {
+                    indicateCursor = XCreateFontCursor(
+                        m_Display, XC_hand1
+                    );
+                }
+                XDefineCursor(m_Display, m_Window, indicateCursor);
             }
-            XDefineCursor(m_Display, m_Window, indicateCursor);
         }
     }
 }
@@ -0,0 +1,196 @@
+//
+// File "cliptst.cpp"
+// Test of clipping: R2Rectangle::clip (Liang-Barsky),
+// clipSegment and clipPolygon of the gclip module
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "gclip.h"
+
+static int numErrors = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s: %s\n", what, ok? "ok" : "FAILED");
+    if (!ok)
+        ++numErrors;
+}
+
+static bool near(const R2Point& p, double x, double y) {
+    return (fabs(p.x - x) < 1e-9 && fabs(p.y - y) < 1e-9);
+}
+
+static bool equal(const I2Point& p, int x, int y) {
+    return (p.x == x && p.y == y);
+}
+
+// Area of a polygon (absolute value), by the shoelace formula
+static double area(const std::vector<I2Point>& p, int n) {
+    double s = 0.;
+    for (int i = 0; i < n; ++i) {
+        const I2Point& a = p[i];
+        const I2Point& b = p[(i + 1) % n];
+        s += (double) a.x * b.y - (double) b.x * a.y;
+    }
+    return fabs(s) / 2.;
+}
+
+static bool insideRect(
+    const std::vector<I2Point>& p, int n, const R2Rectangle& r
+) {
+    for (int i = 0; i < n; ++i) {
+        if (
+            p[i].x < r.getXMin() || p[i].x > r.getXMax() ||
+            p[i].y < r.getYMin() || p[i].y > r.getYMax()
+        )
+            return false;
+    }
+    return true;
+}
+
+static void testRectangleClip() {
+    printf("R2Rectangle::clip\n");
+    R2Rectangle r(0., 0., 10., 10.);
+    R2Point c1, c2;
+
+    bool res = r.clip(R2Point(-5., 5.), R2Point(15., 5.), c1, c2);
+    check(
+        res && near(c1, 0., 5.) && near(c2, 10., 5.),
+        "crossing segment"
+    );
+    res = r.clip(R2Point(2., 3.), R2Point(7., 8.), c1, c2);
+    check(
+        res && near(c1, 2., 3.) && near(c2, 7., 8.),
+        "segment inside is not changed"
+    );
+    res = r.clip(R2Point(2., -5.), R2Point(2., 15.), c1, c2);
+    check(
+        res && near(c1, 2., 0.) && near(c2, 2., 10.),
+        "vertical segment"
+    );
+    res = r.clip(R2Point(-1., -5.), R2Point(-1., 15.), c1, c2);
+    check(!res, "parallel to a side, outside");
+    res = r.clip(R2Point(-5., 11.), R2Point(15., 11.), c1, c2);
+    check(!res, "horizontal, above the rectangle");
+    res = r.clip(R2Point(11., 0.), R2Point(20., 5.), c1, c2);
+    check(!res, "fully outside, to the right");
+    res = r.clip(R2Point(-5., 8.), R2Point(2., 20.), c1, c2);
+    check(!res, "fully outside, passing a corner");
+    res = r.clip(R2Point(0., 0.), R2Point(10., 10.), c1, c2);
+    check(
+        res && near(c1, 0., 0.) && near(c2, 10., 10.),
+        "ends exactly on corners"
+    );
+    res = r.clip(R2Point(0., 0.), R2Point(10., 0.), c1, c2);
+    check(
+        res && near(c1, 0., 0.) && near(c2, 10., 0.),
+        "segment along a side"
+    );
+    res = r.clip(R2Point(0., 5.), R2Point(-5., 5.), c1, c2);
+    check(
+        res && near(c1, 0., 5.) && near(c2, 0., 5.),
+        "touching a side in one point"
+    );
+    res = r.clip(R2Point(15., 5.), R2Point(10., 5.), c1, c2);
+    check(
+        res && near(c1, 10., 5.) && near(c2, 10., 5.),
+        "ending exactly on a side"
+    );
+}
+
+static void testClipSegment() {
+    printf("clipSegment\n");
+    R2Rectangle r(0., 0., 100., 100.);
+
+    I2Point p1(-100, 50), p2(50, 50);
+    bool res = clipSegment(p1, p2, r);
+    check(
+        res && equal(p1, 0, 50) && equal(p2, 50, 50),
+        "one end outside"
+    );
+    p1 = I2Point(-1000000, -1000000); p2 = I2Point(1000000, 1000000);
+    res = clipSegment(p1, p2, r);
+    check(
+        res && equal(p1, 0, 0) && equal(p2, 100, 100),
+        "huge diagonal"
+    );
+    p1 = I2Point(0, 100); p2 = I2Point(100, 100);
+    res = clipSegment(p1, p2, r);
+    check(
+        res && equal(p1, 0, 100) && equal(p2, 100, 100),
+        "on the edge"
+    );
+    p1 = I2Point(101, -5); p2 = I2Point(101, 200);
+    res = clipSegment(p1, p2, r);
+    check(!res, "parallel, outside");
+}
+
+static void testClipPolygon() {
+    printf("clipPolygon\n");
+    R2Rectangle r(0., 0., 10., 10.);
+    std::vector<I2Point> result;
+
+    // The rectangle is inside the polygon
+    I2Point big[4] = {
+        I2Point(-100, -100), I2Point(100, -100),
+        I2Point(100, 100), I2Point(-100, 100)
+    };
+    int n = clipPolygon(big, 4, r, result);
+    check(
+        n == 4 && area(result, n) == 100. && insideRect(result, n, r),
+        "polygon around the rectangle"
+    );
+
+    // Outside, but its box covers the rectangle
+    I2Point outside[3] = {
+        I2Point(20, -50), I2Point(30, 50), I2Point(20, 60)
+    };
+    n = clipPolygon(outside, 3, r, result);
+    check(n < 3, "polygon outside");
+
+    // Vertices exactly on the sides
+    I2Point diamond[4] = {
+        I2Point(5, 0), I2Point(10, 5), I2Point(5, 10), I2Point(0, 5)
+    };
+    n = clipPolygon(diamond, 4, r, result);
+    check(
+        n == 4 && area(result, n) == 50. && insideRect(result, n, r),
+        "vertices on the sides"
+    );
+
+    // Concave "U" whose legs leave through the top side: the parts
+    // are joined along the side, and the joining edges add no area
+    I2Point u[8] = {
+        I2Point(2, -5), I2Point(8, -5), I2Point(8, 15), I2Point(6, 15),
+        I2Point(6, 5), I2Point(4, 5), I2Point(4, 15), I2Point(2, 15)
+    };
+    n = clipPolygon(u, 8, r, result);
+    check(
+        n >= 8 && area(result, n) == 50. && insideRect(result, n, r),
+        "concave polygon"
+    );
+
+    // Concave polygon with a notch reaching outside of the rectangle
+    I2Point notch[5] = {
+        I2Point(-5, -5), I2Point(15, -5), I2Point(15, 15),
+        I2Point(5, 2), I2Point(-5, 15)
+    };
+    n = clipPolygon(notch, 5, r, result);
+    double a = area(result, n);
+    check(
+        n >= 5 && insideRect(result, n, r) && a > 50. && a < 100.,
+        "concave polygon with a notch"
+    );
+}
+
+int main() {
+    testRectangleClip();
+    testClipSegment();
+    testClipPolygon();
+    if (numErrors > 0) {
+        printf("%d test(s) failed\n", numErrors);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
@@ -7,14 +7,12 @@
 #include <math.h>
 #include <unistd.h>
 #include <time.h>
-#include <sys/times.h>
 #include <signal.h>
 #include "gwindow.h"
 
 static void sigHandler(int sigID);      // Handler of Ctrl+C
 
 static const double PI = 3.14159265358979323846;
-static clock_t clocks_per_sec = CLOCKS_PER_SEC;
 static const int ANIMATION_DT = 1000;   // milliseconds
 static bool finished = false;
 
@@ -38,10 +36,6 @@ public:
     int minutes;
     int seconds;
 
-    // Animation
-    clock_t prevMoment;
-    clock_t currentMoment;
-
     // Arrows positions
     R2Vector secondArrow;
     R2Vector minuteArrow;
@@ -58,8 +52,6 @@ public:
         hours(0),
         minutes(0),
         seconds(0),
-        prevMoment(0),
-        currentMoment(0),
         secondArrow(),
         minuteArrow(),
         hourArrow(),
@@ -67,7 +59,6 @@ public:
         offscreenDrawing(false)
     {}
 
-    void animate();
     void defineCurrentTime();
     void drawFace();
     void drawArrows(bool erase = false);
@@ -83,6 +74,7 @@ public:
     virtual void onButtonPress(XEvent& event);
     virtual bool onWindowClosing();
     virtual void onResize(XEvent& event);
+    virtual void onTimer(int timerID, int missed);
 };
 
 double ClockWindow::cosines[360], ClockWindow::sines[360];
@@ -125,8 +117,6 @@ void ClockWindow::onExpose(XEvent& /* event */) {
 
     drawFace();
 
-    struct tms tim;
-    prevMoment = times(&tim);  // Remember the moment of drawing
     defineCurrentTime();
     drawArrows(false);
 }
@@ -138,33 +128,24 @@ void ClockWindow::drawInOffscreen() {
 
     drawFace();
 
-    struct tms tim;
-    prevMoment = times(&tim);  // Remember the moment of drawing
     defineCurrentTime();
     drawArrows(false);
 }
 
-void ClockWindow::animate() {
+// Called every ANIMATION_DT milliseconds
+void ClockWindow::onTimer(int /* timerID */, int /* missed */) {
     if (finished)
         return;
 
-    struct tms tim;
-    currentMoment = times(&tim);
-    if (prevMoment == 0)
-        prevMoment = currentMoment;     // Initialization
-    clock_t dt = currentMoment - prevMoment;
-    if (dt >= clocks_per_sec) {
-        if (!offscreenDrawing) {
-            drawArrows(true);
-        }
-        prevMoment = times(&tim);
-        defineCurrentTime();
-        if (!offscreenDrawing) {
-            drawArrows(false);
-        } else {
-            drawInOffscreen();
-            swapBuffers();
-        }
+    if (!offscreenDrawing) {
+        drawArrows(true);
+    }
+    defineCurrentTime();
+    if (!offscreenDrawing) {
+        drawArrows(false);
+    } else {
+        drawInOffscreen();
+        swapBuffers();
     }
 }
 
@@ -336,7 +317,7 @@ void ClockWindow::drawArrow(
 void ClockWindow::onKeyPress(XEvent& event) {
     KeySym key;
     char keyName[256];
-    int nameLen = XLookupString(&(event.xkey), keyName, 255, &key, 0);
+    int nameLen = lookupString(&(event.xkey), keyName, 255, &key);
     printf("KeyPress: keycode=0x%x, state=0x%x, KeySym=0x%x\n",
         event.xkey.keycode, event.xkey.state, (int) key);
     if (nameLen > 0) {
@@ -397,11 +378,14 @@ int main() {
     }
 
     int numDepths = 0;
-    int *depths = XListDepths(
-        GWindow::m_Display,
-        DefaultScreen(GWindow::m_Display),
-        &numDepths
-    );
+    int *depths = 0;
+    if (GWindow::m_Display != 0) {      // Not in the headless mode
+        depths = XListDepths(
+            GWindow::m_Display,
+            DefaultScreen(GWindow::m_Display),
+            &numDepths
+        );
+    }
     if (depths != 0) {
         printf("Display depths: ");
         for (int i = 0; i < numDepths; ++i) {
@@ -431,7 +415,6 @@ int main() {
     w.setBackground("lightGray");
 
     // GWindow::messageLoop();
-    clocks_per_sec = (clock_t) sysconf(_SC_CLK_TCK);
 
     // Offscreen buffer
     if (w.createOffscreenBuffer()) {
@@ -439,23 +422,18 @@ int main() {
         w.drawInOffscreen();            // Initial drawing
     }
 
+    // Animation timer
+    w.setTimer(ANIMATION_DT, ANIMATION_DT);
+
     // Message loop, animation
     XEvent e;
     while (!finished) {
         if (GWindow::getNextEvent(e)) {
             GWindow::dispatchEvent(e);
+            GWindow::processPendingWork();
         } else {
-
-            // Sleep a bit (we use select for sleeping)
-            timeval dt;
-
-            // Sleep 0.01 sec
-            dt.tv_sec = 0;
-            dt.tv_usec = 10000; // sleeping time 0.01 sec
-
-            select(1, 0, 0, 0, &dt);
-
-            w.animate();
+            // Sleep until an X event or the next timer
+            GWindow::waitForEvents();
         }
     }
 
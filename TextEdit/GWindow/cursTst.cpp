@@ -215,6 +215,10 @@ void MyWindow::onExpose(XEvent& /* event */) {
 }
 
 bool MyWindow::setCursor(int shape) {
+    if (m_Display == 0) {       // No cursors in the headless mode
+        currentCursorIdx = shape;
+        return true;
+    }
     Cursor res = XCreateFontCursor(m_Display, shape);
     bool err = false;
     if (res == BadAlloc) {
@@ -241,7 +245,7 @@ bool MyWindow::setCursor(int shape) {
 void MyWindow::onKeyPress(XEvent& event) {
     KeySym key;
     char keyName[256];
-    int nameLen = XLookupString(&(event.xkey), keyName, 255, &key, 0);
+    int nameLen = lookupString(&(event.xkey), keyName, 255, &key);
     printf("KeyPress: keycode=0x%x, state=0x%x, KeySym=0x%x\n",
         event.xkey.keycode, event.xkey.state, (int) key);
     if (nameLen > 0) {
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <memory>
+#include <vector>
 #include "gwindow.h"
 
 static const int MAX_POINTS = 10;
@@ -16,15 +18,28 @@ class MyWindow: public GWindow {    // Our main class
     R2Point point[MAX_POINTS];      // Mouse clicks
     unsigned int mouseButton[MAX_POINTS];
     int numPoints;
+    GDisplayList picture;           // Recorded drawing
+    bool pictureValid;
+    std::vector<R2Point> graph;     // Samples of the function
+    bool graphValid;
+    bool sampling;                  // Samples are computed in background
 public:
     MyWindow():                     // Constructor
-        numPoints(0)
+        numPoints(0),
+        picture(),
+        pictureValid(false),
+        graph(),
+        graphValid(false),
+        sampling(false)
     {}
 
-    double f(double x);             // Function y = f(x)
+    static double f(double x);      // Function y = f(x)
+    void sampleGraphic();           // Start computing the samples
     void drawGraphic();             // Draw graph of function
+    void drawPicture();             // Axes, graph and mouse clicks
 
     virtual void onExpose(XEvent& event);
+    virtual void onResize(XEvent& event);
     virtual void onKeyPress(XEvent& event);
     virtual void onButtonPress(XEvent& event);
 };
@@ -40,9 +55,26 @@ double MyWindow::f(double x) {
 }
 
 //
-// Process the Expose event: draw in the window
+// Process the Expose event: draw in the window.
+// The picture is computed only when it is changed;
+// then the recorded commands are replayed.
 //
 void MyWindow::onExpose(XEvent& /* event */) {
+    if (!pictureValid) {
+        beginDisplayList(picture);
+        drawPicture();
+        endDisplayList();
+        pictureValid = true;
+    }
+    drawDisplayList(picture);
+}
+
+// Coordinates of the picture are changed
+void MyWindow::onResize(XEvent& /* event */) {
+    pictureValid = false;
+}
+
+void MyWindow::drawPicture() {
     // Erase a window
     setForeground(getBackground());
     fillRectangle(m_RWinRect);
@@ -51,10 +83,13 @@ void MyWindow::onExpose(XEvent& /* event */) {
     setLineWidth(1);
     drawAxes("black", true, "gray");
 
-    // Draw a graph of function
+    // Draw a graph of function, when it is sampled
     setLineWidth(2);
     setForeground("blue");
-    drawGraphic();
+    if (graphValid)
+        drawGraphic();
+    else
+        sampleGraphic();
     drawString(
         R2Point(5., 8.), "y = sin(x) * 8/(1 + 0.1*x*x)"
     );
@@ -81,7 +116,7 @@ void MyWindow::onExpose(XEvent& /* event */) {
 void MyWindow::onKeyPress(XEvent& event) {
     KeySym key;
     char keyName[256];
-    int nameLen = XLookupString(&(event.xkey), keyName, 255, &key, 0);
+    int nameLen = lookupString(&(event.xkey), keyName, 255, &key);
     printf("KeyPress: keycode=0x%x, state=0x%x, KeySym=0x%x\n",
         event.xkey.keycode, event.xkey.state, (int) key);
     if (nameLen > 0) {
@@ -109,26 +144,54 @@ void MyWindow::onButtonPress(XEvent& event) {
 
     point[numPoints] = invMap(I2Point(x, y));
     ++numPoints;
+    pictureValid = false;
     redraw();
 }
 
 //
-// Draw graph of function in a window
+// Sample the function in a background thread; the picture
+// is redrawn with the graph when the samples are ready
 //
-void MyWindow::drawGraphic() {
-    R2Point p;
-    double dx = 0.01;
+void MyWindow::sampleGraphic() {
+    if (sampling)
+        return;
+    sampling = true;
+    double xmin = getXMin();
     double xmax = getXMax();
+    std::shared_ptr< std::vector<R2Point> > samples(
+        new std::vector<R2Point>
+    );
+    runTask(
+        [samples, xmin, xmax]() {
+            double dx = 0.01;
+            R2Point p(xmin, f(xmin));
+            while (p.x < xmax) {
+                samples->push_back(p);
+                p.x += dx;
+                p.y = f(p.x);
+            }
+        },
+        [this, samples, xmin, xmax]() {
+            sampling = false;
+            if (xmin != getXMin() || xmax != getXMax()) {
+                // The coordinates were changed meanwhile
+                sampleGraphic();
+                return;
+            }
+            graph.swap(*samples);
+            graphValid = true;
+            pictureValid = false;
+            redraw();
+        }
+    );
+}
 
-    p.x = getXMin();
-    p.y = f(p.x);
-
-    moveTo(p);
-    while (p.x < xmax) {
-        drawLineTo(p);
-        p.x += dx;
-        p.y = f(p.x);
-    }
+//
+// Draw graph of function in a window
+//
+void MyWindow::drawGraphic() {
+    if (graph.size() > 1)
+        drawPolyline(&(graph[0]), (int) graph.size());
 }
 
 //
@@ -0,0 +1,101 @@
+//
+// File "gclip.cpp"
+// Clipping of segments and polygons, implementation
+//
+#include <math.h>
+
+#include "gclip.h"
+
+static int roundToPixel(double v) {
+    return (int) floor(v + 0.5);
+}
+
+bool clipSegment(I2Point& p1, I2Point& p2, const R2Rectangle& rect) {
+    R2Point c1, c2;
+    if (!rect.clip(R2Point(p1.x, p1.y), R2Point(p2.x, p2.y), c1, c2))
+        return false;
+    p1 = I2Point(roundToPixel(c1.x), roundToPixel(c1.y));
+    p2 = I2Point(roundToPixel(c2.x), roundToPixel(c2.y));
+    return true;
+}
+
+// Sides of the rectangle: a point is inside the half-plane
+// if side * (coordinate - bound) <= 0
+struct ClipSide {
+    bool vertical;      // x = bound
+    double bound;
+    double side;
+};
+
+static bool insideSide(const R2Point& p, const ClipSide& s) {
+    double v = s.vertical? p.x : p.y;
+    return s.side * (v - s.bound) <= 0.;
+}
+
+static R2Point intersectSide(
+    const R2Point& a, const R2Point& b, const ClipSide& s
+) {
+    if (s.vertical) {
+        double t = (s.bound - a.x) / (b.x - a.x);
+        return R2Point(s.bound, a.y + (b.y - a.y) * t);
+    }
+    double t = (s.bound - a.y) / (b.y - a.y);
+    return R2Point(a.x + (b.x - a.x) * t, s.bound);
+}
+
+// Work buffers: they only grow
+static std::vector<R2Point> clipInput;
+static std::vector<R2Point> clipOutput;
+
+int clipPolygon(
+    const I2Point* points, int numPoints, const R2Rectangle& rect,
+    std::vector<I2Point>& result
+) {
+    result.clear();
+    clipInput.resize(numPoints);
+    for (int i = 0; i < numPoints; ++i)
+        clipInput[i] = R2Point(points[i].x, points[i].y);
+
+    const ClipSide sides[4] = {
+        { true, rect.getXMin(), (-1.) },
+        { true, rect.getXMax(), 1. },
+        { false, rect.getYMin(), (-1.) },
+        { false, rect.getYMax(), 1. }
+    };
+    for (int k = 0; k < 4 && clipInput.size() >= 3; ++k) {
+        const ClipSide& s = sides[k];
+        clipOutput.clear();
+        size_t n = clipInput.size();
+        for (size_t i = 0; i < n; ++i) {
+            const R2Point& a = clipInput[(i + n - 1) % n];
+            const R2Point& b = clipInput[i];
+            bool aInside = insideSide(a, s), bInside = insideSide(b, s);
+            if (bInside) {
+                if (!aInside)
+                    clipOutput.push_back(intersectSide(a, b, s));
+                clipOutput.push_back(b);
+            } else if (aInside) {
+                clipOutput.push_back(intersectSide(a, b, s));
+            }
+        }
+        clipInput.swap(clipOutput);
+    }
+    if (clipInput.size() < 3)
+        return 0;
+
+    // Rounding may produce equal consecutive vertices
+    for (size_t i = 0; i < clipInput.size(); ++i) {
+        I2Point p(roundToPixel(clipInput[i].x), roundToPixel(clipInput[i].y));
+        if (
+            result.empty() ||
+            result.back().x != p.x || result.back().y != p.y
+        )
+            result.push_back(p);
+    }
+    while (
+        result.size() > 1 &&
+        result.back().x == result[0].x && result.back().y == result[0].y
+    )
+        result.pop_back();
+    return (int) result.size();
+}
@@ -0,0 +1,29 @@
+//
+// File "gclip.h"
+// Clipping of segments and polygons by a rectangle in pixels,
+// before they are sent to the server or drawn in a raster
+//
+
+#ifndef _GCLIP_H
+#define _GCLIP_H
+
+#include <vector>
+
+// Classes for simple 2-dimensional objects
+#include "R2Graph/R2Graph.h"
+
+// The segment clipped by the rectangle (R2Rectangle::clip),
+// ends rounded to pixels. Returns false if nothing is left.
+bool clipSegment(I2Point& p1, I2Point& p2, const R2Rectangle& rect);
+
+// Sutherland-Hodgman: the polygon is clipped by the four sides
+// of the rectangle in turn, and the vertices are rounded to pixels.
+// Returns the number of vertices in result (less than 3 when nothing
+// is left). Parts of a concave polygon may become joined by edges
+// along a side of the rectangle; such edges enclose no area.
+int clipPolygon(
+    const I2Point* points, int numPoints, const R2Rectangle& rect,
+    std::vector<I2Point>& result
+);
+
+#endif /* _GCLIP_H */
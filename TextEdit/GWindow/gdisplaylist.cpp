@@ -0,0 +1,146 @@
+//
+// File "gdisplaylist.cpp"
+// Display list of a GWindow, recording
+//
+#include "gdisplaylist.h"
+
+GDisplayList::GDisplayList():
+    m_Data(),
+    m_Text(),
+    m_NumCommands(0),
+    m_LastPolyline(-1)
+{}
+
+void GDisplayList::clear() {
+    m_Data.clear();
+    m_Text.clear();
+    m_NumCommands = 0;
+    m_LastPolyline = (-1);
+}
+
+size_t GDisplayList::memorySize() const {
+    return m_Data.size() * sizeof(int) + m_Text.size();
+}
+
+// Pixel values and font IDs fit in 32 bits
+void GDisplayList::addState(OpCode op, unsigned long value) {
+    m_Data.push_back(op);
+    m_Data.push_back((int) value);
+    ++m_NumCommands;
+    m_LastPolyline = (-1);
+}
+
+void GDisplayList::addBox(OpCode op, int x1, int y1, int x2, int y2) {
+    m_Data.push_back(op);
+    m_Data.push_back((x1 < x2)? x1 : x2);
+    m_Data.push_back((y1 < y2)? y1 : y2);
+    m_Data.push_back((x1 < x2)? x2 : x1);
+    m_Data.push_back((y1 < y2)? y2 : y1);
+    ++m_NumCommands;
+    m_LastPolyline = (-1);
+}
+
+void GDisplayList::setForeground(unsigned long pixel) {
+    addState(OP_FOREGROUND, pixel);
+}
+
+void GDisplayList::setBackground(unsigned long pixel) {
+    addState(OP_BACKGROUND, pixel);
+}
+
+void GDisplayList::setFont(Font fontID) {
+    addState(OP_FONT, fontID);
+}
+
+void GDisplayList::setLineAttributes(
+    int width, int style, int cap, int join
+) {
+    m_Data.push_back(OP_LINE_ATTRIBUTES);
+    m_Data.push_back(width);
+    m_Data.push_back(style);
+    m_Data.push_back(cap);
+    m_Data.push_back(join);
+    ++m_NumCommands;
+    m_LastPolyline = (-1);
+}
+
+void GDisplayList::addLine(const I2Point& p1, const I2Point& p2) {
+    if (m_LastPolyline >= 0) {
+        // Continue the last polyline, if the line starts at its end
+        int n = m_Data[m_LastPolyline + 5];
+        if (
+            m_Data[m_LastPolyline + 6 + 2*(n-1)] == p1.x &&
+            m_Data[m_LastPolyline + 6 + 2*(n-1) + 1] == p1.y
+        ) {
+            m_Data.push_back(p2.x);
+            m_Data.push_back(p2.y);
+            m_Data[m_LastPolyline + 5] = n + 1;
+
+            // Extend the bounding box
+            int* box = &(m_Data[m_LastPolyline + 1]);
+            if (p2.x < box[0]) box[0] = p2.x;
+            if (p2.y < box[1]) box[1] = p2.y;
+            if (p2.x > box[2]) box[2] = p2.x;
+            if (p2.y > box[3]) box[3] = p2.y;
+            return;
+        }
+    }
+
+    int pos = (int) m_Data.size();
+    addBox(OP_POLYLINE, p1.x, p1.y, p2.x, p2.y);
+    m_Data.push_back(2);
+    m_Data.push_back(p1.x);
+    m_Data.push_back(p1.y);
+    m_Data.push_back(p2.x);
+    m_Data.push_back(p2.y);
+    m_LastPolyline = pos;
+}
+
+void GDisplayList::addFillRectangle(const I2Rectangle& r) {
+    addBox(OP_FILL_RECTANGLE, r.left(), r.top(), r.right(), r.bottom());
+    m_Data.push_back(r.left());
+    m_Data.push_back(r.top());
+    m_Data.push_back(r.width());
+    m_Data.push_back(r.height());
+}
+
+void GDisplayList::addFillPolygon(const I2Point* points, int numPoints) {
+    if (numPoints <= 2)
+        return;
+    int xmin = points[0].x, xmax = xmin;
+    int ymin = points[0].y, ymax = ymin;
+    for (int i = 1; i < numPoints; ++i) {
+        if (points[i].x < xmin) xmin = points[i].x;
+        if (points[i].x > xmax) xmax = points[i].x;
+        if (points[i].y < ymin) ymin = points[i].y;
+        if (points[i].y > ymax) ymax = points[i].y;
+    }
+    addBox(OP_FILL_POLYGON, xmin, ymin, xmax, ymax);
+    m_Data.push_back(numPoints);
+    for (int i = 0; i < numPoints; ++i) {
+        m_Data.push_back(points[i].x);
+        m_Data.push_back(points[i].y);
+    }
+}
+
+void GDisplayList::addEllipse(const I2Rectangle& r, bool fill) {
+    addBox(
+        fill? OP_FILL_ELLIPSE : OP_DRAW_ELLIPSE,
+        r.left(), r.top(), r.right(), r.bottom()
+    );
+    m_Data.push_back(r.left());
+    m_Data.push_back(r.top());
+    m_Data.push_back(r.width());
+    m_Data.push_back(r.height());
+}
+
+void GDisplayList::addString(
+    int x, int y, const char* str, int len, const I2Rectangle& box
+) {
+    addBox(OP_STRING, box.left(), box.top(), box.right(), box.bottom());
+    m_Data.push_back(x);
+    m_Data.push_back(y);
+    m_Data.push_back((int) m_Text.size());
+    m_Data.push_back(len);
+    m_Text.insert(m_Text.end(), str, str + len);
+}
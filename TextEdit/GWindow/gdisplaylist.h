@@ -0,0 +1,86 @@
+//
+// File "gdisplaylist.h"
+// Display list: drawing commands of a GWindow recorded
+// in device coordinates and replayed later (for instance, on Expose)
+//
+
+#ifndef _GDISPLAYLIST_H
+#define _GDISPLAYLIST_H
+
+#include <vector>
+
+// Classes for simple 2-dimensional objects
+#include "R2Graph/R2Graph.h"
+
+extern "C" {
+
+#include <X11/Xlib.h>
+
+}
+
+//
+// Commands are kept in a compact array of integers:
+//     opcode [bounding box: xmin, ymin, xmax, ymax] arguments...
+// Only drawing commands have a bounding box; it is used to skip
+// the commands outside of the damaged area on replay.
+// Consecutive connected lines are merged into one polyline.
+//
+// A display list is recorded by GWindow::beginDisplayList /
+// GWindow::endDisplayList and replayed by GWindow::drawDisplayList.
+//
+class GDisplayList {
+public:
+    enum OpCode {
+        // State changes
+        OP_FOREGROUND,          // pixel
+        OP_BACKGROUND,          // pixel
+        OP_LINE_ATTRIBUTES,     // width, style, cap, join
+        OP_FONT,                // font
+
+        // Drawing (with a bounding box)
+        OP_POLYLINE,            // n, x0, y0, ..., x[n-1], y[n-1]
+        OP_FILL_RECTANGLE,      // x, y, width, height
+        OP_FILL_POLYGON,        // n, x0, y0, ..., x[n-1], y[n-1]
+        OP_FILL_ELLIPSE,        // x, y, width, height
+        OP_DRAW_ELLIPSE,        // x, y, width, height
+        OP_STRING               // x, y, offset in text, length
+    };
+
+private:
+    std::vector<int>  m_Data;   // Commands
+    std::vector<char> m_Text;   // Characters of strings
+    int m_NumCommands;
+    int m_LastPolyline;         // Position of the last command if it
+                                // is a polyline, -1 otherwise
+
+public:
+    GDisplayList();
+
+    void clear();
+    bool empty() const { return m_NumCommands == 0; }
+    int numCommands() const { return m_NumCommands; }
+    size_t memorySize() const;  // In bytes
+
+    // Recording
+    void setForeground(unsigned long pixel);
+    void setBackground(unsigned long pixel);
+    void setLineAttributes(int width, int style, int cap, int join);
+    void setFont(Font fontID);
+
+    void addLine(const I2Point& p1, const I2Point& p2);
+    void addFillRectangle(const I2Rectangle& r);
+    void addFillPolygon(const I2Point* points, int numPoints);
+    void addEllipse(const I2Rectangle& r, bool fill);
+    void addString(
+        int x, int y, const char* str, int len, const I2Rectangle& box
+    );
+
+private:
+    void addState(OpCode op, unsigned long value);
+    void addBox(OpCode op, int x1, int y1, int x2, int y2);
+
+    friend class GWindow;       // Replays the list
+    friend class GTileRenderer; // Replays the list in parallel
+};
+
+#endif /* _GDISPLAYLIST_H */
@@ -0,0 +1,390 @@
+//
+// File "gheadless.cpp"
+// Support of the headless mode of GWindow, implementation
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "gheadless.h"
+
+extern "C" {
+
+#include <X11/keysym.h>
+
+}
+
+// Color names are normalized: lower case without spaces
+static std::string colorKey(const char* name) {
+    std::string key;
+    for (; *name != 0; ++name) {
+        if (!isspace((unsigned char) *name))
+            key += (char) tolower((unsigned char) *name);
+    }
+    return key;
+}
+
+// Colors used when the rgb.txt database is not installed
+static const struct {
+    const char* name;
+    unsigned long pixel;
+} basicColors[] = {
+    { "black",          0x000000 },
+    { "white",          0xFFFFFF },
+    { "red",            0xFF0000 },
+    { "green",          0x00FF00 },
+    { "blue",           0x0000FF },
+    { "yellow",         0xFFFF00 },
+    { "cyan",           0x00FFFF },
+    { "magenta",        0xFF00FF },
+    { "orange",         0xFFA500 },
+    { "brown",          0xA52A2A },
+    { "gray",           0xBEBEBE },
+    { "grey",           0xBEBEBE },
+    { "lightgray",      0xD3D3D3 },
+    { "lightgrey",      0xD3D3D3 },
+    { "darkgray",       0xA9A9A9 },
+    { "darkgrey",       0xA9A9A9 },
+    { "navy",           0x000080 },
+    { "midnightblue",   0x191970 },
+    { 0,                0 }
+};
+
+static std::unordered_map<std::string, unsigned long> colorNames;
+
+// The database is read when a name is looked up first time
+static void loadColorNames() {
+    if (!colorNames.empty())
+        return;
+    for (int i = 0; basicColors[i].name != 0; ++i)
+        colorNames[basicColors[i].name] = basicColors[i].pixel;
+
+    const char* const paths[] = {
+        "/usr/share/X11/rgb.txt", "/etc/X11/rgb.txt",
+        "/usr/X11R6/lib/X11/rgb.txt", 0
+    };
+    FILE* f = 0;
+    for (int i = 0; f == 0 && paths[i] != 0; ++i)
+        f = fopen(paths[i], "r");
+    if (f == 0)
+        return;
+    char line[256];
+    while (fgets(line, 256, f) != 0) {
+        int r, g, b, n = 0;
+        if (line[0] == '!' || sscanf(line, "%d %d %d %n", &r, &g, &b, &n) < 3)
+            continue;
+        std::string key = colorKey(line + n);
+        if (!key.empty()) {
+            colorNames[key] =
+                ((unsigned long) r << 16) | ((unsigned long) g << 8) |
+                (unsigned long) b;
+        }
+    }
+    fclose(f);
+}
+
+bool headlessParseColor(const char* colorName, unsigned long* pixel) {
+    if (colorName[0] == '#') {
+        int len = (int) strlen(colorName + 1);
+        if (
+            (len != 3 && len != 6) ||
+            (int) strspn(colorName + 1, "0123456789abcdefABCDEF") != len
+        )
+            return false;
+        unsigned long v = strtoul(colorName + 1, 0, 16);
+        if (len == 3) {
+            // Every digit is repeated: #abc = #aabbcc
+            v = ((v & 0xF00) << 12) | ((v & 0xF0) << 8) | ((v & 0xF) << 4);
+            v |= (v >> 4);
+        }
+        *pixel = v;
+        return true;
+    }
+
+    loadColorNames();
+    std::unordered_map<std::string, unsigned long>::const_iterator i =
+        colorNames.find(colorKey(colorName));
+    if (i == colorNames.end())
+        return false;
+    *pixel = i->second;
+    return true;
+}
+
+// Pixel size of a font name; 13 ("fixed") if it is not known
+static void fontSize(const char* fontName, int* width, int* height) {
+    int w = 0, h = 0;
+    if (sscanf(fontName, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+        *width = w;
+        *height = h;
+        return;
+    }
+
+    h = 13;
+    if (fontName[0] == '-') {
+        // -foundry-family-weight-slant-width-style-pixels-points-...
+        const char* p = fontName;
+        for (int field = 0; field < 7 && p != 0; ++field) {
+            p = strchr(p, '-');
+            if (p != 0)
+                ++p;
+        }
+        if (p != 0 && isdigit((unsigned char) *p)) {
+            h = atoi(p);
+        } else if (p != 0 && (p = strchr(p, '-')) != 0) {
+            if (isdigit((unsigned char) p[1]))
+                h = (atoi(p + 1) + 5) / 10;     // Decipoints
+        }
+        if (h <= 0)
+            h = 13;
+    }
+    *width = (h * 3 + 2) / 5;
+    *height = h;
+    if (h == 13)
+        *width = 6;
+}
+
+XFontStruct* headlessCreateFont(Font fontID, const char* fontName) {
+    int width, height;
+    fontSize((fontName != 0)? fontName : "fixed", &width, &height);
+
+    XFontStruct* fs = (XFontStruct*) calloc(1, sizeof(XFontStruct));
+    if (fs == 0)
+        return 0;
+    fs->fid = fontID;
+    fs->direction = FontLeftToRight;
+    fs->min_char_or_byte2 = 0;
+    fs->max_char_or_byte2 = 255;
+    fs->min_byte1 = 0;
+    fs->max_byte1 = 0;
+    fs->all_chars_exist = True;
+    fs->default_char = ' ';
+    fs->descent = height / 5;
+    fs->ascent = height - fs->descent;
+
+    XCharStruct c;
+    c.lbearing = 0;
+    c.rbearing = (short) width;
+    c.width = (short) width;
+    c.ascent = (short) fs->ascent;
+    c.descent = (short) fs->descent;
+    c.attributes = 0;
+    fs->min_bounds = c;
+    fs->max_bounds = c;
+    fs->per_char = 0;           // All characters are equal
+    return fs;
+}
+
+void headlessFreeFont(XFontStruct* fontStruct) {
+    free(fontStruct);
+}
+
+GGlyphMasks* headlessCreateGlyphs(const XFontStruct* fontStruct) {
+    GGlyphMasks* g = new GGlyphMasks;
+    int w = fontStruct->max_bounds.width;
+    if (w < 1)
+        w = 1;
+    g->cellWidth = w;
+    g->ascent = fontStruct->max_bounds.ascent;
+    g->descent = fontStruct->max_bounds.descent;
+    g->originX = 0;
+    for (int c = 0; c < 256; ++c)
+        g->advance[c] = (short) w;
+
+    int h = g->ascent + g->descent;
+    int stride = 16 * w;
+    g->mask.assign((size_t) stride * 16 * h, 0);
+
+    // A box with a gap of 1 pixel between characters
+    int x1 = (w >= 3)? 1 : 0;
+    int x2 = (w >= 3)? w - 1 : w;
+    for (int c = 0; c < 256; ++c) {
+        if (!((c > 0x20 && c < 0x7F) || c > 0xA0))
+            continue;
+        int top = g->ascent / 5;
+        if (islower(c))
+            top = g->ascent * 2 / 5;
+        unsigned char* cell =
+            &(g->mask[(size_t)(c >> 4) * h * stride + (c & 15) * w]);
+        for (int y = top; y < g->ascent; ++y)
+            memset(cell + y * stride + x1, 1, x2 - x1);
+    }
+    return g;
+}
+
+int headlessLookupString(
+    const XKeyEvent* event, char* buffer, int bufferLength, KeySym* keysym
+) {
+    KeySym k = (KeySym) event->keycode;
+    if ((event->state & ShiftMask) != 0 && k >= XK_a && k <= XK_z)
+        k = k - XK_a + XK_A;
+    if (keysym != 0)
+        *keysym = k;
+
+    int c = (-1);
+    if ((k >= 0x20 && k < 0x7F) || (k >= 0xA0 && k <= 0xFF)) {
+        c = (int) k;            // Latin-1 keysyms are the characters
+        if ((event->state & ControlMask) != 0 && isalpha(c))
+            c = toupper(c) & 0x1F;
+    } else if (k == XK_Return || k == XK_KP_Enter) {
+        c = '\r';
+    } else if (k == XK_Linefeed) {
+        c = '\n';
+    } else if (k == XK_BackSpace) {
+        c = '\b';
+    } else if (k == XK_Tab) {
+        c = '\t';
+    } else if (k == XK_Escape) {
+        c = 033;
+    } else if (k == XK_Delete) {
+        c = 0177;
+    }
+    if (c < 0 || bufferLength < 1)
+        return 0;
+    buffer[0] = (char) c;
+    return 1;
+}
+
+bool writeRasterPPM(
+    const GRaster& raster, int width, int height, const char* path
+) {
+    if (width > raster.width())
+        width = raster.width();
+    if (height > raster.height())
+        height = raster.height();
+    if (width <= 0 || height <= 0)
+        return false;
+    FILE* f = fopen(path, "wb");
+    if (f == 0)
+        return false;
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row((size_t) width * 3);
+    for (int y = 0; y < height; ++y) {
+        const uint32_t* p = raster.pixels() + y * raster.stride();
+        for (int x = 0; x < width; ++x) {
+            row[3*x] = (unsigned char) (p[x] >> 16);
+            row[3*x + 1] = (unsigned char) (p[x] >> 8);
+            row[3*x + 2] = (unsigned char) p[x];
+        }
+        fwrite(&(row[0]), 1, row.size(), f);
+    }
+    return (fclose(f) == 0);
+}
+
+GEventScript::GEventScript():
+    m_Steps(),
+    m_Next(0)
+{}
+
+void GEventScript::clear() {
+    m_Steps.clear();
+    m_Next = 0;
+}
+
+void GEventScript::addStep(const GScriptStep& step) {
+    m_Steps.push_back(step);
+}
+
+bool GEventScript::load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == 0)
+        return false;
+    clear();
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, 1024, f) != 0) {
+        ++lineNumber;
+        size_t len = strlen(line);
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = 0;
+        const char* p = line;
+        while (isspace((unsigned char) *p))
+            ++p;
+        if (*p == 0 || *p == '#')
+            continue;
+        GScriptStep step;
+        if (parseLine(p, step))
+            m_Steps.push_back(step);
+        else
+            fprintf(stderr, "%s:%d: bad event \"%s\"\n", path, lineNumber, p);
+    }
+    fclose(f);
+    return true;
+}
+
+bool GEventScript::parseLine(const char* line, GScriptStep& step) {
+    char word[64], arg[64];
+    int n = 0;
+    if (sscanf(line, "%63s %n", word, &n) < 1)
+        return false;
+    const char* rest = line + n;
+    step.args[0] = 0;
+    step.args[1] = 0;
+    step.args[2] = 0;
+    step.state = 0;
+    step.text.clear();
+
+    int* a = step.args;
+    if (strcmp(word, "key") == 0) {
+        step.kind = GScriptStep::KEY;
+        if (sscanf(rest, "%63s %n", arg, &n) < 1)
+            return false;
+        KeySym k = XStringToKeysym(arg);
+        if (k == NoSymbol && strlen(arg) == 1)
+            k = (unsigned char) arg[0];
+        if (k == NoSymbol)
+            return false;
+        a[0] = (int) k;
+        rest += n;
+        while (sscanf(rest, "%63s %n", arg, &n) == 1) {
+            if (strcmp(arg, "shift") == 0)
+                step.state |= ShiftMask;
+            else if (strcmp(arg, "ctrl") == 0 || strcmp(arg, "control") == 0)
+                step.state |= ControlMask;
+            else if (strcmp(arg, "alt") == 0 || strcmp(arg, "meta") == 0)
+                step.state |= Mod1Mask;
+            else
+                return false;
+            rest += n;
+        }
+        return true;
+    } else if (strcmp(word, "type") == 0) {
+        step.kind = GScriptStep::TYPE;
+        step.text = rest;
+        return true;
+    } else if (strcmp(word, "button") == 0) {
+        step.kind = GScriptStep::BUTTON;
+        return (sscanf(rest, "%d %d %d", a, a + 1, a + 2) == 3);
+    } else if (strcmp(word, "press") == 0) {
+        step.kind = GScriptStep::PRESS;
+        return (sscanf(rest, "%d %d %d", a, a + 1, a + 2) == 3);
+    } else if (strcmp(word, "release") == 0) {
+        step.kind = GScriptStep::RELEASE;
+        return (sscanf(rest, "%d %d %d", a, a + 1, a + 2) == 3);
+    } else if (strcmp(word, "motion") == 0) {
+        step.kind = GScriptStep::MOTION;
+        return (sscanf(rest, "%d %d", a, a + 1) == 2);
+    } else if (strcmp(word, "resize") == 0) {
+        step.kind = GScriptStep::RESIZE;
+        return (sscanf(rest, "%d %d", a, a + 1) == 2 && a[0] > 0 && a[1] > 0);
+    } else if (strcmp(word, "expose") == 0) {
+        step.kind = GScriptStep::EXPOSE;
+        return true;
+    } else if (strcmp(word, "wait") == 0) {
+        step.kind = GScriptStep::WAIT;
+        return (sscanf(rest, "%d", a) == 1 && a[0] >= 0);
+    } else if (strcmp(word, "frame") == 0) {
+        step.kind = GScriptStep::FRAME;
+        step.text = rest;
+        while (!step.text.empty() && isspace((unsigned char) *step.text.rbegin()))
+            step.text.erase(step.text.size() - 1);
+        return true;
+    } else if (strcmp(word, "close") == 0) {
+        step.kind = GScriptStep::CLOSE;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,97 @@
+//
+// File "gheadless.h"
+// Support of the headless mode of GWindow: colors and fonts
+// without an X server, a script of synthetic events,
+// and frames written as PPM images
+//
+
+#ifndef _GHEADLESS_H
+#define _GHEADLESS_H
+
+#include <string>
+#include <vector>
+
+extern "C" {
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+}
+
+#include "graster.h"
+
+// Pixel 0x00RRGGBB of a color: "#rgb", "#rrggbb" or a name
+// from rgb.txt (case and spaces are ignored).
+// Returns false if the color is unknown.
+bool headlessParseColor(const char* colorName, unsigned long* pixel);
+
+// Metrics of a fixed width font made up from its name:
+// "WxH" (as "9x15"), an XLFD name with the pixel size, or any other
+// name ("fixed") for 6x13. The structure is released by headlessFreeFont.
+XFontStruct* headlessCreateFont(Font fontID, const char* fontName);
+void headlessFreeFont(XFontStruct* fontStruct);
+
+// Glyphs of a headless font: printable characters are boxes
+// (shorter for lower case letters), the others are empty
+GGlyphMasks* headlessCreateGlyphs(const XFontStruct* fontStruct);
+
+// XLookupString for synthetic key events, which carry the keysym
+// in the keycode field. Shift gives upper case letters, Control
+// gives control characters.
+int headlessLookupString(
+    const XKeyEvent* event, char* buffer, int bufferLength, KeySym* keysym
+);
+
+// Write the rectangle (0, 0, width, height) of a raster
+// as a binary PPM (P6) image
+bool writeRasterPPM(
+    const GRaster& raster, int width, int height, const char* path
+);
+
+//
+// A script of events, one step per line ('#' starts a comment):
+//     key <keysym> [shift] [ctrl] [alt]    KeyPress, e.g. "key q ctrl"
+//     type <text>                          KeyPress for every character
+//     button <n> <x> <y>                   ButtonPress + ButtonRelease
+//     press <n> <x> <y>                    ButtonPress
+//     release <n> <x> <y>                  ButtonRelease
+//     motion <x> <y>                       MotionNotify
+//     resize <width> <height>              ConfigureNotify
+//     expose                               Expose of the whole window
+//     wait <ms>                            Run timers for ms milliseconds
+//     frame [path]                         Write the window in a PPM file
+//     close                                WM_DELETE_WINDOW message
+//
+struct GScriptStep {
+    enum Kind {
+        KEY, TYPE, BUTTON, PRESS, RELEASE, MOTION, RESIZE, EXPOSE,
+        WAIT, FRAME, CLOSE
+    };
+    Kind kind;
+    int args[3];            // Button/keysym, x, y; width, height; ms
+    unsigned int state;     // Modifiers of a key
+    std::string text;       // Text to type, path of a frame
+};
+
+class GEventScript {
+    std::vector<GScriptStep> m_Steps;
+    size_t m_Next;
+
+public:
+    GEventScript();
+
+    // Returns false if the file cannot be read; errors in lines
+    // are reported to stderr, and the lines are skipped
+    bool load(const char* path);
+
+    void clear();
+    void addStep(const GScriptStep& step);
+
+    bool atEnd() const { return m_Next >= m_Steps.size(); }
+    const GScriptStep& nextStep() { return m_Steps[m_Next++]; }
+
+private:
+    bool parseLine(const char* line, GScriptStep& step);
+};
+
+#endif /* _GHEADLESS_H */
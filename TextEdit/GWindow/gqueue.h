@@ -0,0 +1,83 @@
+//
+// File "gqueue.h"
+// Lock-free queue with many producer threads and one consumer
+//
+
+#ifndef _GQUEUE_H
+#define _GQUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+//
+// Producers push items onto a stack with compare-and-swap. The consumer
+// takes the whole stack by one exchange and reverses it, so the items
+// are seen in the order they were pushed; since nothing is popped
+// one by one, there is no ABA problem.
+//
+template <class T> class GMpscQueue {
+    struct Node {
+        T value;
+        Node* next;
+    };
+    std::atomic<Node*> m_Head;
+
+    GMpscQueue(const GMpscQueue&);              // Not copyable
+    GMpscQueue& operator=(const GMpscQueue&);
+
+public:
+    GMpscQueue(): m_Head(0) {}
+
+    ~GMpscQueue() {
+        Node* n = m_Head.exchange(0);
+        while (n != 0) {
+            Node* next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    // Any thread. Returns true if the queue was empty: the consumer
+    // may be waiting, and has to be woken up.
+    bool push(const T& value) {
+        Node* n = new Node;
+        n->value = value;
+        Node* head = m_Head.load(std::memory_order_relaxed);
+        do {
+            n->next = head;
+        } while (
+            !m_Head.compare_exchange_weak(
+                head, n, std::memory_order_release, std::memory_order_relaxed
+            )
+        );
+        return (head == 0);
+    }
+
+    bool empty() const {
+        return (m_Head.load(std::memory_order_acquire) == 0);
+    }
+
+    // The consumer thread only: calls f(item) for the items pushed
+    // so far, oldest first. Returns their number.
+    template <class F> size_t drain(F f) {
+        Node* n = m_Head.exchange(0, std::memory_order_acquire);
+        Node* fifo = 0;
+        while (n != 0) {
+            Node* next = n->next;
+            n->next = fifo;
+            fifo = n;
+            n = next;
+        }
+        size_t count = 0;
+        while (fifo != 0) {
+            Node* next = fifo->next;
+            f(fifo->value);
+            delete fifo;
+            fifo = next;
+            ++count;
+        }
+        return count;
+    }
+};
+
+#endif /* _GQUEUE_H */
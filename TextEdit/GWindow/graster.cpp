@@ -0,0 +1,363 @@
+//
+// File "graster.cpp"
+// Client-side 32-bit framebuffer, implementation
+//
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "graster.h"
+
+GRaster::GRaster():
+    m_Pixels(0),
+    m_Width(0),
+    m_Height(0),
+    m_Stride(0),
+    m_OwnPixels(false),
+    m_ClipXMin(0),
+    m_ClipYMin(0),
+    m_ClipXMax(0),
+    m_ClipYMax(0)
+{}
+
+GRaster::~GRaster() {
+    release();
+}
+
+void GRaster::release() {
+    if (m_OwnPixels)
+        free(m_Pixels);
+    m_Pixels = 0;
+    m_OwnPixels = false;
+    m_Width = 0;
+    m_Height = 0;
+    m_Stride = 0;
+    resetClip();
+}
+
+bool GRaster::create(int width, int height) {
+    release();
+    if (width <= 0 || height <= 0)
+        return false;
+    // Rows are aligned by 16 bytes for the vector stores
+    int stride = (width + 3) & ~3;
+    void* p = 0;
+    if (posix_memalign(&p, 16, (size_t) stride * height * 4) != 0)
+        return false;
+    memset(p, 0, (size_t) stride * height * 4);
+    m_Pixels = (uint32_t*) p;
+    m_OwnPixels = true;
+    m_Width = width;
+    m_Height = height;
+    m_Stride = stride;
+    resetClip();
+    return true;
+}
+
+void GRaster::attach(uint32_t* pixels, int width, int height, int stride) {
+    release();
+    m_Pixels = pixels;
+    m_Width = width;
+    m_Height = height;
+    m_Stride = stride;
+    resetClip();
+}
+
+void GRaster::copyFrom(const GRaster& src, int width, int height) {
+    if (width > m_Width) width = m_Width;
+    if (width > src.m_Width) width = src.m_Width;
+    if (height > m_Height) height = m_Height;
+    if (height > src.m_Height) height = src.m_Height;
+    if (width <= 0)
+        return;
+    for (int y = 0; y < height; ++y) {
+        memcpy(
+            m_Pixels + y * m_Stride, src.m_Pixels + y * src.m_Stride,
+            (size_t) width * 4
+        );
+    }
+}
+
+void GRaster::copyArea(
+    const GRaster& src, int srcX, int srcY, int width, int height,
+    int dstX, int dstY
+) {
+    // Clip by the source raster, then by the clip rectangle
+    if (srcX < 0) { width += srcX; dstX -= srcX; srcX = 0; }
+    if (srcY < 0) { height += srcY; dstY -= srcY; srcY = 0; }
+    width = std::min(width, src.m_Width - srcX);
+    height = std::min(height, src.m_Height - srcY);
+    if (dstX < m_ClipXMin) {
+        int d = m_ClipXMin - dstX;
+        width -= d; srcX += d; dstX += d;
+    }
+    if (dstY < m_ClipYMin) {
+        int d = m_ClipYMin - dstY;
+        height -= d; srcY += d; dstY += d;
+    }
+    width = std::min(width, m_ClipXMax - dstX);
+    height = std::min(height, m_ClipYMax - dstY);
+    if (width <= 0 || height <= 0)
+        return;
+
+    // The areas may overlap in the same raster: rows are copied
+    // from the bottom when the picture moves down
+    for (int k = 0; k < height; ++k) {
+        int row = (dstY > srcY)? height - 1 - k : k;
+        memmove(
+            m_Pixels + (dstY + row) * m_Stride + dstX,
+            src.m_Pixels + (srcY + row) * src.m_Stride + srcX,
+            (size_t) width * 4
+        );
+    }
+}
+
+void GRaster::setClip(int x, int y, int width, int height) {
+    m_ClipXMin = std::max(x, 0);
+    m_ClipYMin = std::max(y, 0);
+    m_ClipXMax = std::min(x + width, m_Width);
+    m_ClipYMax = std::min(y + height, m_Height);
+}
+
+void GRaster::resetClip() {
+    setClip(0, 0, m_Width, m_Height);
+}
+
+void GRaster::fillSpan(int y, int x1, int x2, uint32_t color) {
+    if (y < m_ClipYMin || y >= m_ClipYMax)
+        return;
+    if (x1 < m_ClipXMin)
+        x1 = m_ClipXMin;
+    if (x2 > m_ClipXMax)
+        x2 = m_ClipXMax;
+    if (x1 >= x2)
+        return;
+
+    uint32_t* p = m_Pixels + y * m_Stride + x1;
+    uint32_t* end = p + (x2 - x1);
+#ifdef __SSE2__
+    // Fill up to the 16-byte boundary, then 4 pixels per store
+    while (p < end && ((uintptr_t) p & 15) != 0)
+        *p++ = color;
+    __m128i v = _mm_set1_epi32((int) color);
+    while (end - p >= 16) {
+        _mm_store_si128((__m128i*) p, v);
+        _mm_store_si128((__m128i*) (p + 4), v);
+        _mm_store_si128((__m128i*) (p + 8), v);
+        _mm_store_si128((__m128i*) (p + 12), v);
+        p += 16;
+    }
+    while (end - p >= 4) {
+        _mm_store_si128((__m128i*) p, v);
+        p += 4;
+    }
+#endif
+    while (p < end)
+        *p++ = color;
+}
+
+void GRaster::fillRectangle(
+    int x, int y, int width, int height, uint32_t color
+) {
+    int y1 = std::max(y, m_ClipYMin);
+    int y2 = std::min(y + height, m_ClipYMax);
+    for (int row = y1; row < y2; ++row)
+        fillSpan(row, x, x + width, color);
+}
+
+void GRaster::drawLine(
+    int x1, int y1, int x2, int y2, uint32_t color,
+    int lineWidth /* = 0 */
+) {
+    if (lineWidth > 1) {
+        // A wide line is a rectangle along the segment (CapButt)
+        double dx = x2 - x1, dy = y2 - y1;
+        double len = sqrt(dx*dx + dy*dy);
+        if (len == 0.)
+            return;
+        double nx = -dy / len * lineWidth / 2.;
+        double ny = dx / len * lineWidth / 2.;
+        I2Point quad[4];
+        quad[0] = I2Point((int) floor(x1 + nx + 0.5), (int) floor(y1 + ny + 0.5));
+        quad[1] = I2Point((int) floor(x2 + nx + 0.5), (int) floor(y2 + ny + 0.5));
+        quad[2] = I2Point((int) floor(x2 - nx + 0.5), (int) floor(y2 - ny + 0.5));
+        quad[3] = I2Point((int) floor(x1 - nx + 0.5), (int) floor(y1 - ny + 0.5));
+        fillPolygon(quad, 4, color);
+        return;
+    }
+
+    // Horizontal lines are spans
+    if (y1 == y2) {
+        fillSpan(y1, std::min(x1, x2), std::max(x1, x2) + 1, color);
+        return;
+    }
+
+    // Bresenham along the major axis: the pixel i of the line is at
+    // the distance i along it and round(i * minor / major) across it.
+    // Only the steps inside the clip range of the major axis are done,
+    // starting with the error term of the first one, so the pixels
+    // do not depend on the clip rectangle.
+    bool steep = abs(y2 - y1) > abs(x2 - x1);
+    int major1 = x1, minor1 = y1, major2 = x2, minor2 = y2;
+    int clipMin = m_ClipXMin, clipMax = m_ClipXMax;
+    if (steep) {
+        major1 = y1; minor1 = x1; major2 = y2; minor2 = x2;
+        clipMin = m_ClipYMin; clipMax = m_ClipYMax;
+    }
+    int dMajor = abs(major2 - major1), sMajor = (major1 < major2)? 1 : (-1);
+    int dMinor = abs(minor2 - minor1), sMinor = (minor1 < minor2)? 1 : (-1);
+
+    // Steps [i1, i2] with the major coordinate in [clipMin, clipMax)
+    long long i1 = 0, i2 = dMajor;
+    if (sMajor > 0) {
+        i1 = std::max(i1, (long long) clipMin - major1);
+        i2 = std::min(i2, (long long) clipMax - 1 - major1);
+    } else {
+        i1 = std::max(i1, (long long) major1 - (clipMax - 1));
+        i2 = std::min(i2, (long long) major1 - clipMin);
+    }
+    if (i1 > i2)
+        return;
+
+    // Minor offset q = floor((2*i*dMinor + dMajor) / (2*dMajor)),
+    // remainder r of the division
+    long long num = 2 * i1 * dMinor + dMajor;
+    long long den = 2 * (long long) dMajor;
+    int q = (int)(num / den);
+    long long r = num % den;
+    int major = major1 + (int) i1 * sMajor;
+    int minor = minor1 + q * sMinor;
+    for (long long i = i1; i <= i2; ++i) {
+        if (steep)
+            setPixel(minor, major, color);
+        else
+            setPixel(major, minor, color);
+        major += sMajor;
+        r += 2 * dMinor;
+        if (r >= den) {
+            r -= den;
+            minor += sMinor;
+        }
+    }
+}
+
+// Scanline fill with the even-odd rule; pixel centers are sampled
+void GRaster::fillPolygon(
+    const I2Point* points, int numPoints, uint32_t color
+) {
+    if (numPoints < 3)
+        return;
+    int ymin = points[0].y, ymax = points[0].y;
+    for (int i = 1; i < numPoints; ++i) {
+        ymin = std::min(ymin, points[i].y);
+        ymax = std::max(ymax, points[i].y);
+    }
+    ymin = std::max(ymin, m_ClipYMin);
+    ymax = std::min(ymax, m_ClipYMax - 1);
+
+    std::vector<double> xs;
+    for (int y = ymin; y <= ymax; ++y) {
+        double yc = y + 0.5;
+        xs.clear();
+        for (int i = 0; i < numPoints; ++i) {
+            const I2Point& a = points[i];
+            const I2Point& b = points[(i + 1) % numPoints];
+            if ((a.y <= yc && b.y > yc) || (b.y <= yc && a.y > yc)) {
+                xs.push_back(
+                    a.x + (yc - a.y) * (double)(b.x - a.x) / (double)(b.y - a.y)
+                );
+            }
+        }
+        std::sort(xs.begin(), xs.end());
+        for (size_t k = 0; k + 1 < xs.size(); k += 2) {
+            // Pixels with centers inside [xs[k], xs[k+1])
+            int x1 = (int) ceil(xs[k] - 0.5);
+            int x2 = (int) ceil(xs[k+1] - 0.5);
+            fillSpan(y, x1, x2, color);
+        }
+    }
+}
+
+void GRaster::fillEllipse(
+    int x, int y, int width, int height, uint32_t color
+) {
+    if (width <= 0 || height <= 0)
+        return;
+    double a = width / 2., b = height / 2.;
+    double cx = x + a, cy = y + b;
+    int y1 = std::max(y, m_ClipYMin);
+    int y2 = std::min(y + height, m_ClipYMax);
+    for (int row = y1; row < y2; ++row) {
+        double t = (row + 0.5 - cy) / b;
+        if (t <= -1. || t >= 1.)
+            continue;
+        double dx = a * sqrt(1. - t*t);
+        fillSpan(
+            row, (int) ceil(cx - dx - 0.5), (int) ceil(cx + dx - 0.5), color
+        );
+    }
+}
+
+void GRaster::drawEllipse(
+    int x, int y, int width, int height, uint32_t color,
+    int lineWidth /* = 0 */
+) {
+    if (width < 0 || height < 0)
+        return;
+    // A polyline with about 2 pixels per segment
+    double a = width / 2., b = height / 2.;
+    double cx = x + a, cy = y + b;
+    int n = (int)((a + b) * 3.) + 8;
+    if (n > 4096)
+        n = 4096;
+    int px = (int) floor(cx + a + 0.5), py = (int) floor(cy + 0.5);
+    for (int i = 1; i <= n; ++i) {
+        double phi = 2. * M_PI * i / n;
+        int qx = (int) floor(cx + a * cos(phi) + 0.5);
+        int qy = (int) floor(cy + b * sin(phi) + 0.5);
+        drawLine(px, py, qx, qy, color, lineWidth);
+        px = qx; py = qy;
+    }
+}
+
+void GRaster::drawMask(
+    int x, int y, const unsigned char* mask,
+    int width, int height, int maskStride, uint32_t color
+) {
+    for (int row = 0; row < height; ++row) {
+        int py = y + row;
+        if (py < m_ClipYMin || py >= m_ClipYMax)
+            continue;
+        const unsigned char* m = mask + row * maskStride;
+        for (int col = 0; col < width; ++col) {
+            if (m[col] != 0)
+                setPixel(x + col, py, color);
+        }
+    }
+}
+
+int GRaster::drawString(
+    int x, int y, const char* str, int len,
+    const GGlyphMasks& glyphs, uint32_t color
+) {
+    int h = glyphs.ascent + glyphs.descent;
+    int stride = 16 * glyphs.cellWidth;
+    int x0 = x;
+    for (int i = 0; i < len; ++i) {
+        int c = (unsigned char) str[i];
+        drawMask(
+            x - glyphs.originX, y - glyphs.ascent,
+            &(glyphs.mask[(size_t)(c >> 4) * h * stride + (c & 15) * glyphs.cellWidth]),
+            glyphs.cellWidth, h, stride, color
+        );
+        x += glyphs.advance[c];
+    }
+    return x - x0;
+}
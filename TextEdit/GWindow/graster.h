@@ -0,0 +1,119 @@
+//
+// File "graster.h"
+// Client-side 32-bit framebuffer with simple rasterization
+// of lines, rectangles, polygons and ellipses
+//
+
+#ifndef _GRASTER_H
+#define _GRASTER_H
+
+#include <stdint.h>
+#include <vector>
+
+// Classes for simple 2-dimensional objects
+#include "R2Graph/R2Graph.h"
+
+//
+// Masks of 256 glyphs of a font: cells of equal size, 16 per row,
+// 1 byte per pixel (non-zero where the glyph is drawn)
+//
+struct GGlyphMasks {
+    int cellWidth;
+    int ascent;
+    int descent;
+    int originX;        // Origin of a glyph in its cell
+    short advance[256];
+    std::vector<unsigned char> mask;
+};
+
+//
+// Pixels are 32-bit values in the format of the X visual
+// (0x00RRGGBB for usual TrueColor visuals). The memory may be
+// allocated by the raster itself or supplied by the caller
+// (for instance, the data of a shared memory XImage).
+// All drawing is clipped by the clip rectangle.
+//
+class GRaster {
+    uint32_t* m_Pixels;
+    int m_Width;
+    int m_Height;
+    int m_Stride;           // In pixels
+    bool m_OwnPixels;
+
+    // Clip rectangle: xmin <= x < xmax, ymin <= y < ymax
+    int m_ClipXMin;
+    int m_ClipYMin;
+    int m_ClipXMax;
+    int m_ClipYMax;
+
+public:
+    GRaster();
+    ~GRaster();
+
+    // Allocate a framebuffer; the contents are lost
+    bool create(int width, int height);
+
+    // Use an external memory (not released by the raster)
+    void attach(uint32_t* pixels, int width, int height, int stride);
+
+    void release();
+
+    uint32_t* pixels() const { return m_Pixels; }
+    int width() const { return m_Width; }
+    int height() const { return m_Height; }
+    int stride() const { return m_Stride; }
+
+    // Copy a rectangle from another raster (both are clipped)
+    void copyFrom(const GRaster& src, int width, int height);
+
+    // Copy a rectangle of a raster (this one or another) to (dstX, dstY);
+    // the destination is clipped by the clip rectangle
+    void copyArea(
+        const GRaster& src, int srcX, int srcY, int width, int height,
+        int dstX, int dstY
+    );
+
+    void setClip(int x, int y, int width, int height);
+    void resetClip();
+
+    // Primitives. Coordinates are in pixels; rectangles and ellipses
+    // are given by the left-top corner, width and height, as in Xlib.
+    void fillSpan(int y, int x1, int x2, uint32_t color);  // [x1, x2)
+    void fillRectangle(int x, int y, int width, int height, uint32_t color);
+    void drawLine(
+        int x1, int y1, int x2, int y2, uint32_t color, int lineWidth = 0
+    );
+    void fillPolygon(const I2Point* points, int numPoints, uint32_t color);
+    void fillEllipse(int x, int y, int width, int height, uint32_t color);
+    void drawEllipse(
+        int x, int y, int width, int height, uint32_t color,
+        int lineWidth = 0
+    );
+
+    // Draw the pixels set in a 1-byte-per-pixel mask (glyphs)
+    void drawMask(
+        int x, int y, const unsigned char* mask,
+        int width, int height, int maskStride, uint32_t color
+    );
+
+    // Draw a string at the base point (x, y); returns the advance
+    int drawString(
+        int x, int y, const char* str, int len,
+        const GGlyphMasks& glyphs, uint32_t color
+    );
+
+private:
+    void setPixel(int x, int y, uint32_t color) {
+        if (
+            x >= m_ClipXMin && x < m_ClipXMax &&
+            y >= m_ClipYMin && y < m_ClipYMax
+        )
+            m_Pixels[y * m_Stride + x] = color;
+    }
+
+    // Not copyable
+    GRaster(const GRaster&);
+    GRaster& operator=(const GRaster&);
+};
+
+#endif /* _GRASTER_H */
@@ -0,0 +1,151 @@
+//
+// File "gtasks.cpp"
+// Pool of threads for background tasks, implementation
+//
+#include "gtasks.h"
+
+// Index of the worker of the current thread in its pool, or -1
+static thread_local const GTaskPool* currentPool = 0;
+static thread_local int currentWorker = (-1);
+
+GTaskPool::GTaskPool(int numThreads /* = 0 */):
+    m_NumThreads(0),
+    m_Workers(),
+    m_Threads(),
+    m_StartLock(),
+    m_SleepLock(),
+    m_Wake(),
+    m_Idle(),
+    m_Queued(0),
+    m_Running(0),
+    m_Stopping(false),
+    m_NextWorker(0)
+{
+    setNumThreads(numThreads);
+}
+
+GTaskPool::~GTaskPool() {
+    stop();
+}
+
+int GTaskPool::numThreads() const {
+    if (!m_Workers.empty())
+        return (int) m_Workers.size();
+    if (m_NumThreads > 0)
+        return m_NumThreads;
+    int n = (int) std::thread::hardware_concurrency();
+    return (n > 0)? n : 1;
+}
+
+void GTaskPool::start() {
+    int n = numThreads();
+    for (int i = 0; i < n; ++i)
+        m_Workers.push_back(new Worker);
+    for (int i = 0; i < n; ++i)
+        m_Threads.push_back(std::thread(&GTaskPool::run, this, i));
+}
+
+void GTaskPool::submit(const Task& task) {
+    int index = currentWorker;
+    if (currentPool == this) {
+        // A worker: the pool is running until the worker is done
+        push(index, task);
+        return;
+    }
+
+    // Other threads start the pool, or wait until it is stopped
+    std::lock_guard<std::mutex> guard(m_StartLock);
+    if (m_Workers.empty())
+        start();
+    index = (int)(m_NextWorker.fetch_add(1) % m_Workers.size());
+    push(index, task);
+}
+
+void GTaskPool::push(int index, const Task& task) {
+    {
+        // The counter never lags behind the deques
+        std::lock_guard<std::mutex> guard(m_SleepLock);
+        std::lock_guard<std::mutex> workerGuard(m_Workers[index]->lock);
+        m_Workers[index]->tasks.push_back(task);
+        ++m_Queued;
+    }
+    m_Wake.notify_one();
+}
+
+void GTaskPool::wait() {
+    std::unique_lock<std::mutex> guard(m_SleepLock);
+    while ((m_Queued > 0 || m_Running > 0) && !m_Stopping)
+        m_Idle.wait(guard);
+}
+
+void GTaskPool::stop() {
+    std::lock_guard<std::mutex> startGuard(m_StartLock);
+    if (m_Threads.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(m_SleepLock);
+        m_Stopping = true;
+    }
+    m_Wake.notify_all();
+    m_Idle.notify_all();
+    for (size_t i = 0; i < m_Threads.size(); ++i)
+        m_Threads[i].join();
+    m_Threads.clear();
+    for (size_t i = 0; i < m_Workers.size(); ++i)
+        delete m_Workers[i];
+    m_Workers.clear();
+    m_Queued = 0;
+    m_Running = 0;
+    m_Stopping = false;
+}
+
+// Own tasks are taken from the back, stolen ones from the front
+bool GTaskPool::takeTask(int index, Task& task) {
+    int n = (int) m_Workers.size();
+    for (int j = 0; j < n; ++j) {
+        Worker* w = m_Workers[(index + j) % n];
+        std::lock_guard<std::mutex> guard(w->lock);
+        if (w->tasks.empty())
+            continue;
+        if (j == 0) {
+            task.swap(w->tasks.back());
+            w->tasks.pop_back();
+        } else {
+            task.swap(w->tasks.front());
+            w->tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void GTaskPool::run(int index) {
+    currentPool = this;
+    currentWorker = index;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(m_SleepLock);
+            while (m_Queued == 0 && !m_Stopping)
+                m_Wake.wait(guard);
+            if (m_Stopping)
+                break;
+        }
+        Task task;
+        if (!takeTask(index, task))
+            continue;   // Taken by another worker meanwhile
+        {
+            std::lock_guard<std::mutex> guard(m_SleepLock);
+            --m_Queued;
+            ++m_Running;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> guard(m_SleepLock);
+            --m_Running;
+            if (m_Queued == 0 && m_Running == 0)
+                m_Idle.notify_all();
+        }
+    }
+    currentPool = 0;
+    currentWorker = (-1);
+}
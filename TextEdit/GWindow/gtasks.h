@@ -0,0 +1,81 @@
+//
+// File "gtasks.h"
+// Pool of threads for background tasks, with work stealing
+//
+
+#ifndef _GTASKS_H
+#define _GTASKS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// Every worker has its own deque of tasks. A task submitted by a worker
+// (a task that splits its work) goes to the back of the worker's deque,
+// other tasks are dealt to the workers in turn. A worker takes tasks
+// from the back of its deque; when the deque is empty, the worker
+// steals from the fronts of the others, and sleeps if there is
+// nothing to steal.
+//
+// Threads are started by the first "submit". Tasks must not throw.
+//
+class GTaskPool {
+public:
+    typedef std::function<void()> Task;
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    int m_NumThreads;           // 0: one thread per processor
+    std::vector<Worker*> m_Workers;
+    std::vector<std::thread> m_Threads;
+    std::mutex m_StartLock;     // Starting and stopping
+
+    std::mutex m_SleepLock;     // Guards the counters and m_Stopping
+    std::condition_variable m_Wake;
+    std::condition_variable m_Idle;
+    int m_Queued;               // Tasks in all deques
+    int m_Running;              // Tasks being performed
+    bool m_Stopping;
+    std::atomic<unsigned int> m_NextWorker;
+
+    GTaskPool(const GTaskPool&);                // Not copyable
+    GTaskPool& operator=(const GTaskPool&);
+
+public:
+    GTaskPool(int numThreads = 0);
+    ~GTaskPool();               // Stops the pool
+
+    // The number of threads can be changed before the pool is started.
+    // The owner thread only.
+    void setNumThreads(int n) { m_NumThreads = (n < 0)? 0 : n; }
+    int numThreads() const;     // Actual number of threads
+
+    // Any thread. The first call starts the pool.
+    void submit(const Task& task);
+
+    // Wait until all tasks are done, including the tasks they submit.
+    // Not for the tasks of the pool themselves.
+    void wait();
+
+    // Tasks being performed are finished, the queued ones are dropped.
+    // The pool may be started again by "submit". Not for the tasks
+    // of the pool themselves.
+    void stop();
+
+private:
+    void start();
+    void run(int index);
+    void push(int index, const Task& task);
+    bool takeTask(int index, Task& task);
+};
+
+#endif /* _GTASKS_H */
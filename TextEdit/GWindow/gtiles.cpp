@@ -0,0 +1,301 @@
+//
+// File "gtiles.cpp"
+// Parallel replay of a display list in a raster, implementation
+//
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include "gtiles.h"
+
+GTileRenderer::GTileRenderer(
+    int numThreads /* = 0 */, int tileSize /* = DEFAULT_TILE_SIZE */
+):
+    m_NumThreads(0),
+    m_TileSize(DEFAULT_TILE_SIZE),
+    m_Commands(),
+    m_Bins(),
+    m_TilesX(0),
+    m_TilesY(0),
+    m_Area(),
+    m_Pool()
+{
+    setNumThreads(numThreads);
+    setTileSize(tileSize);
+}
+
+void GTileRenderer::setNumThreads(int n) {
+    m_NumThreads = (n < 0)? 0 : n;
+    // The pool is started again with the new number
+    m_Pool.stop();
+}
+
+int GTileRenderer::numThreads() const {
+    if (m_NumThreads > 0)
+        return m_NumThreads;
+    int n = (int) std::thread::hardware_concurrency();
+    return (n > 0)? n : 1;
+}
+
+static const GGlyphMasks* findGlyphs(
+    const GGlyphTable& glyphs, unsigned long font
+) {
+    GGlyphTable::const_iterator i = glyphs.find(font);
+    if (i == glyphs.end())
+        return 0;
+    return i->second;
+}
+
+// Put a command with the box [x1, x2] x [y1, y2] in the bins
+// of the tiles it covers. The box of its pixels is added to "touched"
+// (x1, y1, x2, y2).
+void GTileRenderer::addCommand(
+    const Command& c, int x1, int y1, int x2, int y2, int* touched
+) {
+    // Pixels of a command: [x1, x2) x [y1, y2)
+    int margin = c.lineWidth / 2 + 1;
+    x1 = std::max(x1 - margin, m_Area.left());
+    y1 = std::max(y1 - margin, m_Area.top());
+    x2 = std::min(x2 + margin + 1, m_Area.right());
+    y2 = std::min(y2 + margin + 1, m_Area.bottom());
+    if (x1 >= x2 || y1 >= y2)
+        return;
+    touched[0] = std::min(touched[0], x1);
+    touched[1] = std::min(touched[1], y1);
+    touched[2] = std::max(touched[2], x2);
+    touched[3] = std::max(touched[3], y2);
+
+    int index = (int) m_Commands.size();
+    m_Commands.push_back(c);
+    int ax1 = m_Area.left(), ay1 = m_Area.top();
+    int tx1 = (x1 - ax1) / m_TileSize, tx2 = (x2 - 1 - ax1) / m_TileSize;
+    int ty1 = (y1 - ay1) / m_TileSize, ty2 = (y2 - 1 - ay1) / m_TileSize;
+    for (int ty = ty1; ty <= ty2; ++ty) {
+        for (int tx = tx1; tx <= tx2; ++tx)
+            m_Bins[ty * m_TilesX + tx].push_back(index);
+    }
+}
+
+// Resolve the state of every drawing command and put it in the bins
+// of the tiles it covers. Returns the box of all commands in the area.
+I2Rectangle GTileRenderer::binCommands(
+    const GDisplayList& list, const GTileState& state,
+    const GGlyphTable& glyphs
+) {
+    const std::vector<int>& d = list.m_Data;
+    int touched[4] = {               // Empty: x1 > x2, y1 > y2
+        m_Area.right(), m_Area.bottom(), m_Area.left(), m_Area.top()
+    };
+
+    Command c;
+    c.first = 0;
+    c.count = 0;
+    c.foreground = state.foreground;
+    c.lineWidth = state.lineWidth;
+    c.glyphs = findGlyphs(glyphs, state.font);
+
+    size_t i = 0;
+    while (i < d.size()) {
+        c.pos = (int) i;
+        int op = d[i++];
+        switch (op) {
+        case GDisplayList::OP_FOREGROUND:
+            c.foreground = (uint32_t) d[i++];
+            continue;
+        case GDisplayList::OP_BACKGROUND:
+            ++i;
+            continue;
+        case GDisplayList::OP_FONT:
+            c.glyphs = findGlyphs(glyphs, (unsigned long)(unsigned int) d[i++]);
+            continue;
+        case GDisplayList::OP_LINE_ATTRIBUTES:
+            c.lineWidth = d[i];
+            i += 4;
+            continue;
+        }
+
+        const int* box = &(d[i]);
+        i += 4;
+        if (op == GDisplayList::OP_POLYLINE) {
+            // Chunks of segments with their own boxes
+            int n = d[i];
+            const int* v = &(d[i + 1]);
+            for (int first = 0; first < n - 1; first += POLYLINE_CHUNK) {
+                int last = std::min(first + POLYLINE_CHUNK, n - 1);
+                int x1 = v[2*first], y1 = v[2*first + 1];
+                int x2 = x1, y2 = y1;
+                for (int k = first + 1; k <= last; ++k) {
+                    x1 = std::min(x1, v[2*k]); x2 = std::max(x2, v[2*k]);
+                    y1 = std::min(y1, v[2*k + 1]); y2 = std::max(y2, v[2*k + 1]);
+                }
+                c.first = first;
+                c.count = last - first;
+                addCommand(c, x1, y1, x2, y2, touched);
+            }
+            c.first = 0;
+            c.count = 0;
+            i += 1 + 2 * n;
+            continue;
+        }
+        if (op == GDisplayList::OP_FILL_POLYGON)
+            i += 1 + 2 * d[i];
+        else
+            i += 4;
+        addCommand(c, box[0], box[1], box[2], box[3], touched);
+    }
+
+    if (touched[0] >= touched[2] || touched[1] >= touched[3])
+        return I2Rectangle(0, 0, 0, 0);
+    return I2Rectangle(
+        touched[0], touched[1],
+        touched[2] - touched[0], touched[3] - touched[1]
+    );
+}
+
+I2Rectangle GTileRenderer::render(
+    const GDisplayList& list, GRaster& raster,
+    const I2Rectangle& area, const GTileState& state,
+    const GGlyphTable& glyphs
+) {
+    int x1 = std::max(area.left(), 0);
+    int y1 = std::max(area.top(), 0);
+    int x2 = std::min(area.right(), raster.width());
+    int y2 = std::min(area.bottom(), raster.height());
+    if (x1 >= x2 || y1 >= y2)
+        return I2Rectangle(0, 0, 0, 0);
+    m_Area = I2Rectangle(x1, y1, x2 - x1, y2 - y1);
+    m_TilesX = (x2 - x1 + m_TileSize - 1) / m_TileSize;
+    m_TilesY = (y2 - y1 + m_TileSize - 1) / m_TileSize;
+
+    m_Commands.clear();
+    m_Bins.resize(m_TilesX * m_TilesY);
+    for (size_t t = 0; t < m_Bins.size(); ++t)
+        m_Bins[t].clear();
+    I2Rectangle drawn = binCommands(list, state, glyphs);
+
+    std::vector<int> tiles;
+    for (int t = 0; t < m_TilesX * m_TilesY; ++t) {
+        if (!m_Bins[t].empty())
+            tiles.push_back(t);
+    }
+    int numTiles = (int) tiles.size();
+    int threads = std::min(numThreads(), numTiles);
+
+    if (threads <= 1) {
+        GRaster view;
+        std::vector<I2Point> points;
+        for (int k = 0; k < numTiles; ++k)
+            renderTile(tiles[k], list, raster, view, points);
+        return drawn;
+    }
+
+    // Contiguous ranges of tiles: [next, end)
+    struct TileRange {
+        std::mutex lock;
+        int next;
+        int end;
+    };
+    std::vector<TileRange> ranges(threads);
+    for (int k = 0; k < threads; ++k) {
+        ranges[k].next = (int)((long long) numTiles * k / threads);
+        ranges[k].end = (int)((long long) numTiles * (k + 1) / threads);
+    }
+
+    auto work = [&](int k) {
+        GRaster view;
+        std::vector<I2Point> points;
+        while (true) {
+            int t = (-1);
+            {
+                std::lock_guard<std::mutex> guard(ranges[k].lock);
+                if (ranges[k].next < ranges[k].end)
+                    t = tiles[ranges[k].next++];
+            }
+            // Steal from the end of another range
+            for (int j = 1; t < 0 && j < threads; ++j) {
+                TileRange& r = ranges[(k + j) % threads];
+                std::lock_guard<std::mutex> guard(r.lock);
+                if (r.next < r.end)
+                    t = tiles[--r.end];
+            }
+            if (t < 0)
+                break;
+            renderTile(t, list, raster, view, points);
+        }
+    };
+
+    // The calling thread is one of the workers
+    m_Pool.setNumThreads(numThreads() - 1);
+    for (int k = 1; k < threads; ++k)
+        m_Pool.submit([&work, k]() { work(k); });
+    work(0);
+    m_Pool.wait();
+    return drawn;
+}
+
+void GTileRenderer::renderTile(
+    int tile, const GDisplayList& list, GRaster& raster,
+    GRaster& view, std::vector<I2Point>& points
+) const {
+    int x = m_Area.left() + (tile % m_TilesX) * m_TileSize;
+    int y = m_Area.top() + (tile / m_TilesX) * m_TileSize;
+    int w = std::min(m_TileSize, m_Area.right() - x);
+    int h = std::min(m_TileSize, m_Area.bottom() - y);
+
+    // A view of the same pixels, clipped by the tile
+    view.attach(raster.pixels(), raster.width(), raster.height(), raster.stride());
+    view.setClip(x, y, w, h);
+
+    const std::vector<int>& bin = m_Bins[tile];
+    for (size_t k = 0; k < bin.size(); ++k)
+        drawCommand(m_Commands[bin[k]], list, view, points);
+}
+
+void GTileRenderer::drawCommand(
+    const Command& c, const GDisplayList& list,
+    GRaster& view, std::vector<I2Point>& points
+) const {
+    const std::vector<int>& d = list.m_Data;
+    int i = c.pos;
+    int op = d[i++];
+    i += 4;                     // Bounding box
+    switch (op) {
+    case GDisplayList::OP_POLYLINE: {
+            const int* v = &(d[i + 1]) + 2 * c.first;
+            for (int k = 0; k < c.count; ++k) {
+                view.drawLine(
+                    v[2*k], v[2*k + 1], v[2*k + 2], v[2*k + 3],
+                    c.foreground, c.lineWidth
+                );
+            }
+        }
+        break;
+    case GDisplayList::OP_FILL_POLYGON: {
+            int n = d[i++];
+            points.resize(n);
+            for (int k = 0; k < n; ++k)
+                points[k] = I2Point(d[i + 2*k], d[i + 2*k + 1]);
+            view.fillPolygon(&(points[0]), n, c.foreground);
+        }
+        break;
+    case GDisplayList::OP_FILL_RECTANGLE:
+        view.fillRectangle(d[i], d[i+1], d[i+2], d[i+3], c.foreground);
+        break;
+    case GDisplayList::OP_FILL_ELLIPSE:
+        view.fillEllipse(d[i], d[i+1], d[i+2], d[i+3], c.foreground);
+        break;
+    case GDisplayList::OP_DRAW_ELLIPSE:
+        view.drawEllipse(
+            d[i], d[i+1], d[i+2], d[i+3], c.foreground, c.lineWidth
+        );
+        break;
+    case GDisplayList::OP_STRING:
+        if (c.glyphs != 0 && d[i+3] > 0) {
+            view.drawString(
+                d[i], d[i+1], &(list.m_Text[d[i+2]]), d[i+3],
+                *(c.glyphs), c.foreground
+            );
+        }
+        break;
+    }
+}
@@ -0,0 +1,103 @@
+//
+// File "gtiles.h"
+// Parallel replay of a display list in a raster: the picture is
+// divided in tiles, and the tiles are rasterized by a pool of threads
+//
+
+#ifndef _GTILES_H
+#define _GTILES_H
+
+#include <vector>
+#include <unordered_map>
+
+#include "graster.h"
+#include "gdisplaylist.h"
+#include "gtasks.h"
+
+// Drawing state at the beginning of a display list
+struct GTileState {
+    uint32_t foreground;
+    int lineWidth;
+    unsigned long font;         // Font
+};
+
+// Glyph masks of fonts, Font -> masks
+typedef std::unordered_map<unsigned long, GGlyphMasks*> GGlyphTable;
+
+//
+// Every drawing command of a list is put in the bins of the tiles
+// its bounding box intersects. A polyline is split in chunks of a few
+// segments, each with its own box, so a long plot is not replayed
+// in full by every tile. A tile is rasterized by one thread with
+// the raster clipped by the tile, and its commands are performed in
+// the order of the list. A pixel belongs to exactly one tile, so the
+// picture does not depend on the number of threads.
+//
+// Each thread takes tiles from its own contiguous range; when the range
+// is done, the thread steals tiles from the ends of the other ranges.
+// The threads are kept in a pool between the calls of "render".
+//
+class GTileRenderer {
+public:
+    enum {
+        DEFAULT_TILE_SIZE = 64,
+        POLYLINE_CHUNK = 16     // Segments of a polyline per command
+    };
+
+private:
+    // A drawing command with the state it is drawn in
+    struct Command {
+        int pos;                // Position of the opcode in the list
+        int first;              // Polyline: first segment of the chunk
+        int count;              //     and the number of segments
+        uint32_t foreground;
+        int lineWidth;
+        const GGlyphMasks* glyphs;
+    };
+
+    int m_NumThreads;           // 0: one thread per processor
+    int m_TileSize;
+
+    std::vector<Command> m_Commands;
+    std::vector< std::vector<int> > m_Bins;     // Commands of tiles
+    int m_TilesX;
+    int m_TilesY;
+    I2Rectangle m_Area;
+
+    GTaskPool m_Pool;           // Helpers of the calling thread
+
+public:
+    GTileRenderer(int numThreads = 0, int tileSize = DEFAULT_TILE_SIZE);
+
+    void setNumThreads(int n);
+    int numThreads() const;     // Actual number of threads
+    void setTileSize(int size) { m_TileSize = (size < 8)? 8 : size; }
+    int tileSize() const { return m_TileSize; }
+
+    // Replay a list in the area of a raster. Returns the box
+    // of the area touched by the commands.
+    I2Rectangle render(
+        const GDisplayList& list, GRaster& raster,
+        const I2Rectangle& area, const GTileState& state,
+        const GGlyphTable& glyphs
+    );
+
+private:
+    void addCommand(
+        const Command& c, int x1, int y1, int x2, int y2, int* touched
+    );
+    I2Rectangle binCommands(
+        const GDisplayList& list, const GTileState& state,
+        const GGlyphTable& glyphs
+    );
+    void renderTile(
+        int tile, const GDisplayList& list, GRaster& raster,
+        GRaster& view, std::vector<I2Point>& points
+    ) const;
+    void drawCommand(
+        const Command& c, const GDisplayList& list,
+        GRaster& view, std::vector<I2Point>& points
+    ) const;
+};
+
+#endif /* _GTILES_H */
@@ -9,14 +9,46 @@
 #include <sys/time.h>       
 #include <sys/types.h>       
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>      // Batched map of point arrays
+#endif
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
 
 #include "gwindow.h"
+#include "gheadless.h"      // Fonts, colors and events without a server
+#include "gclip.h"          // Clipping of segments and polygons
+#include "gqueue.h"         // Commands posted by other threads
+
+extern "C" {
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/eventfd.h>
+#include <X11/extensions/XShm.h>    // MIT-SHM for the raster buffer
+#include <X11/Xatom.h>
+
+#ifdef GWINDOW_XCB
+#include <xcb/xcb.h>
+#include <X11/Xlib-xcb.h>           // XGetXCBConnection
+#endif
+
+}
 
 Display* GWindow::m_Display = 0;
 int      GWindow::m_Screen = 0;
 Atom     GWindow::m_WMProtocolsAtom = 0;
 Atom     GWindow::m_WMDeleteWindowAtom = 0;
+XContext GWindow::m_WindowContext = 0;
+bool     GWindow::m_Headless = false;
 
 int        GWindow::m_NumWindows = 0;
 int        GWindow::m_NumCreatedWindows = 0;
@@ -28,19 +60,628 @@ ListHeader GWindow::m_FontList(
                &GWindow::m_FontList, &GWindow::m_FontList
            );
 
-bool GWindow::getNextEvent(XEvent& e) {
-    long eventMask =  
-        ExposureMask | ButtonPressMask | ButtonReleaseMask
-        | KeyPressMask | PointerMotionMask
-        | StructureNotifyMask       // For resize event
-        | SubstructureNotifyMask
-        | FocusChangeMask;
+ListHeader GWindow::m_AtlasList(
+               &GWindow::m_AtlasList, &GWindow::m_AtlasList
+           );
+int         GWindow::m_NumAtlases = 0;
+TextBackend GWindow::m_TextBackend = TEXT_BACKEND_CORE;
+OffscreenBackend GWindow::m_OffscreenBackend = OFFSCREEN_BACKEND_PIXMAP;
+bool        GWindow::m_InvalidWindows = false;
+bool        GWindow::m_FlushRequested = false;
+
+// Atlases are kept in LRU order; the oldest ones are released.
+// An atlas has 256 cells, ATLAS_COLUMNS per row.
+static const int MAX_ATLASES = 8;
+static const int ATLAS_COLUMNS = 16;
+
+// Process-wide cache of colors: name -> pixel.
+// A name is resolved by the server only once per connection.
+static std::unordered_map<std::string, unsigned long> colorCache;
+
+// Process-wide cache of fonts, indexed by name and by Font id.
+// The descriptors themselves are kept in GWindow::m_FontList.
+static std::unordered_map<std::string, FontDescriptor*> fontsByName;
+static std::unordered_map<Font, FontDescriptor*> fontsByID;
+
+// Consecutive connected segments are collected in one XDrawLines
+// request. The batch is sent when a segment is not connected to it,
+// when it is full, before any other drawing or change of the GC,
+// and before the message loop reads events.
+static const int LINE_BATCH_SIZE = 4096;     // Points
+static XPoint   lineBatch[LINE_BATCH_SIZE];
+static int      lineBatchLength = 0;
+static Drawable lineBatchDrawable = 0;
+static GC       lineBatchGC = 0;
+
+// Primitives are culled when their box misses the window (widened by
+// the line width), and clipped only when they reach beyond a guard
+// band around it: coordinates in the band fit in the 16 bits of X
+// requests, and clipping there moves no visible pixels.
+static const int GUARD_BAND = 4096;
+static const int MAX_ELLIPSE_VERTICES = 16384;
+
+static short saturateShort(int v) {
+    if (v < SHRT_MIN)
+        return SHRT_MIN;
+    if (v > SHRT_MAX)
+        return SHRT_MAX;
+    return (short) v;
+}
+
+// Scratch buffers for arrays of points. They only grow,
+// so that drawing of a polygon does not allocate memory.
+static std::vector<I2Point> scratchPoints;
+static std::vector<XPoint> scratchXPoints;
+static std::vector<I2Point> clippedPoints;
+
+template <class T> static T* scratchBuffer(std::vector<T>& buffer, int n) {
+    if ((int) buffer.size() < n)
+        buffer.resize(n);
+    return &(buffer[0]);
+}
+
+#ifdef GWINDOW_XCB
+// Requests sent through the XCB connection of the display without
+// waiting for the replies. The replies are collected when the atoms,
+// colors and fonts are used; by then most of them have arrived
+// together, in one round trip.
+struct PendingFont {
+    Font fontID;
+    xcb_void_cookie_t open;         // Checked: the name may be wrong
+    xcb_query_font_cookie_t query;
+};
+static xcb_connection_t* xcbConnection = 0;
+static xcb_intern_atom_cookie_t atomCookies[2];
+static bool atomsPending = false;
+static std::unordered_map<std::string, xcb_alloc_named_color_cookie_t>
+    pendingColors;
+static std::unordered_map<std::string, PendingFont> pendingFonts;
+#endif
+
+// Replies to the atom requests sent by initX
+static void collectAtoms() {
+#ifdef GWINDOW_XCB
+    if (!atomsPending)
+        return;
+    atomsPending = false;
+    Atom* atoms[2] = {
+        &GWindow::m_WMProtocolsAtom, &GWindow::m_WMDeleteWindowAtom
+    };
+    for (int i = 0; i < 2; ++i) {
+        xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(
+            xcbConnection, atomCookies[i], 0
+        );
+        if (reply != 0) {
+            *(atoms[i]) = reply->atom;
+            free(reply);
+        }
+    }
+#endif
+}
+
+// Image of a raster offscreen buffer. With MIT-SHM the pixels are
+// in a shared memory segment and XShmPutImage does not copy them
+// through the socket; the server may read the segment after the
+// request is sent, so the raster is not touched until the server
+// reports the end of every XShmPutImage by a ShmCompletion event.
+struct RasterImage {
+    XImage* image;
+    XShmSegmentInfo shmInfo;
+    bool shared;
+    int pending;        // Number of XShmPutImage not completed yet
+};
+
+// Type of ShmCompletion events; -1 until a shared image is created
+static int shmCompletionType = (-1);
+
+static Bool isShmCompletion(Display*, XEvent* e, XPointer arg) {
+    const RasterImage* ri = (const RasterImage*) arg;
     return (
-        XCheckMaskEvent(m_Display, eventMask, &e) != 0 ||
-        XCheckTypedEvent(m_Display, ClientMessage, &e) != 0
+        e->type == shmCompletionType &&
+        ((XShmCompletionEvent*) e)->shmseg == ri->shmInfo.shmseg
+    );
+}
+
+// Masks of glyphs for the raster offscreen buffer are read back
+// from the server once per font; Font 0 is the default font
+// of a graphic context.
+static GGlyphTable rasterGlyphs;
+
+// Display lists replayed in a raster buffer are rasterized in parallel
+// when they have at least TILED_MIN_COMMANDS commands
+static GTileRenderer tileRenderer;
+static const int TILED_MIN_COMMANDS = 256;
+
+static void releaseRasterGlyphs(Font fontID) {
+    GGlyphTable::iterator i = rasterGlyphs.find(fontID);
+    if (i != rasterGlyphs.end()) {
+        delete i->second;
+        rasterGlyphs.erase(i);
+    }
+}
+
+static void releaseAllRasterGlyphs() {
+    GGlyphTable::iterator i;
+    for (i = rasterGlyphs.begin(); i != rasterGlyphs.end(); ++i)
+        delete i->second;
+    rasterGlyphs.clear();
+}
+
+// Headless mode. Windows have made up ids and are found through
+// headlessWindows; events are taken from a queue, which is filled
+// by the steps of the script when the message loop is idle.
+// Time is virtual and passes only in the "wait" steps; it does not
+// start from 0, since 0 means "unset" for some timestamps.
+static std::unordered_map<Window, GWindow*> headlessWindows;
+static Window lastHeadlessWindow = 0x200000;
+static Font lastHeadlessFont = 0x100;
+static std::deque<XEvent> headlessEvents;
+static GEventScript eventScript;
+static long long virtualTime = 1000000000LL;    // Nanoseconds
+static long long waitDeadline = 0;      // End of the current "wait" step
+static unsigned int buttonState = 0;    // Buttons pressed by the script
+static int closeRequests = 0;           // Attempts to close after the end
+static const char* framePrefix = 0;     // GWINDOW_PPM
+static int frameNumber = 0;
+static const int HEADLESS_SCREEN_WIDTH = 1280;
+static const int HEADLESS_SCREEN_HEIGHT = 1024;
+static const int HEADLESS_DEFAULT_WAIT = 10000;     // Without a script, ms
+
+// Drawing commands posted by other threads. A producer that finds
+// the queue empty writes to the eventfd, which wakes the message loop.
+static GMpscQueue<GDrawCommand*> commandQueue;
+static int wakeupFd = (-1);
+static std::once_flag wakeupOnce;
+
+static void createWakeup() {
+    wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd < 0)
+        perror("eventfd");
+}
+
+static void wakeUpLoop() {
+    std::call_once(wakeupOnce, createWakeup);
+    if (wakeupFd >= 0) {
+        uint64_t one = 1;
+        ssize_t res = write(wakeupFd, &one, sizeof(one));
+        (void) res;     // The counter is full: the loop is awake anyway
+    }
+}
+
+// Background tasks, and completions of the tasks done
+// waiting for the message loop
+static GTaskPool taskPool;
+static GMpscQueue<GTaskPool::Task*> completionQueue;
+
+// File descriptors watched by the message loop
+struct FdWatch {
+    int fd;
+    short events;
+    GWindow::FdHandler handler;
+    void* data;
+};
+static std::vector<FdWatch> fdWatches;
+
+// Timer heap: the nearest deadline is at the front
+struct TimerEntry {
+    long long deadline;         // Monotonic time, nanoseconds
+    long long interval;         // 0 for a one-shot timer
+    int id;
+    GWindow* window;
+};
+
+static bool laterDeadline(const TimerEntry& t1, const TimerEntry& t2) {
+    return (t1.deadline > t2.deadline);
+}
+
+static std::vector<TimerEntry> timerHeap;
+static int lastTimerID = 0;
+static unsigned long numMissedDeadlines = 0;
+static unsigned long numCoalescedEvents = 0;
+
+// Under a steady flow of events the windows are painted at most
+// once per frame; a burst of events is painted when it is over
+static const long long PAINT_INTERVAL = 16000000LL;     // Nanoseconds
+static long long lastPaintTime = 0;
+
+static long long monotonicTime() {
+    if (GWindow::m_Headless)
+        return virtualTime;
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + (long long) t.tv_nsec;
+}
+
+static int addTimer(GWindow* w, long long delay, long long interval) {
+    TimerEntry t;
+    t.deadline = monotonicTime() + delay;
+    t.interval = interval;
+    t.id = ++lastTimerID;
+    t.window = w;
+    timerHeap.push_back(t);
+    std::push_heap(timerHeap.begin(), timerHeap.end(), laterDeadline);
+    return t.id;
+}
+
+int GWindow::setTimer(int delayMs, int intervalMs /* = 0 */) {
+    if (delayMs < 0)
+        delayMs = 0;
+    if (intervalMs < 0)
+        intervalMs = 0;
+    return addTimer(
+        this,
+        (long long) delayMs * 1000000LL,
+        (long long) intervalMs * 1000000LL
     );
 }
 
+int GWindow::setFrameRate(double framesPerSecond) {
+    if (framesPerSecond <= 0.)
+        return 0;
+    long long interval = (long long)(1e9 / framesPerSecond);
+    if (interval <= 0)
+        interval = 1;
+    return addTimer(this, interval, interval);
+}
+
+void GWindow::killTimer(int timerID) {
+    for (size_t i = 0; i < timerHeap.size(); ++i) {
+        if (timerHeap[i].id == timerID) {
+            timerHeap.erase(timerHeap.begin() + i);
+            std::make_heap(timerHeap.begin(), timerHeap.end(), laterDeadline);
+            return;
+        }
+    }
+}
+
+void GWindow::killTimers() {
+    size_t n = 0;
+    for (size_t i = 0; i < timerHeap.size(); ++i) {
+        if (timerHeap[i].window != this)
+            timerHeap[n++] = timerHeap[i];
+    }
+    if (n == timerHeap.size())
+        return;
+    timerHeap.resize(n);
+    std::make_heap(timerHeap.begin(), timerHeap.end(), laterDeadline);
+}
+
+int GWindow::dispatchTimers() {
+    // One moment for all the timers: a periodic timer is put after it,
+    // so it fires at most once per call, even if its handler takes
+    // longer than its interval
+    long long now = monotonicTime();
+    while (timerHeap.size() > 0 && timerHeap.front().deadline <= now) {
+        std::pop_heap(timerHeap.begin(), timerHeap.end(), laterDeadline);
+        TimerEntry t = timerHeap.back();
+        timerHeap.pop_back();
+
+        int missed = 0;
+        if (t.interval > 0) {
+            // Keep the phase; skip the periods that are already over
+            long long late = now - t.deadline;
+            missed = (int)(late / t.interval);
+            numMissedDeadlines += missed;
+            t.deadline += (long long)(missed + 1) * t.interval;
+            timerHeap.push_back(t);
+            std::push_heap(timerHeap.begin(), timerHeap.end(), laterDeadline);
+        }
+
+        // The handler may set or kill timers
+        t.window->onTimer(t.id, missed);
+    }
+
+    if (timerHeap.size() == 0)
+        return (-1);
+    long long dt = timerHeap.front().deadline - monotonicTime();
+    if (dt < 0)
+        dt = 0;
+    return (int)((dt + 999999LL) / 1000000LL);     // Round up
+}
+
+unsigned long GWindow::missedDeadlines() {
+    return numMissedDeadlines;
+}
+
+bool GWindow::getNextEvent(XEvent& e) {
+    // XPending flushes the output buffer and reads the events
+    // already available on the connection, but never blocks.
+    // All events are taken (not only the ones matching a mask),
+    // so that NoExpose, GraphicsExpose, etc. do not stay
+    // in the queue forever; dispatchEvent ignores them.
+    flushLines();
+    if (m_Headless) {
+        if (headlessEvents.empty())
+            return false;
+        e = headlessEvents.front();
+        headlessEvents.pop_front();
+        return true;
+    }
+    if (XPending(m_Display) == 0)
+        return false;
+    XNextEvent(m_Display, &e);
+    coalesceEvent(e);
+    return true;
+}
+
+void GWindow::coalesceEvent(XEvent& e) {
+    if (
+        e.type != MotionNotify && e.type != ConfigureNotify &&
+        e.type != Expose
+    )
+        return;
+    GWindow* w = findWindow(e.xany.window);
+    if (w == 0 || !w->m_CoalesceEvents)
+        return;
+
+    XEvent next;
+    if (e.type == MotionNotify) {
+        // Only consecutive motions are merged, so that the order
+        // of motions and button/key events is kept
+        while (XEventsQueued(m_Display, QueuedAfterReading) > 0) {
+            XPeekEvent(m_Display, &next);
+            if (
+                next.type != MotionNotify ||
+                next.xany.window != e.xany.window
+            )
+                break;
+            XNextEvent(m_Display, &e);
+            ++numCoalescedEvents;
+        }
+    } else if (e.type == ConfigureNotify) {
+        // Only the final size matters
+        while (
+            XCheckTypedWindowEvent(
+                m_Display, e.xany.window, ConfigureNotify, &next
+            )
+        ) {
+            e = next;
+            ++numCoalescedEvents;
+        }
+    } else {
+        // Add the damaged rectangles to the region of the window;
+        // the last event is dispatched
+        while (
+            XCheckTypedWindowEvent(m_Display, e.xany.window, Expose, &next)
+        ) {
+            w->addExposeRectangle(e);
+            e = next;
+            ++numCoalescedEvents;
+        }
+    }
+}
+
+unsigned long GWindow::coalescedEvents() {
+    return numCoalescedEvents;
+}
+
+bool GWindow::waitForEvents(int timeoutMs /* = (-1) */) {
+    if (m_Headless)
+        return waitForHeadlessEvents();
+
+    // Commands of other threads are performed before painting,
+    // so that the areas they invalidate are painted in this pass
+    performCommands();
+
+    // Wake up at the nearest timer deadline
+    int timerTimeout = dispatchTimers();
+    if (
+        timerTimeout >= 0 &&
+        (timeoutMs < 0 || timerTimeout < timeoutMs)
+    )
+        timeoutMs = timerTimeout;
+
+    // The loop is idle: paint the invalidated areas
+    paintInvalidWindows();
+    flushLines();
+    notifyFlushed();
+
+    if (m_Display != 0 && XPending(m_Display) > 0)
+        return true;
+
+    std::vector<pollfd> fds;
+    if (m_Display != 0) {
+        pollfd p;
+        p.fd = ConnectionNumber(m_Display);
+        p.events = POLLIN;
+        p.revents = 0;
+        fds.push_back(p);
+    }
+    std::call_once(wakeupOnce, createWakeup);
+    int wakeupIndex = (-1);
+    if (wakeupFd >= 0) {
+        pollfd p;
+        p.fd = wakeupFd;
+        p.events = POLLIN;
+        p.revents = 0;
+        wakeupIndex = (int) fds.size();
+        fds.push_back(p);
+    }
+    int firstWatch = (int) fds.size();
+
+    // Handlers may add or remove watches, so we work on a copy
+    std::vector<FdWatch> watches(fdWatches);
+    for (size_t i = 0; i < watches.size(); ++i) {
+        pollfd p;
+        p.fd = watches[i].fd;
+        p.events = watches[i].events;
+        p.revents = 0;
+        fds.push_back(p);
+    }
+    if (fds.size() == 0) {
+        // Nothing to watch: just sleep until the timeout
+        if (timeoutMs > 0)
+            poll(0, 0, timeoutMs);
+        dispatchTimers();
+        return false;
+    }
+
+    int n = poll(&(fds[0]), fds.size(), timeoutMs);
+    if (n <= 0) {
+        // Timeout, or interrupted by a signal (EINTR)
+        if (n < 0 && errno != EINTR)
+            perror("poll");
+        dispatchTimers();
+        return false;
+    }
+
+    if (wakeupIndex >= 0 && fds[wakeupIndex].revents != 0) {
+        uint64_t counter;
+        ssize_t res = read(wakeupFd, &counter, sizeof(counter));
+        (void) res;
+        performCommands();
+    }
+    for (size_t i = 0; i < watches.size(); ++i) {
+        short revents = fds[firstWatch + i].revents;
+        if (revents != 0)
+            watches[i].handler(watches[i].fd, revents, watches[i].data);
+    }
+    dispatchTimers();
+    return (m_Display != 0 && firstWatch > 0 && fds[0].revents != 0);
+}
+
+void GWindow::postDisplayList(
+    Window w, GDisplayList* list, bool offscreen /* = true */
+) {
+    GDrawCommand* c = new GDrawCommand;
+    c->type = GDrawCommand::DISPLAY_LIST;
+    c->window = w;
+    c->offscreen = offscreen;
+    c->list = list;
+    if (commandQueue.push(c))
+        wakeUpLoop();
+}
+
+void GWindow::postImage(
+    Window w, int x, int y, int width, int height,
+    const uint32_t* pixels, bool offscreen /* = true */
+) {
+    if (width <= 0 || height <= 0)
+        return;
+    GDrawCommand* c = new GDrawCommand;
+    c->type = GDrawCommand::IMAGE;
+    c->window = w;
+    c->offscreen = offscreen;
+    c->x = x; c->y = y;
+    c->width = width; c->height = height;
+    c->pixels.assign(pixels, pixels + (size_t) width * height);
+    if (commandQueue.push(c))
+        wakeUpLoop();
+}
+
+void GWindow::processPendingWork() {
+    performCommands();
+    dispatchTimers();
+    bool drained;
+    if (m_Headless)
+        drained = headlessEvents.empty();
+    else
+        drained = (
+            m_Display == 0 ||
+            XEventsQueued(m_Display, QueuedAlready) == 0
+        );
+    if (drained || monotonicTime() - lastPaintTime >= PAINT_INTERVAL)
+        paintInvalidWindows();
+    flushLines();
+    notifyFlushed();
+}
+
+// The thread of the message loop: perform the commands posted so far,
+// and call the completions of background tasks
+void GWindow::performCommands() {
+    if (!completionQueue.empty()) {
+        completionQueue.drain([](GTaskPool::Task* completion) {
+            (*completion)();
+            delete completion;
+        });
+    }
+    if (commandQueue.empty())
+        return;
+    commandQueue.drain([](GDrawCommand* c) {
+        GWindow* w = findWindow(c->window);
+        if (w != 0 && w->m_WindowCreated)
+            w->onCommand(*c);
+        delete c;
+    });
+    GWindow* w = (GWindow*) m_WindowList.next;
+    for (; w != (GWindow*) &m_WindowList; w = (GWindow*) w->next) {
+        if (w->m_SwapAfterCommands) {
+            w->m_SwapAfterCommands = false;
+            if (w->m_WindowCreated)
+                w->swapBuffers();
+        }
+    }
+}
+
+void GWindow::runInBackground(
+    const GTaskPool::Task& task,
+    const GTaskPool::Task& completion /* = GTaskPool::Task() */
+) {
+    taskPool.submit([task, completion]() {
+        task();
+        if (completion) {
+            if (completionQueue.push(new GTaskPool::Task(completion)))
+                wakeUpLoop();
+        }
+    });
+}
+
+void GWindow::runTask(
+    const GTaskPool::Task& task,
+    const GTaskPool::Task& completion /* = GTaskPool::Task() */
+) {
+    if (!completion) {
+        runInBackground(task);
+        return;
+    }
+    Window w = m_Window;
+    runInBackground(task, [w, completion]() {
+        GWindow* window = findWindow(w);
+        if (window != 0 && window->m_WindowCreated)
+            completion();
+    });
+}
+
+void GWindow::setNumTaskThreads(int numThreads) {
+    taskPool.setNumThreads(numThreads);
+}
+
+void GWindow::onCommand(GDrawCommand& command) {
+    bool offscreen = command.offscreen && hasOffscreenBuffer();
+    if (command.type == GDrawCommand::DISPLAY_LIST) {
+        if (command.list != 0)
+            drawDisplayList(*(command.list), offscreen);
+    } else if (command.type == GDrawCommand::IMAGE) {
+        drawImage(
+            command.x, command.y, command.width, command.height,
+            &(command.pixels[0]), offscreen
+        );
+    }
+    if (offscreen)
+        m_SwapAfterCommands = true;
+}
+
+void GWindow::addFdHandler(
+    int fd, short events, FdHandler handler, void* data /* = 0 */
+) {
+    removeFdHandler(fd);
+    FdWatch w;
+    w.fd = fd;
+    w.events = events;
+    w.handler = handler;
+    w.data = data;
+    fdWatches.push_back(w);
+}
+
+void GWindow::removeFdHandler(int fd) {
+    for (size_t i = 0; i < fdWatches.size(); ++i) {
+        if (fdWatches[i].fd == fd) {
+            fdWatches.erase(fdWatches.begin() + i);
+            return;
+        }
+    }
+}
+
 void GWindow::messageLoop(GWindow* dialogWnd /* = 0 */) {
     XEvent event;
 
@@ -52,17 +693,16 @@ void GWindow::messageLoop(GWindow* dialogWnd /* = 0 */) {
         m_NumCreatedWindows > 0 &&
         (dialogWnd == 0 || dialogWnd->m_Window != 0)
     ) {
-        //... XNextEvent(m_Display, &event);
         if (!getNextEvent(event)) {
-            // Sleep a bit
-            timeval dt;
-            dt.tv_sec = 0;
-            dt.tv_usec = 10000;         // 0.01 sec
-            select(1, 0, 0, 0, &dt);    // sleep...
+            // Sleep until something happens
+            waitForEvents();
             continue;
         }
         // printf("got event: type=%d\n", event.type);
         dispatchEvent(event);
+
+        // Commands and timers are not delayed by a flow of events
+        processPendingWork();
     }
 
     while (getNextEvent(event)) {
@@ -82,53 +722,21 @@ void GWindow::dispatchEvent(XEvent& event) {
         */
         return;
     }
-    if (event.type == Expose) {
+    if (event.type == shmCompletionType) {
+        // The server has read the shared raster; events of a released
+        // raster (another segment) are ignored
+        RasterImage* ri = w->m_RasterImage;
+        if (
+            ri != 0 && ri->pending > 0 &&
+            isShmCompletion(m_Display, &event, (XPointer) ri)
+        )
+            --(ri->pending);
+    } else if (event.type == Expose) {
         // printf("Expose event.\n");
-        if (w->m_BeginExposeSeries) {
-            w->m_ClipRectangle.x = event.xexpose.x;
-            w->m_ClipRectangle.y = event.xexpose.y;
-            w->m_ClipRectangle.width = event.xexpose.width;
-            w->m_ClipRectangle.height = event.xexpose.height;
-            w->m_BeginExposeSeries = false;
-        } else {
-            // Add the current rectangle to the clip rectangle
-            if (event.xexpose.x < w->m_ClipRectangle.x)
-                w->m_ClipRectangle.x = event.xexpose.x;
-            if (event.xexpose.y < w->m_ClipRectangle.y)
-                w->m_ClipRectangle.y = event.xexpose.y;
-            if (event.xexpose.x + event.xexpose.width >
-                w->m_ClipRectangle.x + w->m_ClipRectangle.width) {
-                w->m_ClipRectangle.width = event.xexpose.x +
-                    event.xexpose.width - w->m_ClipRectangle.x;
-            }
-            if (event.xexpose.y + event.xexpose.height >
-                w->m_ClipRectangle.y + w->m_ClipRectangle.height) {
-                w->m_ClipRectangle.height = event.xexpose.y +
-                    event.xexpose.height - w->m_ClipRectangle.y;
-            }
-        }
-        if (event.xexpose.count == 0) {
-            // Restrict a drawing to clip rectangle
-            XSetClipRectangles(
-                m_Display, w->m_GC,
-                0, 0,                   // Clip origin
-                &(w->m_ClipRectangle), 1, Unsorted
-            );
-
-            w->onExpose(event);
-
-            // Restore the clip region
-            w->m_ClipRectangle.x = 0;
-            w->m_ClipRectangle.y = 0;
-            w->m_ClipRectangle.width = w->m_IWinRect.width();
-            w->m_ClipRectangle.height = w->m_IWinRect.height();
-            XSetClipRectangles(
-                m_Display, w->m_GC,
-                0, 0,                   // Clip origin
-                &(w->m_ClipRectangle), 1, Unsorted
-            );
-            w->m_BeginExposeSeries = true;
-        }
+        // Accumulate damaged rectangles until the last event of a series
+        w->addExposeRectangle(event);
+        if (event.xexpose.count == 0)
+            w->paintExposeRegion(event);
     } else if (event.type == KeyPress) {
         // printf("KeyPress event.\n");
         w->onKeyPress(event);
@@ -158,6 +766,13 @@ void GWindow::dispatchEvent(XEvent& event) {
 
         GWindow* destroyedWindow = findWindow(event.xdestroywindow.window);
         if (destroyedWindow != 0) {
+            if (m_Headless) {
+                headlessWindows.erase(event.xdestroywindow.window);
+            } else {
+                XDeleteContext(
+                    m_Display, event.xdestroywindow.window, m_WindowContext
+                );
+            }
             if (destroyedWindow->m_WindowCreated) {
                 destroyedWindow->m_WindowCreated = false;
                 m_NumCreatedWindows--;
@@ -195,17 +810,11 @@ void GWindow::dispatchEvent(XEvent& event) {
             w->m_IWinRect.setWidth(newWidth);
             w->m_IWinRect.setHeight(newHeight);
             w->recalculateMap();
-            if (w->m_Pixmap != 0) {
+            if (w->m_Framebuffer != 0)
+                w->resizeFramebuffer(newWidth, newHeight);
+            if (w->hasOffscreenBuffer()) {
                 // Offscreen drawing is used
-                int depth = DefaultDepth(
-                    m_Display, DefaultScreen(m_Display)
-                );
-                ::XFreePixmap(m_Display, w->m_Pixmap);
-                w->m_Pixmap = ::XCreatePixmap(
-                    m_Display, w->m_Window,
-                    newWidth, newHeight,
-                    depth
-                );
+                w->resizeOffscreenBuffer();
             }
             w->onResize(event);
             w->redraw();
@@ -219,23 +828,246 @@ void GWindow::doModal() {
     messageLoop(this);
 }
 
+// Windows are found through the Xlib context manager (a hash table),
+// so the cost of dispatching does not depend on the number of windows
 GWindow* GWindow::findWindow(Window w) {
-    ListHeader* p = m_WindowList.next;
-    int i = 0;
-    while (i < m_NumWindows && p != &m_WindowList) {
-        if (((GWindow*) p)->m_Window == w) {
-            return ((GWindow *)p);
+    if (m_Headless) {
+        std::unordered_map<Window, GWindow*>::const_iterator i =
+            headlessWindows.find(w);
+        return (i != headlessWindows.end())? i->second : 0;
+    }
+    XPointer p;
+    if (
+        w == 0 ||
+        XFindContext(m_Display, w, m_WindowContext, &p) != 0
+    )
+        return 0;
+    return (GWindow*) p;
+}
+
+void GWindow::postEvent(XEvent& e) {
+    if (m_Headless)
+        headlessEvents.push_back(e);
+    else if (m_Display != 0)
+        XSendEvent(m_Display, e.xany.window, False, NoEventMask, &e);
+}
+
+int GWindow::lookupString(
+    XKeyEvent* event, char* buffer, int bufferLength, KeySym* keysym
+) {
+    if (m_Headless)
+        return headlessLookupString(event, buffer, bufferLength, keysym);
+    return XLookupString(event, buffer, bufferLength, keysym, 0);
+}
+
+// Synthetic events of the headless mode
+static void postKeyPress(Window w, KeySym keysym, unsigned int state) {
+    XEvent e;
+    memset(&e, 0, sizeof(e));
+    e.type = KeyPress;
+    e.xkey.window = w;
+    e.xkey.time = (Time) (virtualTime / 1000000LL);
+    e.xkey.state = state;
+    e.xkey.keycode = (unsigned int) keysym;     // See headlessLookupString
+    e.xkey.same_screen = True;
+    GWindow::postEvent(e);
+}
+
+static void postButton(Window w, int type, int button, int x, int y) {
+    XEvent e;
+    memset(&e, 0, sizeof(e));
+    e.type = type;
+    e.xbutton.window = w;
+    e.xbutton.time = (Time) (virtualTime / 1000000LL);
+    e.xbutton.x = x;
+    e.xbutton.y = y;
+    e.xbutton.x_root = x;
+    e.xbutton.y_root = y;
+    e.xbutton.state = buttonState;      // Before the event, as in X
+    e.xbutton.button = (unsigned int) button;
+    e.xbutton.same_screen = True;
+    GWindow::postEvent(e);
+
+    unsigned int mask = (button >= 1 && button <= 5)?
+        (Button1Mask << (button - 1)) : 0;
+    if (type == ButtonPress)
+        buttonState |= mask;
+    else
+        buttonState &= ~mask;
+}
+
+static void postCloseRequest(Window w) {
+    XEvent e;
+    memset(&e, 0, sizeof(e));
+    e.type = ClientMessage;
+    e.xclient.window = w;
+    e.xclient.message_type = GWindow::m_WMProtocolsAtom;
+    e.xclient.format = 32;
+    e.xclient.data.l[0] = (long) GWindow::m_WMDeleteWindowAtom;
+    e.xclient.data.l[1] = (long) (virtualTime / 1000000LL);
+    GWindow::postEvent(e);
+}
+
+// Idle point of the headless message loop: the windows are painted
+// and written in frames; then the clock runs to the next timer
+// of a "wait" step, or the next step of the script is performed
+bool GWindow::waitForHeadlessEvents() {
+    // Background tasks are finished before every step,
+    // so that a script gives the same frames every time
+    taskPool.wait();
+    performCommands();
+    dispatchTimers();
+    paintInvalidWindows();
+    notifyFlushed();
+
+    if (framePrefix != 0) {
+        GWindow* w = (GWindow*) m_WindowList.next;
+        for (; w != (GWindow*) &m_WindowList; w = (GWindow*) w->next) {
+            if (!w->m_WindowCreated || !w->m_FramebufferChanged)
+                continue;
+            char path[1024];
+            snprintf(path, 1024, "%s-%05d.ppm", framePrefix, ++frameNumber);
+            if (!w->writePPM(path))
+                perror(path);
+            w->m_FramebufferChanged = false;
         }
-        p = p->next;
-        i++;
     }
-    return 0;
+    if (!headlessEvents.empty())
+        return true;
+
+    if (virtualTime < waitDeadline) {
+        long long t = waitDeadline;
+        if (timerHeap.size() > 0 && timerHeap.front().deadline < t)
+            t = timerHeap.front().deadline;
+        if (t > virtualTime)
+            virtualTime = t;
+        dispatchTimers();
+    } else {
+        runScriptStep();
+    }
+    return !headlessEvents.empty();
+}
+
+// Events of a step go to the newest window. When the script
+// is over, the windows are asked to close; the ones that refuse
+// are destroyed at the next idle point.
+void GWindow::runScriptStep() {
+    GWindow* w = (GWindow*) m_WindowList.next;
+    while (w != (GWindow*) &m_WindowList && !w->m_WindowCreated)
+        w = (GWindow*) w->next;
+    if (w == (GWindow*) &m_WindowList)
+        return;
+
+    if (eventScript.atEnd()) {
+        ++closeRequests;
+        while (w != (GWindow*) &m_WindowList) {
+            GWindow* nextWindow = (GWindow*) w->next;
+            if (w->m_WindowCreated) {
+                if (closeRequests == 1)
+                    postCloseRequest(w->m_Window);
+                else
+                    w->destroyWindow();
+            }
+            w = nextWindow;
+        }
+        return;
+    }
+
+    const GScriptStep& step = eventScript.nextStep();
+    const int* a = step.args;
+    XEvent e;
+    memset(&e, 0, sizeof(e));
+    e.xany.window = w->m_Window;
+    switch (step.kind) {
+    case GScriptStep::KEY:
+        postKeyPress(w->m_Window, (KeySym) a[0], step.state);
+        break;
+    case GScriptStep::TYPE:
+        for (size_t i = 0; i < step.text.size(); ++i)
+            postKeyPress(w->m_Window, (unsigned char) step.text[i], 0);
+        break;
+    case GScriptStep::BUTTON:
+        postButton(w->m_Window, ButtonPress, a[0], a[1], a[2]);
+        postButton(w->m_Window, ButtonRelease, a[0], a[1], a[2]);
+        break;
+    case GScriptStep::PRESS:
+        postButton(w->m_Window, ButtonPress, a[0], a[1], a[2]);
+        break;
+    case GScriptStep::RELEASE:
+        postButton(w->m_Window, ButtonRelease, a[0], a[1], a[2]);
+        break;
+    case GScriptStep::MOTION:
+        e.type = MotionNotify;
+        e.xmotion.time = (Time) (virtualTime / 1000000LL);
+        e.xmotion.x = a[0];
+        e.xmotion.y = a[1];
+        e.xmotion.x_root = a[0];
+        e.xmotion.y_root = a[1];
+        e.xmotion.state = buttonState;
+        e.xmotion.is_hint = NotifyNormal;
+        e.xmotion.same_screen = True;
+        postEvent(e);
+        break;
+    case GScriptStep::RESIZE:
+        e.type = ConfigureNotify;
+        e.xconfigure.event = w->m_Window;
+        e.xconfigure.x = w->m_WindowPosition.x;
+        e.xconfigure.y = w->m_WindowPosition.y;
+        e.xconfigure.width = a[0];
+        e.xconfigure.height = a[1];
+        e.xconfigure.border_width = w->m_BorderWidth;
+        postEvent(e);
+        break;
+    case GScriptStep::EXPOSE:
+        e.type = Expose;
+        e.xexpose.width = w->m_IWinRect.width();
+        e.xexpose.height = w->m_IWinRect.height();
+        postEvent(e);
+        break;
+    case GScriptStep::WAIT:
+        waitDeadline = virtualTime + (long long) a[0] * 1000000LL;
+        break;
+    case GScriptStep::FRAME: {
+            // The windows have been painted at the idle point
+            std::string path = step.text;
+            if (path.empty()) {
+                char name[1024];
+                snprintf(
+                    name, 1024, "%s-%05d.ppm",
+                    (framePrefix != 0)? framePrefix : "frame", ++frameNumber
+                );
+                path = name;
+            }
+            if (!w->writePPM(path.c_str()))
+                perror(path.c_str());
+            w->m_FramebufferChanged = false;
+        }
+        break;
+    case GScriptStep::CLOSE:
+        postCloseRequest(w->m_Window);
+        break;
+    }
 }
 
 GWindow::GWindow():
     m_Window(0),
     m_Pixmap(0),
     m_GC(0),
+    m_AtlasGC(0),
+    m_PixmapWidth(0),
+    m_PixmapHeight(0),
+    m_PixmapShrinkTime(0),
+    m_OffscreenDamage(0),
+    m_LineWidth(0),
+    m_LineSolid(true),
+    m_ThinSolidLines(true),
+    m_DisplayList(0),
+    m_Raster(0),
+    m_RasterImage(0),
+    m_Framebuffer(0),
+    m_FramebufferChanged(false),
+    m_SwapAfterCommands(false),
+    m_NotifyFlush(false),
     m_WindowPosition(0, 0),
     m_IWinRect(I2Point(0, 0), 300, 200),    // Some arbitrary values
     m_RWinRect(
@@ -252,7 +1084,10 @@ GWindow::GWindow():
     m_bgColorName(0),
     m_fgColorName(0),
     m_BorderWidth(DEFAULT_BORDER_WIDTH),
-    m_BeginExposeSeries(true)
+    m_Font(0),
+    m_ExposeRegion(0),
+    m_CoalesceEvents(true),
+    m_InvalidRegion(0)
 {
     strcpy(m_WindowTitle, "Graphic Window");
 }
@@ -264,6 +1099,21 @@ GWindow::GWindow(
     m_Window(0),
     m_Pixmap(0),
     m_GC(0),
+    m_AtlasGC(0),
+    m_PixmapWidth(0),
+    m_PixmapHeight(0),
+    m_PixmapShrinkTime(0),
+    m_OffscreenDamage(0),
+    m_LineWidth(0),
+    m_LineSolid(true),
+    m_ThinSolidLines(true),
+    m_DisplayList(0),
+    m_Raster(0),
+    m_RasterImage(0),
+    m_Framebuffer(0),
+    m_FramebufferChanged(false),
+    m_SwapAfterCommands(false),
+    m_NotifyFlush(false),
     m_WindowPosition(frameRect.left(), frameRect.top()),
     m_IWinRect(I2Point(0, 0), frameRect.width(), frameRect.height()),
     m_RWinRect(),
@@ -276,7 +1126,11 @@ GWindow::GWindow(
     m_fgPixel(0),
     m_bgColorName(0),
     m_fgColorName(0),
-    m_BorderWidth(DEFAULT_BORDER_WIDTH)
+    m_BorderWidth(DEFAULT_BORDER_WIDTH),
+    m_Font(0),
+    m_ExposeRegion(0),
+    m_CoalesceEvents(true),
+    m_InvalidRegion(0)
 {
     GWindow(            // Call another constructor
         frameRect,
@@ -296,6 +1150,21 @@ GWindow::GWindow(
     m_Window(0),
     m_Pixmap(0),
     m_GC(0),
+    m_AtlasGC(0),
+    m_PixmapWidth(0),
+    m_PixmapHeight(0),
+    m_PixmapShrinkTime(0),
+    m_OffscreenDamage(0),
+    m_LineWidth(0),
+    m_LineSolid(true),
+    m_ThinSolidLines(true),
+    m_DisplayList(0),
+    m_Raster(0),
+    m_RasterImage(0),
+    m_Framebuffer(0),
+    m_FramebufferChanged(false),
+    m_SwapAfterCommands(false),
+    m_NotifyFlush(false),
     m_WindowPosition(frameRect.left(), frameRect.top()),
     m_IWinRect(I2Point(0, 0), frameRect.width(), frameRect.height()),
     m_RWinRect(coordRect),
@@ -308,7 +1177,11 @@ GWindow::GWindow(
     m_fgPixel(0),
     m_bgColorName(0),
     m_fgColorName(0),
-    m_BorderWidth(DEFAULT_BORDER_WIDTH)
+    m_BorderWidth(DEFAULT_BORDER_WIDTH),
+    m_Font(0),
+    m_ExposeRegion(0),
+    m_CoalesceEvents(true),
+    m_InvalidRegion(0)
 {
     if (title == 0) {
         strcpy(m_WindowTitle, "Graphic Window");
@@ -368,39 +1241,36 @@ void GWindow::createWindow(
     }
 
     if (m_bgColorName != 0) {
-        XColor bg;
-        XParseColor(
-            m_Display,
-            DefaultColormap(m_Display, m_Screen),
-            m_bgColorName,
-            &bg
-        );
-        XAllocColor(
-            m_Display, DefaultColormap(m_Display, m_Screen), &bg
-        );
-        m_bgPixel = bg.pixel;
+        m_bgPixel = allocateColor(m_bgColorName);
     } else {
-        m_bgPixel = WhitePixel(m_Display, m_Screen);
+        m_bgPixel = m_Headless? 0xFFFFFF : WhitePixel(m_Display, m_Screen);
     }
 
     if (m_fgColorName != 0) {
-        XColor fg;
-        XParseColor(
-            m_Display,
-            DefaultColormap(m_Display, m_Screen),
-            m_fgColorName,
-            &fg
-        );
-        XAllocColor(
-            m_Display, DefaultColormap(m_Display, m_Screen), &fg
-        );
-        m_fgPixel = fg.pixel;
+        m_fgPixel = allocateColor(m_fgColorName);
     } else {
-        m_fgPixel = BlackPixel(m_Display, m_Screen);
+        m_fgPixel = m_Headless? 0 : BlackPixel(m_Display, m_Screen);
     }
 
     m_BorderWidth = borderWidth;
 
+    if (m_Headless) {
+        // The window is a raster; it is painted on the first Expose
+        m_Window = ++lastHeadlessWindow;
+        headlessWindows[m_Window] = this;
+        resizeFramebuffer(m_IWinRect.width(), m_IWinRect.height());
+        m_WindowCreated = true;
+
+        XEvent e;
+        memset(&e, 0, sizeof(e));
+        e.type = Expose;
+        e.xexpose.window = m_Window;
+        e.xexpose.width = m_IWinRect.width();
+        e.xexpose.height = m_IWinRect.height();
+        postEvent(e);
+        return;
+    }
+
     /*...
     m_Window = XCreateSimpleWindow(
         m_Display, 
@@ -441,6 +1311,7 @@ void GWindow::createWindow(
         attributesValueMask,
         winAttributes
     );
+    XSaveContext(m_Display, m_Window, m_WindowContext, (XPointer) this);
 
     m_WindowCreated = true;
     XSetStandardProperties(
@@ -487,10 +1358,13 @@ void GWindow::createWindow(
         m_Window
     );
 
-    // To prevent application closing on pressing the window close box
-    XSetWMProtocols(
+    // To prevent application closing on pressing the window close box.
+    // (XSetWMProtocols would intern WM_PROTOCOLS once more.)
+    collectAtoms();
+    XChangeProperty(
         m_Display, m_Window,
-        &m_WMDeleteWindowAtom, 1
+        m_WMProtocolsAtom, XA_ATOM, 32, PropModeReplace,
+        (unsigned char*) &m_WMDeleteWindowAtom, 1
     );
 
     // printf("In createWindow: m_Window = %d\n", (int) m_Window);
@@ -500,7 +1374,7 @@ void GWindow::setWindowTitle(const char* title) {
     strncpy(m_WindowTitle, title, 127);
     m_WindowTitle[127] = 0;
 
-    if (m_WindowCreated)
+    if (m_WindowCreated && m_Display != 0)
         XStoreName(m_Display, m_Window, m_WindowTitle);
 }
 
@@ -605,6 +1479,9 @@ void GWindow::createWindow(
 }
 
 GWindow::~GWindow() {
+    killTimers();
+    releaseExposeRegion();
+
     if (m_WindowCreated) {
         destroyWindow();        // Destroy window
         m_WindowCreated = false;
@@ -628,6 +1505,10 @@ void GWindow::destroyWindow() {
     m_WindowCreated = false;
     m_NumCreatedWindows--;
 
+    killTimers();
+
+    if (m_GC != 0 && m_GC == lineBatchGC)
+        flushLines();
     if (m_GC != 0) {
         XFreeGC(
             m_Display,
@@ -635,23 +1516,62 @@ void GWindow::destroyWindow() {
         );
         m_GC = 0;
     }
+    if (m_AtlasGC != 0) {
+        XFreeGC(m_Display, m_AtlasGC);
+        m_AtlasGC = 0;
+    }
     if (m_Pixmap != 0) {
         XFreePixmap(
             m_Display,
             m_Pixmap
         );
         m_Pixmap = 0;
+        m_PixmapWidth = 0;
+        m_PixmapHeight = 0;
+        m_PixmapShrinkTime = 0;
+        if (m_OffscreenDamage != 0) {
+            XDestroyRegion(m_OffscreenDamage);
+            m_OffscreenDamage = 0;
+        }
+    }
+    if (m_Raster != 0) {
+        releaseRaster();
+        m_PixmapWidth = 0;
+        m_PixmapHeight = 0;
+        m_PixmapShrinkTime = 0;
+        if (m_OffscreenDamage != 0) {
+            XDestroyRegion(m_OffscreenDamage);
+            m_OffscreenDamage = 0;
+        }
     }
     if (m_Window != 0) {
-        XDestroyWindow(
-            m_Display,
-            m_Window
-        );
+        if (m_Headless || m_Display == 0) {
+            headlessWindows.erase(m_Window);    // Or the display is closed
+        } else {
+            XDeleteContext(m_Display, m_Window, m_WindowContext);
+            XDestroyWindow(
+                m_Display,
+                m_Window
+            );
+        }
         m_Window = 0;
     }
+    if (m_Framebuffer != 0) {
+        delete m_Framebuffer;
+        m_Framebuffer = 0;
+    }
 }
 
-bool GWindow::initX() {
+bool GWindow::initX(bool headless /* = false */) {
+    const char* headlessMode = getenv("GWINDOW_HEADLESS");
+    if (
+        headlessMode != 0 && headlessMode[0] != 0 &&
+        strcmp(headlessMode, "0") != 0
+    )
+        headless = true;
+    if (headless || m_Headless)
+        return initHeadless();
+
     //+++
     // printf("Initializing display...\n");
     //+++
@@ -663,26 +1583,120 @@ bool GWindow::initX() {
     }
 
     m_Screen  = DefaultScreen(m_Display);
+    m_WindowContext = XUniqueContext();
 
     // For interconnetion with Window Manager
-    m_WMProtocolsAtom = XInternAtom(
-        GWindow::m_Display,
-        "WM_PROTOCOLS",
-        False
-    );
-    m_WMDeleteWindowAtom = XInternAtom(
-        GWindow::m_Display,
-        "WM_DELETE_WINDOW",
-        False
-    );
+    static const char* const atomNames[2] = {
+        "WM_PROTOCOLS", "WM_DELETE_WINDOW"
+    };
+#ifdef GWINDOW_XCB
+    // The replies are waited for when the first window is created
+    xcbConnection = XGetXCBConnection(m_Display);
+    for (int i = 0; i < 2; ++i) {
+        atomCookies[i] = xcb_intern_atom(
+            xcbConnection, 0, strlen(atomNames[i]), atomNames[i]
+        );
+    }
+    atomsPending = true;
+#else
+    // Both atoms in one round trip
+    Atom atoms[2];
+    XInternAtoms(m_Display, (char**) atomNames, 2, False, atoms);
+    m_WMProtocolsAtom = atoms[0];
+    m_WMDeleteWindowAtom = atoms[1];
+#endif
+
+    readEnvironment();
+    return true;
+}
+
+// Backends selected by the environment variables
+void GWindow::readEnvironment() {
+    const char* textBackend = getenv("GWINDOW_TEXT_BACKEND");
+    if (textBackend != 0 && strcmp(textBackend, "atlas") == 0)
+        m_TextBackend = TEXT_BACKEND_ATLAS;
+    const char* offscreenBackend = getenv("GWINDOW_OFFSCREEN");
+    if (offscreenBackend != 0 && strcmp(offscreenBackend, "raster") == 0)
+        m_OffscreenBackend = OFFSCREEN_BACKEND_RASTER;
+    const char* threads = getenv("GWINDOW_THREADS");
+    if (threads != 0)
+        tileRenderer.setNumThreads(atoi(threads));
+}
+
+// There is no connection: the atoms are made up, and the offscreen
+// buffers are always rasters
+bool GWindow::initHeadless() {
+    if (m_Headless)
+        return true;
+    m_Headless = true;
+    m_Screen = 0;
+    m_WMProtocolsAtom = 1;
+    m_WMDeleteWindowAtom = 2;
+    readEnvironment();
+    m_OffscreenBackend = OFFSCREEN_BACKEND_RASTER;
+
+    eventScript.clear();
+    closeRequests = 0;
+    const char* script = getenv("GWINDOW_EVENTS");
+    if (script != 0 && script[0] != 0) {
+        if (!eventScript.load(script))
+            perror("Cannot read the event script");
+    } else {
+        GScriptStep step;
+        step.kind = GScriptStep::WAIT;
+        step.args[0] = HEADLESS_DEFAULT_WAIT;
+        step.args[1] = 0;
+        step.args[2] = 0;
+        step.state = 0;
+        eventScript.addStep(step);
+    }
+    framePrefix = getenv("GWINDOW_PPM");
+    if (framePrefix != 0 && framePrefix[0] == 0)
+        framePrefix = 0;
     return true;
 }
 
 void GWindow::closeX() {
-    if (m_Display == 0)
+    if (m_Display == 0 && !m_Headless)
         return;
 
+    taskPool.stop();
+    completionQueue.drain([](GTaskPool::Task* completion) {
+        delete completion;
+    });
+
+    releaseAtlases();
+    releaseAllRasterGlyphs();
     releaseFonts();
+    colorCache.clear();
+
+    if (m_Headless) {
+        m_Headless = false;
+        headlessEvents.clear();
+        eventScript.clear();
+        return;
+    }
+
+#ifdef GWINDOW_XCB
+    // Requests prefetched but never used
+    if (atomsPending) {
+        xcb_discard_reply(xcbConnection, atomCookies[0].sequence);
+        xcb_discard_reply(xcbConnection, atomCookies[1].sequence);
+        atomsPending = false;
+    }
+    std::unordered_map<std::string, xcb_alloc_named_color_cookie_t>::
+        const_iterator c;
+    for (c = pendingColors.begin(); c != pendingColors.end(); ++c)
+        xcb_discard_reply(xcbConnection, c->second.sequence);
+    pendingColors.clear();
+    std::unordered_map<std::string, PendingFont>::const_iterator f;
+    for (f = pendingFonts.begin(); f != pendingFonts.end(); ++f) {
+        xcb_discard_reply(xcbConnection, f->second.open.sequence);
+        xcb_discard_reply(xcbConnection, f->second.query.sequence);
+    }
+    pendingFonts.clear();
+    xcbConnection = 0;
+#endif
 
     //+++
     // printf("Closing display...\n");
@@ -695,12 +1709,16 @@ void GWindow::closeX() {
 int GWindow::screenMaxX() {
     if (m_Display == 0)
         initX();
+    if (m_Headless)
+        return HEADLESS_SCREEN_WIDTH;
     return XDisplayWidth(m_Display, m_Screen);
 }
 
 int GWindow::screenMaxY() {
     if (m_Display == 0)
         initX();
+    if (m_Headless)
+        return HEADLESS_SCREEN_HEIGHT;
     return XDisplayHeight(m_Display, m_Screen);
 }
 
@@ -825,7 +1843,27 @@ void GWindow::moveRel(double dx, double dy) {
 }
 
 void GWindow::drawLineTo(const I2Point& p, bool offscreen /* = false */) {
-    drawLine(m_ICurPos, p, offscreen);
+    // A display list keeps the line as it is: it may be replayed
+    // in a larger window
+    I2Point p1 = m_ICurPos, p2 = p;
+    if (m_DisplayList == 0 && !clipLine(p1, p2)) {
+        moveTo(p);
+        return;
+    }
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(raster, p1.x, p1.y, p2.x, p2.y);
+        raster->drawLine(
+            p1.x, p1.y, p2.x, p2.y, (uint32_t) m_fgPixel, m_LineWidth
+        );
+    } else {
+        Drawable draw = m_Window;
+        if (offscreen && m_Pixmap != 0)
+            draw = m_Pixmap;
+        if (draw == m_Pixmap)
+            addOffscreenDamage(p1.x, p1.y, p2.x, p2.y);
+        batchLine(draw, p1, p2);
+    }
     moveTo(p);
 }
 
@@ -834,12 +1872,191 @@ void GWindow::drawLineTo(int x, int y, bool offscreen /* = false */) {
 }
 
 void GWindow::drawLineTo(const R2Point& p, bool offscreen /* = false */) {
-    drawLine(m_RCurPos, p, offscreen);
-    moveTo(p);
-}
+    Drawable draw = m_Window;
+    if (offscreen && m_Pixmap != 0)
+        draw = m_Pixmap;
 
-void GWindow::drawLineTo(double x, double y, bool offscreen /* = false */) {
-    drawLineTo(R2Point(x, y), offscreen);
+    R2Point c1, c2;
+    if (m_RWinRect.clip(m_RCurPos, p, c1, c2)) {
+        I2Point ip1 = map(c1), ip2 = map(c2);
+        GRaster* raster = drawingRaster(offscreen);
+        if (raster != 0) {
+            addRasterDamage(raster, ip1.x, ip1.y, ip2.x, ip2.y);
+            raster->drawLine(
+                ip1.x, ip1.y, ip2.x, ip2.y, (uint32_t) m_fgPixel, m_LineWidth
+            );
+        } else {
+            if (draw == m_Pixmap)
+                addOffscreenDamage(ip1.x, ip1.y, ip2.x, ip2.y);
+            batchLine(draw, ip1, ip2);
+        }
+    }
+    moveTo(p);
+}
+
+void GWindow::drawPolyline(
+    const R2Point* points, int numPoints, bool offscreen /* = false */
+) {
+    if (numPoints <= 0)
+        return;
+
+    // When no segment needs clipping, the points are mapped at once
+    bool inside = true;
+    for (int i = 0; inside && i < numPoints; ++i) {
+        inside = (
+            m_RWinRect.getXMin() <= points[i].x &&
+            points[i].x <= m_RWinRect.getXMax() &&
+            m_RWinRect.getYMin() <= points[i].y &&
+            points[i].y <= m_RWinRect.getYMax()
+        );
+    }
+    if (inside) {
+        I2Point* pnt = scratchBuffer(scratchPoints, numPoints);
+        map(points, numPoints, pnt);
+        drawMappedPolyline(pnt, numPoints, offscreen);
+        m_RCurPos = points[numPoints - 1];
+        m_ICurPos = pnt[numPoints - 1];
+        return;
+    }
+
+    moveTo(points[0]);
+    for (int i = 1; i < numPoints; ++i)
+        drawLineTo(points[i], offscreen);
+}
+
+void GWindow::drawPolyline(
+    const I2Point* points, int numPoints, bool offscreen /* = false */
+) {
+    if (numPoints <= 0)
+        return;
+
+    // Inside the guard band no segment is clipped
+    int xmin = points[0].x, xmax = xmin;
+    int ymin = points[0].y, ymax = ymin;
+    for (int i = 1; i < numPoints; ++i) {
+        xmin = std::min(xmin, points[i].x);
+        xmax = std::max(xmax, points[i].x);
+        ymin = std::min(ymin, points[i].y);
+        ymax = std::max(ymax, points[i].y);
+    }
+    R2Rectangle band = guardBand();
+    if (
+        m_DisplayList != 0 || (
+            band.getXMin() <= xmin && xmax <= band.getXMax() &&
+            band.getYMin() <= ymin && ymax <= band.getYMax()
+        )
+    ) {
+        if (m_DisplayList != 0 || !isBoxOutside(xmin, ymin, xmax, ymax))
+            drawMappedPolyline(points, numPoints, offscreen);
+        moveTo(points[numPoints - 1]);
+        return;
+    }
+
+    moveTo(points[0]);
+    for (int i = 1; i < numPoints; ++i)
+        drawLineTo(points[i], offscreen);
+}
+
+// Segments of a polyline in pixels that need no clipping go straight
+// to the display list, the raster or the line batch; the current
+// position is set by the caller
+void GWindow::drawMappedPolyline(
+    const I2Point* points, int numPoints, bool offscreen
+) {
+    if (m_DisplayList != 0) {
+        for (int i = 1; i < numPoints; ++i)
+            m_DisplayList->addLine(points[i - 1], points[i]);
+        return;
+    }
+
+    int xmin = points[0].x, xmax = xmin;
+    int ymin = points[0].y, ymax = ymin;
+    for (int i = 1; i < numPoints; ++i) {
+        xmin = std::min(xmin, points[i].x);
+        xmax = std::max(xmax, points[i].x);
+        ymin = std::min(ymin, points[i].y);
+        ymax = std::max(ymax, points[i].y);
+    }
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(raster, xmin, ymin, xmax, ymax);
+        for (int i = 1; i < numPoints; ++i) {
+            raster->drawLine(
+                points[i - 1].x, points[i - 1].y, points[i].x, points[i].y,
+                (uint32_t) m_fgPixel, m_LineWidth
+            );
+        }
+        return;
+    }
+
+    Drawable draw = m_Window;
+    if (offscreen && m_Pixmap != 0)
+        draw = m_Pixmap;
+    if (draw == m_Pixmap)
+        addOffscreenDamage(xmin, ymin, xmax, ymax);
+    for (int i = 1; i < numPoints; ++i)
+        batchLine(draw, points[i - 1], points[i]);
+}
+
+void GWindow::batchLine(Drawable draw, const I2Point& p1, const I2Point& p2) {
+    if (m_DisplayList != 0) {
+        m_DisplayList->addLine(p1, p2);
+        return;
+    }
+    if (m_Display != 0 && !m_ThinSolidLines) {
+        // Wide segments of XDrawLines are joined instead of capped,
+        // and dashes run on across them: such lines are drawn one
+        // by one, as they were asked for
+        flushLines();
+        ::XDrawLine(m_Display, draw, m_GC, p1.x, p1.y, p2.x, p2.y);
+        return;
+    }
+    int capacity = LINE_BATCH_SIZE;
+    if (m_Display != 0) {
+        // XDrawLines takes 3 words + 1 word per point
+        long maxPoints = XMaxRequestSize(m_Display) - 3;
+        if (maxPoints < capacity)
+            capacity = (int) maxPoints;
+    }
+
+    if (
+        lineBatchLength == 0 ||
+        draw != lineBatchDrawable || m_GC != lineBatchGC ||
+        lineBatch[lineBatchLength - 1].x != (short) p1.x ||
+        lineBatch[lineBatchLength - 1].y != (short) p1.y
+    ) {
+        flushLines();
+        lineBatchDrawable = draw;
+        lineBatchGC = m_GC;
+        lineBatch[0].x = (short) p1.x;
+        lineBatch[0].y = (short) p1.y;
+        lineBatchLength = 1;
+    } else if (lineBatchLength >= capacity) {
+        // Continue the polyline in the next request
+        XPoint last = lineBatch[lineBatchLength - 1];
+        flushLines();
+        lineBatchDrawable = draw;
+        lineBatchGC = m_GC;
+        lineBatch[0] = last;
+        lineBatchLength = 1;
+    }
+    lineBatch[lineBatchLength].x = (short) p2.x;
+    lineBatch[lineBatchLength].y = (short) p2.y;
+    ++lineBatchLength;
+}
+
+void GWindow::flushLines() {
+    if (lineBatchLength >= 2 && m_Display != 0) {
+        XDrawLines(
+            m_Display, lineBatchDrawable, lineBatchGC,
+            lineBatch, lineBatchLength, CoordModeOrigin
+        );
+    }
+    lineBatchLength = 0;
+}
+
+void GWindow::drawLineTo(double x, double y, bool offscreen /* = false */) {
+    drawLineTo(R2Point(x, y), offscreen);
 }
 
 void GWindow::drawLineRel(const I2Vector& v, bool offscreen /* = false */) {
@@ -861,40 +2078,34 @@ void GWindow::drawLineRel(double dx, double dy, bool offscreen /* = false */) {
 void GWindow::drawLine(
     const I2Point& p1, const I2Point& p2, bool offscreen /* = false */
 ) {
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->addLine(p1, p2);
+        moveTo(invMap(p2));
+        return;
+    }
     //... drawLine(invMap(p1), invMap(p2));
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
 
-    if (
-        abs(p1.x) < SHRT_MAX && abs(p1.y) < SHRT_MAX &&
-        abs(p2.x) < SHRT_MAX && abs(p2.y) < SHRT_MAX
-    )
-    {
-        ::XDrawLine(
-            m_Display,
-            draw,
-            m_GC,
-            p1.x, p1.y,
-            p2.x, p2.y
-        );
-    } else {
-        R2Point c1, c2;
-        if (
-            R2Rectangle(
-                m_IWinRect.left(), m_IWinRect.top(),
-                m_IWinRect.width(), m_IWinRect.height()
-            ).clip(
-                R2Point(p1.x, p1.y), R2Point(p1.x, p1.y),
-                c1, c2
-            )
-        ) {
+    I2Point c1 = p1, c2 = p2;
+    if (clipLine(c1, c2)) {
+        GRaster* raster = drawingRaster(offscreen);
+        if (raster != 0) {
+            addRasterDamage(raster, c1.x, c1.y, c2.x, c2.y);
+            raster->drawLine(
+                c1.x, c1.y, c2.x, c2.y, (uint32_t) m_fgPixel, m_LineWidth
+            );
+        } else {
+            if (draw == m_Pixmap)
+                addOffscreenDamage(c1.x, c1.y, c2.x, c2.y);
             ::XDrawLine(
                 m_Display,
                 draw,
                 m_GC,
-                (int)(c1.x + 0.5), (int)(c1.y + 0.5),
-                (int)(c2.x + 0.5), (int)(c2.y + 0.5)
+                c1.x, c1.y,
+                c2.x, c2.y
             );
         }
     }
@@ -916,6 +2127,7 @@ void GWindow::drawLine(
 void GWindow::drawLine(
     const R2Point& p1, const R2Point& p2, bool offscreen /* = false */
 ) {
+    flushLines();
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
@@ -923,10 +2135,25 @@ void GWindow::drawLine(
     R2Point c1, c2;
     if (m_RWinRect.clip(p1, p2, c1, c2)) {
         I2Point ip1 = map(c1), ip2 = map(c2);
+        if (m_DisplayList != 0) {
+            m_DisplayList->addLine(ip1, ip2);
+            return;
+        }
 
         // printf("Line from (%d, %d) to (%d, %d)\n",
         //     ip1.x, ip1.y, ip2.x, ip2.y);
 
+        GRaster* raster = drawingRaster(offscreen);
+        if (raster != 0) {
+            addRasterDamage(raster, ip1.x, ip1.y, ip2.x, ip2.y);
+            raster->drawLine(
+                ip1.x, ip1.y, ip2.x, ip2.y, (uint32_t) m_fgPixel, m_LineWidth
+            );
+            return;
+        }
+        if (draw == m_Pixmap)
+            addOffscreenDamage(ip1.x, ip1.y, ip2.x, ip2.y);
+
         ::XDrawLine(
             m_Display,
             draw,
@@ -950,19 +2177,39 @@ void GWindow::drawLine(
 }
 
 void GWindow::fillRectangle(const I2Rectangle& r, bool offscreen /* = false */) {
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->addFillRectangle(r);
+        return;
+    }
+    int x1 = r.left(), y1 = r.top(), x2 = r.right(), y2 = r.bottom();
+    if (!clipBox(x1, y1, x2, y2))
+        return;
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(raster, x1, y1, x2, y2);
+        raster->fillRectangle(
+            x1, y1, x2 - x1, y2 - y1, (uint32_t) m_fgPixel
+        );
+        return;
+    }
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
 
+    if (draw == m_Pixmap)
+        addOffscreenDamage(x1, y1, x2, y2);
+
     ::XFillRectangle(
         m_Display,
         draw,
         m_GC,
-        r.left(), r.top(), r.width(), r.height()
+        x1, y1, x2 - x1, y2 - y1
     );
 }
 
 void GWindow::fillRectangle(const R2Rectangle& r, bool offscreen /* = false */) {
+    flushLines();
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
@@ -970,9 +2217,40 @@ void GWindow::fillRectangle(const R2Rectangle& r, bool offscreen /* = false */)
     I2Point leftTop = map(R2Point(r.left(), r.top()));
     I2Point rightBottom = map(R2Point(r.right(), r.bottom()));
 
+    if (m_DisplayList != 0) {
+        m_DisplayList->addFillRectangle(
+            I2Rectangle(
+                leftTop,
+                rightBottom.x - leftTop.x, rightBottom.y - leftTop.y
+            )
+        );
+        return;
+    }
+    if (!clipBox(leftTop.x, leftTop.y, rightBottom.x, rightBottom.y))
+        return;
+
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(
+            raster, leftTop.x, leftTop.y, rightBottom.x, rightBottom.y
+        );
+        raster->fillRectangle(
+            leftTop.x, leftTop.y,
+            rightBottom.x - leftTop.x, rightBottom.y - leftTop.y,
+            (uint32_t) m_fgPixel
+        );
+        return;
+    }
+
     //+++ printf("leftTop = (%d, %d), rightBottom = (%d, %d)\n",
     //+++     leftTop.x, leftTop.y, rightBottom.x, rightBottom.y);
 
+    if (draw == m_Pixmap) {
+        addOffscreenDamage(
+            leftTop.x, leftTop.y, rightBottom.x, rightBottom.y
+        );
+    }
+
     ::XFillRectangle(
         m_Display,
         draw,
@@ -988,32 +2266,63 @@ void GWindow::fillPolygon(
     if (numPoints <= 2)
         return;
 
-    I2Point* pnt = new I2Point[numPoints];
-    for (int i = 0; i < numPoints; ++i) {
-        pnt[i] = map(points[i]);
-    }
+    I2Point* pnt = scratchBuffer(scratchPoints, numPoints);
+    map(points, numPoints, pnt);
     fillPolygon(pnt, numPoints, offscreen);
-    delete[] pnt;
 }
 
 void GWindow::fillPolygon(
     const I2Point* points, int numPoints, bool offscreen /* = false */
 ) {
+    flushLines();
     if (numPoints <= 2)
         return;
 
+    if (m_DisplayList != 0) {
+        m_DisplayList->addFillPolygon(points, numPoints);
+        return;
+    }
+
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
 
 
-    XPoint* pnt = new XPoint[numPoints];
-    pnt[0].x = (short) points[0].x;
-    pnt[0].y = (short) points[0].y;
+    int xmin = points[0].x, xmax = xmin;
+    int ymin = points[0].y, ymax = ymin;
     for (int i = 1; i < numPoints; ++i) {
-        pnt[i].x = (short) points[i].x;
-        pnt[i].y = (short) points[i].y;
+        if (points[i].x < xmin) xmin = points[i].x;
+        if (points[i].x > xmax) xmax = points[i].x;
+        if (points[i].y < ymin) ymin = points[i].y;
+        if (points[i].y > ymax) ymax = points[i].y;
+    }
+    if (isBoxOutside(xmin, ymin, xmax, ymax))
+        return;
+    R2Rectangle band = guardBand();
+    if (
+        xmin < band.getXMin() || xmax > band.getXMax() ||
+        ymin < band.getYMin() || ymax > band.getYMax()
+    ) {
+        numPoints = clipPolygon(points, numPoints, band, clippedPoints);
+        if (numPoints < 3)
+            return;
+        points = &(clippedPoints[0]);
+        xmin = std::max(xmin, (int) band.getXMin());
+        xmax = std::min(xmax, (int) band.getXMax());
+        ymin = std::max(ymin, (int) band.getYMin());
+        ymax = std::min(ymax, (int) band.getYMax());
+    }
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0)
+        addRasterDamage(raster, xmin, ymin, xmax, ymax);
+    else if (draw == m_Pixmap)
+        addOffscreenDamage(xmin, ymin, xmax, ymax);
+    if (raster != 0) {
+        raster->fillPolygon(points, numPoints, (uint32_t) m_fgPixel);
+        return;
     }
+    XPoint* pnt = scratchBuffer(scratchXPoints, numPoints);
+    toXPoints(points, numPoints, pnt);
     ::XFillPolygon(
         m_Display,
         draw,
@@ -1023,14 +2332,37 @@ void GWindow::fillPolygon(
         Convex,
         CoordModeOrigin
     );
-    delete[] pnt;
 }
 
 void GWindow::fillEllipse(const I2Rectangle& r, bool offscreen /* = false */) {
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->addEllipse(r, true);
+        return;
+    }
+    if (isBoxOutside(r.left(), r.top(), r.right(), r.bottom()))
+        return;
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
 
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(raster, r.left(), r.top(), r.right(), r.bottom());
+        raster->fillEllipse(
+            r.left(), r.top(), r.width(), r.height(), (uint32_t) m_fgPixel
+        );
+        return;
+    }
+    if (
+        drawLargeEllipse(
+            r.left(), r.top(), r.width(), r.height(), true, offscreen
+        )
+    )
+        return;
+    if (draw == m_Pixmap)
+        addOffscreenDamage(r.left(), r.top(), r.right(), r.bottom());
+
     ::XFillArc(
         m_Display,
         draw,
@@ -1041,6 +2373,7 @@ void GWindow::fillEllipse(const I2Rectangle& r, bool offscreen /* = false */) {
 }
 
 void GWindow::fillEllipse(const R2Rectangle& r, bool offscreen /* = false */) {
+    flushLines();
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
@@ -1048,6 +2381,44 @@ void GWindow::fillEllipse(const R2Rectangle& r, bool offscreen /* = false */) {
     I2Point leftTop = map(R2Point(r.left(), r.top()));
     I2Point rightBottom = map(R2Point(r.right(), r.bottom()));
 
+    if (m_DisplayList != 0) {
+        m_DisplayList->addEllipse(
+            I2Rectangle(
+                leftTop,
+                rightBottom.x - leftTop.x, rightBottom.y - leftTop.y
+            ), true
+        );
+        return;
+    }
+    if (isBoxOutside(leftTop.x, leftTop.y, rightBottom.x, rightBottom.y))
+        return;
+
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(
+            raster, leftTop.x, leftTop.y, rightBottom.x, rightBottom.y
+        );
+        raster->fillEllipse(
+            leftTop.x, leftTop.y,
+            rightBottom.x - leftTop.x, rightBottom.y - leftTop.y,
+            (uint32_t) m_fgPixel
+        );
+        return;
+    }
+    if (
+        drawLargeEllipse(
+            leftTop.x, leftTop.y,
+            rightBottom.x - leftTop.x, rightBottom.y - leftTop.y,
+            true, offscreen
+        )
+    )
+        return;
+    if (draw == m_Pixmap) {
+        addOffscreenDamage(
+            leftTop.x, leftTop.y, rightBottom.x, rightBottom.y
+        );
+    }
+
     ::XFillArc(
         m_Display,
         draw,
@@ -1068,26 +2439,19 @@ void GWindow::redraw() {
 }
 
 void GWindow::redrawRectangle(const I2Rectangle& r) {
+    if (!m_WindowCreated || r.width() <= 0 || r.height() <= 0)
+        return;
     XRectangle rect;
     rect.x = (short) r.left(); rect.y = (short) r.top();
     rect.width = (unsigned short) r.width(); 
     rect.height = (unsigned short) r.height();
-    XSetClipRectangles(
-        m_Display, m_GC, 
-        0, 0,                   // Clip origin
-        &rect, 1, Unsorted
-    );
 
-    XEvent e;
-    memset(&e, 0, sizeof(e));
-    e.type = Expose;
-    e.xany.window = m_Window;
-    e.xexpose.x = r.left();
-    e.xexpose.y = r.top();
-    e.xexpose.width = r.width();
-    e.xexpose.height = r.height();
-    e.xexpose.count = 0;
-    XSendEvent(m_Display, m_Window, 0, ExposureMask, &e);
+    // Nothing is sent to the server: the area is painted
+    // by paintInvalidWindows
+    if (m_InvalidRegion == 0)
+        m_InvalidRegion = XCreateRegion();
+    XUnionRectWithRegion(&rect, m_InvalidRegion, m_InvalidRegion);
+    m_InvalidWindows = true;
 }
 
 void GWindow::redrawRectangle(const R2Rectangle& r) {
@@ -1106,6 +2470,7 @@ void GWindow::drawString(
     int x, int y, const char* str, int len /* = (-1) */,
     bool offscreen /* = false */
 ) {
+    flushLines();
     int l = len;
     if (l < 0)
         l = strlen(str);
@@ -1114,6 +2479,33 @@ void GWindow::drawString(
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
 
+    if (m_DisplayList != 0) {
+        m_DisplayList->addString(x, y, str, l, textBox(x, y, str, l));
+        return;
+    }
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        drawRasterString(raster, x, y, str, l);
+        return;
+    }
+    I2Rectangle box = textBox(x, y, str, l);
+    if (isBoxOutside(box.left(), box.top(), box.right(), box.bottom()))
+        return;
+    // A text that starts farther than the 16 bits of X requests reach
+    // is not visible (the box of an unknown font is the whole window)
+    if (x != saturateShort(x) || y != saturateShort(y))
+        return;
+    if (draw == m_Pixmap)
+        damageOffscreen(box);
+
+    if (m_TextBackend == TEXT_BACKEND_ATLAS && m_Font != 0) {
+        GlyphAtlas* atlas = findAtlas(m_Font);
+        if (atlas != 0) {
+            drawAtlasString(atlas, draw, x, y, str, l);
+            return;
+        }
+    }
+
     ::XDrawString(
         m_Display,
         draw,
@@ -1124,6 +2516,20 @@ void GWindow::drawString(
     );
 }
 
+// The box of a text is known for fonts loaded by loadFont;
+// otherwise the whole window is returned
+I2Rectangle GWindow::textBox(int x, int y, const char* str, int len) const {
+    FontDescriptor* fd = (m_Font != 0)? findFont(m_Font) : 0;
+    if (fd == 0)
+        return I2Rectangle(0, 0, m_IWinRect.width(), m_IWinRect.height());
+    int ascent = fd->font_struct->max_bounds.ascent;
+    return I2Rectangle(
+        x, y - ascent,
+        textWidth(m_Font, str, len),
+        ascent + fd->font_struct->max_bounds.descent
+    );
+}
+
 void GWindow::drawString(
     const I2Point& p, const char* str, int len, bool offscreen /* = false */
 ) {
@@ -1142,41 +2548,161 @@ void GWindow::drawString(
     drawString(map(R2Point(x, y)), str, len, offscreen);
 }
 
+// Pixel value of a 16-bit color channel for a TrueColor mask
+static unsigned long channelPixel(unsigned short value, unsigned long mask) {
+    if (mask == 0)
+        return 0;
+    int shift = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        ++shift;
+    }
+    int bits = 0;
+    while ((mask & 1) != 0) {
+        mask >>= 1;
+        ++bits;
+    }
+    unsigned long v = (bits >= 16)?
+        ((unsigned long) value << (bits - 16)) :
+        ((unsigned long) value >> (16 - bits));
+    return (v << shift);
+}
+
+// With a TrueColor visual the pixel is computed from the RGB value
+// of the color: a name is looked up in rgb.txt by the client,
+// so that neither XParseColor nor XAllocColor asks the server
+static bool parseTrueColor(const char* colorName, unsigned long* pixel) {
+    Visual* visual = DefaultVisual(GWindow::m_Display, GWindow::m_Screen);
+    unsigned long rgb;
+    if (visual->c_class != TrueColor || !headlessParseColor(colorName, &rgb))
+        return false;
+    *pixel = channelPixel(((rgb >> 16) & 0xFF) * 0x101, visual->red_mask) |
+        channelPixel(((rgb >> 8) & 0xFF) * 0x101, visual->green_mask) |
+        channelPixel((rgb & 0xFF) * 0x101, visual->blue_mask);
+    return true;
+}
+
+void GWindow::prefetchColor(const char* colorName) {
+    if (m_Display == 0 && !m_Headless)
+        initX();
+    if (colorCache.find(colorName) != colorCache.end())
+        return;
+    unsigned long pixel;
+    if (m_Headless) {
+        // 0x00RRGGBB, as in a 24-bit TrueColor visual
+        if (!headlessParseColor(colorName, &pixel))
+            pixel = 0;
+        colorCache[colorName] = pixel;
+        return;
+    }
+    if (parseTrueColor(colorName, &pixel)) {
+        colorCache[colorName] = pixel;
+        return;
+    }
+#ifdef GWINDOW_XCB
+    if (pendingColors.find(colorName) == pendingColors.end()) {
+        pendingColors[colorName] = xcb_alloc_named_color(
+            xcbConnection, DefaultColormap(m_Display, m_Screen),
+            strlen(colorName), colorName
+        );
+    }
+#endif
+}
+
 unsigned long GWindow::allocateColor(const char* colorName) {
-    XColor c;
-    XParseColor(
-        m_Display, 
-        DefaultColormap(m_Display, m_Screen), 
-        colorName,
-        &c
-    );
-    XAllocColor(
-        m_Display, DefaultColormap(m_Display, m_Screen), &c
+    prefetchColor(colorName);
+    std::unordered_map<std::string, unsigned long>::const_iterator i =
+        colorCache.find(colorName);
+    if (i != colorCache.end())
+        return i->second;
+
+    unsigned long pixel;
+#ifdef GWINDOW_XCB
+    std::unordered_map<std::string, xcb_alloc_named_color_cookie_t>::
+        iterator p = pendingColors.find(colorName);
+    assert(p != pendingColors.end());
+    xcb_generic_error_t* error = 0;
+    xcb_alloc_named_color_reply_t* reply = xcb_alloc_named_color_reply(
+        xcbConnection, p->second, &error
     );
-    return c.pixel;
+    pendingColors.erase(p);
+    if (reply != 0) {
+        pixel = reply->pixel;
+        free(reply);
+    } else {
+        // Unknown color or the colormap is full
+        free(error);
+        pixel = BlackPixel(m_Display, m_Screen);
+    }
+    colorCache[colorName] = pixel;
+    return pixel;
+#else
+    Colormap colormap = DefaultColormap(m_Display, m_Screen);
+    Visual* visual = DefaultVisual(m_Display, m_Screen);
+    XColor c;
+    memset(&c, 0, sizeof(c));
+    if (XParseColor(m_Display, colormap, colorName, &c) == 0) {
+        pixel = BlackPixel(m_Display, m_Screen);    // Unknown color
+    } else if (visual->c_class == TrueColor) {
+        // The pixel is computed from RGB, no XAllocColor round trip
+        pixel = channelPixel(c.red, visual->red_mask) |
+            channelPixel(c.green, visual->green_mask) |
+            channelPixel(c.blue, visual->blue_mask);
+    } else if (XAllocColor(m_Display, colormap, &c) != 0) {
+        pixel = c.pixel;
+    } else {
+        pixel = BlackPixel(m_Display, m_Screen);    // Colormap is full
+    }
+    colorCache[colorName] = pixel;
+    return pixel;
+#endif
 }
 
 void GWindow::setBackground(unsigned long bg) {
-    XSetBackground(m_Display, m_GC, bg);
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->setBackground(bg);
+        return;
+    }
+    if (m_GC != 0)
+        XSetBackground(m_Display, m_GC, bg);
     m_bgPixel = bg;
 }
 
 void GWindow::setBackground(const char* colorName) {
+    flushLines();
     // printf("Setting bg color: %s\n", colorName);
     unsigned long bgPixel = allocateColor(colorName);
-    XSetBackground(m_Display, m_GC, bgPixel);
+    if (m_DisplayList != 0) {
+        m_DisplayList->setBackground(bgPixel);
+        return;
+    }
+    if (m_GC != 0)
+        XSetBackground(m_Display, m_GC, bgPixel);
     m_bgPixel = bgPixel;
 }
 
 void GWindow::setForeground(unsigned long fg) {
-    XSetForeground(m_Display, m_GC, fg);
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->setForeground(fg);
+        return;
+    }
+    if (m_GC != 0)
+        XSetForeground(m_Display, m_GC, fg);
     m_fgPixel = fg;
 }
 
 void GWindow::setForeground(const char* colorName) {
+    flushLines();
     // printf("Setting fg color: %s\n", colorName);
     unsigned long fgPixel = allocateColor(colorName);
-    XSetForeground(m_Display, m_GC, fgPixel);
+    if (m_DisplayList != 0) {
+        m_DisplayList->setForeground(fgPixel);
+        return;
+    }
+    if (m_GC != 0)
+        XSetForeground(m_Display, m_GC, fgPixel);
     m_fgPixel = fgPixel;
 }
 
@@ -1216,77 +2742,498 @@ R2Point GWindow::invMap(const I2Point& p) const {
     );
 }
 
-void GWindow::onExpose(XEvent&) {
+// The batched version computes both coordinates of a point
+// in one SSE2 register, two points per iteration. The operations
+// are the same as in mapX/mapY, so are the results:
+// (top - y) * ycoeff == (y - top) * (-ycoeff) exactly.
 
+void GWindow::map(
+    const R2Point* points, int numPoints, I2Point* result
+) const {
+    int i = 0;
+#ifdef __SSE2__
+    const __m128d origin = _mm_set_pd(m_RWinRect.top(), m_RWinRect.left());
+    const __m128d coeff = _mm_set_pd(-m_ycoeff, m_xcoeff);
+    for (; i + 1 < numPoints; i += 2) {
+        __m128d p0 = _mm_loadu_pd(&(points[i].x));
+        __m128d p1 = _mm_loadu_pd(&(points[i + 1].x));
+        __m128i q0 = _mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(p0, origin), coeff));
+        __m128i q1 = _mm_cvttpd_epi32(_mm_mul_pd(_mm_sub_pd(p1, origin), coeff));
+        _mm_storeu_si128((__m128i*) &(result[i]), _mm_unpacklo_epi64(q0, q1));
+    }
+#endif
+    for (; i < numPoints; ++i)
+        result[i] = map(points[i]);
 }
 
-void GWindow::onResize(XEvent&) {
+bool GWindow::isBoxOutside(int x1, int y1, int x2, int y2) const {
+    if (x1 > x2)
+        std::swap(x1, x2);
+    if (y1 > y2)
+        std::swap(y1, y2);
+    int margin = m_LineWidth / 2 + 1;
+    return (
+        x2 < m_IWinRect.left() - margin || x1 > m_IWinRect.right() + margin ||
+        y2 < m_IWinRect.top() - margin || y1 > m_IWinRect.bottom() + margin
+    );
+}
 
+// The box (x1, y1)-(x2, y2), x1 <= x2, y1 <= y2, is cut by the guard
+// band. Returns false if it is not visible.
+bool GWindow::clipBox(int& x1, int& y1, int& x2, int& y2) const {
+    if (isBoxOutside(x1, y1, x2, y2))
+        return false;
+    int left = m_IWinRect.left() - GUARD_BAND;
+    int top = m_IWinRect.top() - GUARD_BAND;
+    int right = m_IWinRect.right() + GUARD_BAND;
+    int bottom = m_IWinRect.bottom() + GUARD_BAND;
+    x1 = std::max(x1, left);
+    y1 = std::max(y1, top);
+    x2 = std::min(x2, right);
+    y2 = std::min(y2, bottom);
+    return true;
 }
 
-void GWindow::onKeyPress(XEvent&) {
+// The window with the guard band, in pixels (y grows downwards)
+R2Rectangle GWindow::guardBand() const {
+    return R2Rectangle(
+        m_IWinRect.left() - GUARD_BAND, m_IWinRect.top() - GUARD_BAND,
+        m_IWinRect.width() + 2*GUARD_BAND, m_IWinRect.height() + 2*GUARD_BAND
+    );
+}
 
+// Returns false if the segment is not visible
+bool GWindow::clipLine(I2Point& p1, I2Point& p2) const {
+    if (isBoxOutside(p1.x, p1.y, p2.x, p2.y))
+        return false;
+    R2Rectangle band = guardBand();
+    if (
+        band.getXMin() <= std::min(p1.x, p2.x) &&
+        std::max(p1.x, p2.x) <= band.getXMax() &&
+        band.getYMin() <= std::min(p1.y, p2.y) &&
+        std::max(p1.y, p2.y) <= band.getYMax()
+    )
+        return true;
+    return clipSegment(p1, p2, band);
 }
 
-void GWindow::onButtonPress(XEvent&) {
+// XDrawArc and XFillArc cannot be clipped without changing the shape,
+// so an ellipse reaching beyond the guard band is drawn as a polygon,
+// which is clipped like any other. The chords deviate from the arc
+// by less than half a pixel. Returns false if the ellipse fits.
+bool GWindow::drawLargeEllipse(
+    int x, int y, int w, int h, bool fill, bool offscreen
+) {
+    R2Rectangle band = guardBand();
+    if (
+        band.getXMin() <= x && x + w <= band.getXMax() &&
+        band.getYMin() <= y && y + h <= band.getYMax()
+    )
+        return false;
 
+    double rx = w / 2., ry = h / 2.;
+    double cx = x + rx, cy = y + ry;
+    double r = std::max(std::max(rx, ry), 1.);
+    int n = std::max(8, (int) ceil(M_PI / acos(1. - 0.5 / r)));
+    n = std::min(n, MAX_ELLIPSE_VERTICES);
+
+    I2Point* pnt = scratchBuffer(scratchPoints, n + 1);
+    for (int i = 0; i < n; ++i) {
+        double a = 2. * M_PI * i / n;
+        pnt[i] = I2Point(
+            (int) floor(cx + rx * cos(a) + 0.5),
+            (int) floor(cy + ry * sin(a) + 0.5)
+        );
+    }
+    if (fill) {
+        fillPolygon(pnt, n, offscreen);
+    } else {
+        // The current position is not moved by an ellipse
+        R2Point rCurPos = m_RCurPos;
+        I2Point iCurPos = m_ICurPos;
+        pnt[n] = pnt[0];
+        drawPolyline(pnt, n + 1, offscreen);
+        m_RCurPos = rCurPos;
+        m_ICurPos = iCurPos;
+    }
+    return true;
 }
 
-void GWindow::onButtonRelease(XEvent&) {
+// Conversion to the coordinates of X requests, 4 points per iteration
+void GWindow::toXPoints(
+    const I2Point* points, int numPoints, XPoint* result
+) {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 3 < numPoints; i += 4) {
+        __m128i p0 = _mm_loadu_si128((const __m128i*) &(points[i]));
+        __m128i p1 = _mm_loadu_si128((const __m128i*) &(points[i + 2]));
+        _mm_storeu_si128((__m128i*) &(result[i]), _mm_packs_epi32(p0, p1));
+    }
+#endif
+    for (; i < numPoints; ++i) {
+        result[i].x = saturateShort(points[i].x);
+        result[i].y = saturateShort(points[i].y);
+    }
+}
 
+bool GWindow::isExposed(const I2Rectangle& r) const {
+    if (m_ExposeRegion == 0)
+        return true;
+    return XRectInRegion(
+        m_ExposeRegion, r.left(), r.top(), r.width(), r.height()
+    ) != RectangleOut;
 }
 
-void GWindow::onMotionNotify(XEvent&) {
+void GWindow::releaseExposeRegion() {
+    if (m_ExposeRegion != 0) {
+        XDestroyRegion(m_ExposeRegion);
+        m_ExposeRegion = 0;
+    }
+    if (m_InvalidRegion != 0) {
+        XDestroyRegion(m_InvalidRegion);
+        m_InvalidRegion = 0;
+    }
+}
 
+void GWindow::addExposeRectangle(const XEvent& event) {
+    if (m_ExposeRegion == 0)
+        m_ExposeRegion = XCreateRegion();
+    XRectangle rect;
+    rect.x = (short) event.xexpose.x;
+    rect.y = (short) event.xexpose.y;
+    rect.width = (unsigned short) event.xexpose.width;
+    rect.height = (unsigned short) event.xexpose.height;
+    XUnionRectWithRegion(&rect, m_ExposeRegion, m_ExposeRegion);
 }
 
-void GWindow::onCreateNotify(XEvent&) {
+// Calls onExpose with the clip mask set to m_ExposeRegion
+void GWindow::paintExposeRegion(XEvent& event) {
+    flushLines();
+    // Restrict a drawing to the damaged region
+    // (to its bounding box in the headless mode)
+    if (m_GC != 0)
+        XSetRegion(m_Display, m_GC, m_ExposeRegion);
+    if (m_AtlasGC != 0)
+        XSetRegion(m_Display, m_AtlasGC, m_ExposeRegion);
+    if (m_Framebuffer != 0) {
+        XRectangle box;
+        XClipBox(m_ExposeRegion, &box);
+        m_Framebuffer->setClip(box.x, box.y, box.width, box.height);
+    }
 
+    onExpose(event);
+    flushLines();
+
+    // Restore the clip region (the window may be destroyed
+    // in onExpose)
+    if (m_GC != 0)
+        XSetClipMask(m_Display, m_GC, None);
+    if (m_AtlasGC != 0)
+        XSetClipMask(m_Display, m_AtlasGC, None);
+    if (m_Framebuffer != 0)
+        m_Framebuffer->resetClip();
+    if (m_ExposeRegion != 0) {
+        XDestroyRegion(m_ExposeRegion);
+        m_ExposeRegion = 0;
+    }
 }
 
-void GWindow::onDestroyNotify(XEvent&) {
-    //... printf("DestroyNotify event: m_Window=%d\n", m_Window);
+void GWindow::scrollInvalidRegion(int dx, int dy) {
+    if (m_InvalidRegion == 0)
+        return;
+    // The copied pixels are invalid at the new place;
+    // the old place is kept, as it may be not covered by the copy
+    Region moved = XCreateRegion();
+    XUnionRegion(m_InvalidRegion, moved, moved);
+    XOffsetRegion(moved, dx, dy);
+    XUnionRegion(moved, m_InvalidRegion, m_InvalidRegion);
+    XDestroyRegion(moved);
 }
 
-void GWindow::onFocusIn(XEvent&) {
+void GWindow::paintInvalidWindows() {
+    lastPaintTime = monotonicTime();
+    if (!m_InvalidWindows)
+        return;
+    m_InvalidWindows = false;
+
+    GWindow* w = (GWindow*) m_WindowList.next;
+    while (w != (GWindow*) &m_WindowList) {
+        GWindow* nextWindow = (GWindow*) w->next;
+        if (w->m_InvalidRegion != 0) {
+            Region r = w->m_InvalidRegion;
+            w->m_InvalidRegion = 0;
+            if (
+                !w->m_WindowCreated ||
+                (w->m_GC == 0 && w->m_Framebuffer == 0)
+            ) {
+                XDestroyRegion(r);
+            } else if (w->m_ExposeRegion != 0) {
+                // A series of Expose events is in progress:
+                // the area will be painted with it
+                XUnionRegion(r, w->m_ExposeRegion, w->m_ExposeRegion);
+                XDestroyRegion(r);
+            } else {
+                w->m_ExposeRegion = r;
+                XRectangle box;
+                XClipBox(r, &box);
+                XEvent e;
+                memset(&e, 0, sizeof(e));
+                e.type = Expose;
+                e.xany.window = w->m_Window;
+                e.xany.display = m_Display;
+                e.xexpose.x = box.x;
+                e.xexpose.y = box.y;
+                e.xexpose.width = box.width;
+                e.xexpose.height = box.height;
+                e.xexpose.count = 0;
+                w->paintExposeRegion(e);
+            }
+        }
+        w = nextWindow;
+    }
+}
+
+void GWindow::onExpose(XEvent&) {
 
 }
 
-void GWindow::onFocusOut(XEvent&) {
+void GWindow::onResize(XEvent&) {
 
 }
 
-void GWindow::recalculateMap() {
-    if (m_IWinRect.width() == 0)
-        m_IWinRect.setWidth(1);
-    if (m_IWinRect.height() == 0)
-        m_IWinRect.setHeight(1);
+void GWindow::onKeyPress(XEvent&) {
 
-    m_xcoeff = double(m_IWinRect.width()) / m_RWinRect.width();
-    m_ycoeff = double(m_IWinRect.height()) / m_RWinRect.height();
-    m_ICurPos = map(m_RCurPos);
 }
 
-Font GWindow::loadFont(const char* fontName, XFontStruct **font_struct) {
-    //... return XLoadFont(m_Display, fontName);
-    XFontStruct *fStruct = XLoadQueryFont(m_Display, fontName);
-    if (fStruct == NULL)
+void GWindow::onButtonPress(XEvent&) {
+
+}
+
+void GWindow::onButtonRelease(XEvent&) {
+
+}
+
+void GWindow::onMotionNotify(XEvent&) {
+
+}
+
+void GWindow::onCreateNotify(XEvent&) {
+
+}
+
+void GWindow::onDestroyNotify(XEvent&) {
+    //... printf("DestroyNotify event: m_Window=%d\n", m_Window);
+}
+
+void GWindow::onFocusIn(XEvent&) {
+
+}
+
+void GWindow::onFocusOut(XEvent&) {
+
+}
+
+void GWindow::onTimer(int /* timerID */, int /* missed */) {
+
+}
+
+void GWindow::requestFlushNotification() {
+    m_NotifyFlush = true;
+    m_FlushRequested = true;
+}
+
+void GWindow::onFlushed() {
+}
+
+// After painting: send the requests to the server and notify
+// the windows that wait for it
+void GWindow::notifyFlushed() {
+    if (!m_FlushRequested)
+        return;
+    m_FlushRequested = false;
+    if (m_Display != 0)
+        XFlush(m_Display);
+
+    GWindow* w = (GWindow*) m_WindowList.next;
+    while (w != (GWindow*) &m_WindowList) {
+        GWindow* nextWindow = (GWindow*) w->next;
+        if (w->m_NotifyFlush) {
+            w->m_NotifyFlush = false;
+            w->onFlushed();
+        }
+        w = nextWindow;
+    }
+}
+
+void GWindow::recalculateMap() {
+    if (m_IWinRect.width() == 0)
+        m_IWinRect.setWidth(1);
+    if (m_IWinRect.height() == 0)
+        m_IWinRect.setHeight(1);
+
+    m_xcoeff = double(m_IWinRect.width()) / m_RWinRect.width();
+    m_ycoeff = double(m_IWinRect.height()) / m_RWinRect.height();
+    m_ICurPos = map(m_RCurPos);
+}
+
+#ifdef GWINDOW_XCB
+static void copyCharInfo(XCharStruct& c, const xcb_charinfo_t& info) {
+    c.lbearing = info.left_side_bearing;
+    c.rbearing = info.right_side_bearing;
+    c.width = info.character_width;
+    c.ascent = info.ascent;
+    c.descent = info.descent;
+    c.attributes = info.attributes;
+}
+
+// Reply to the font requests sent by prefetchFont. The structure is
+// allocated as XLoadQueryFont does it, so it is released by XFreeFont.
+static XFontStruct* collectFont(const char* fontName) {
+    std::unordered_map<std::string, PendingFont>::iterator p =
+        pendingFonts.find(fontName);
+    if (p == pendingFonts.end())
         return 0;
-    Font font = fStruct->fid;
+    PendingFont pf = p->second;
+    pendingFonts.erase(p);
+
+    xcb_generic_error_t* error = 0;
+    xcb_query_font_reply_t* reply = xcb_query_font_reply(
+        xcbConnection, pf.query, &error
+    );
+    free(error);
+    // The reply has come after OpenFont, so its error (if any) is here
+    error = xcb_request_check(xcbConnection, pf.open);
+    if (error != 0) {
+        free(error);
+        free(reply);
+        return 0;
+    }
+    if (reply == 0) {
+        xcb_close_font(xcbConnection, pf.fontID);
+        return 0;
+    }
+
+    XFontStruct* fs = (XFontStruct*) calloc(1, sizeof(XFontStruct));
+    fs->fid = pf.fontID;
+    fs->direction = reply->draw_direction;
+    fs->min_char_or_byte2 = reply->min_char_or_byte2;
+    fs->max_char_or_byte2 = reply->max_char_or_byte2;
+    fs->min_byte1 = reply->min_byte1;
+    fs->max_byte1 = reply->max_byte1;
+    fs->all_chars_exist = reply->all_chars_exist;
+    fs->default_char = reply->default_char;
+    fs->ascent = reply->font_ascent;
+    fs->descent = reply->font_descent;
+    copyCharInfo(fs->min_bounds, reply->min_bounds);
+    copyCharInfo(fs->max_bounds, reply->max_bounds);
+
+    int numProps = xcb_query_font_properties_length(reply);
+    if (numProps > 0) {
+        const xcb_fontprop_t* props = xcb_query_font_properties(reply);
+        fs->properties = (XFontProp*) malloc(numProps * sizeof(XFontProp));
+        for (int i = 0; i < numProps; ++i) {
+            fs->properties[i].name = props[i].name;
+            fs->properties[i].card32 = props[i].value;
+        }
+        fs->n_properties = numProps;
+    }
+    int numChars = xcb_query_font_char_infos_length(reply);
+    if (numChars > 0) {
+        const xcb_charinfo_t* infos = xcb_query_font_char_infos(reply);
+        fs->per_char = (XCharStruct*) malloc(numChars * sizeof(XCharStruct));
+        for (int i = 0; i < numChars; ++i)
+            copyCharInfo(fs->per_char[i], infos[i]);
+    }
+    free(reply);
+    return fs;
+}
+#endif
+
+Font GWindow::loadFont(const char* fontName, XFontStruct **font_struct) {
+    std::unordered_map<std::string, FontDescriptor*>::const_iterator i =
+        fontsByName.find(fontName);
+    FontDescriptor* fd;
+    if (i != fontsByName.end()) {
+        fd = i->second;
+        ++(fd->ref_count);
+    } else if (m_Headless) {
+        Font fontID = ++lastHeadlessFont;
+        XFontStruct* fStruct = headlessCreateFont(fontID, fontName);
+        if (fStruct == 0)
+            return 0;
+        fd = addFontDescriptor(fontID, fStruct, fontName);
+    } else {
+#ifdef GWINDOW_XCB
+        prefetchFont(fontName);
+        XFontStruct *fStruct = collectFont(fontName);
+#else
+        XFontStruct *fStruct = XLoadQueryFont(m_Display, fontName);
+#endif
+        if (fStruct == NULL)
+            return 0;
+        fd = addFontDescriptor(fStruct->fid, fStruct, fontName);
+    }
     if (font_struct != 0) {
-        *font_struct = fStruct;
+        *font_struct = fd->font_struct;
     }
-    addFontDescriptor(font, fStruct);
-    return font;
+    return fd->font_id;
+}
+
+void GWindow::prefetchFont(const char* fontName) {
+#ifdef GWINDOW_XCB
+    if (m_Display == 0 && !m_Headless)
+        initX();
+    if (
+        m_Headless ||
+        fontsByName.find(fontName) != fontsByName.end() ||
+        pendingFonts.find(fontName) != pendingFonts.end()
+    )
+        return;
+    PendingFont pf;
+    pf.fontID = xcb_generate_id(xcbConnection);
+    pf.open = xcb_open_font_checked(
+        xcbConnection, pf.fontID, strlen(fontName), fontName
+    );
+    pf.query = xcb_query_font(xcbConnection, pf.fontID);
+    pendingFonts[fontName] = pf;
+#else
+    (void) fontName;    // XLoadQueryFont waits for its reply anyway
+#endif
+}
+
+void GWindow::releasePrefetchedFonts() {
+#ifdef GWINDOW_XCB
+    std::unordered_map<std::string, PendingFont>::const_iterator f;
+    for (f = pendingFonts.begin(); f != pendingFonts.end(); ++f) {
+        xcb_discard_reply(xcbConnection, f->second.query.sequence);
+        // A font that could not be opened must not be closed; all the
+        // replies have been requested, so this is one round trip at most
+        xcb_generic_error_t* error =
+            xcb_request_check(xcbConnection, f->second.open);
+        if (error == 0)
+            xcb_close_font(xcbConnection, f->second.fontID);
+        free(error);
+    }
+    pendingFonts.clear();
+#endif
 }
 
 void GWindow::unloadFont(Font fontID) {
-    //... XUnloadFont(m_Display, fontID);
     FontDescriptor* fd = findFont(fontID);
     if (fd == 0) {
-        XUnloadFont(m_Display, fontID);
-    } else {
-        XFreeFont(m_Display, fd->font_struct);
+        releaseAtlases(fontID);
+        releaseRasterGlyphs(fontID);
+        if (m_Display != 0)
+            XUnloadFont(m_Display, fontID);
+    } else if (--(fd->ref_count) <= 0) {
+        // The last user of the font
+        releaseAtlases(fontID);
+        releaseRasterGlyphs(fontID);
+        if (m_Headless)
+            headlessFreeFont(fd->font_struct);
+        else
+            XFreeFont(m_Display, fd->font_struct);
         removeFontDescriptor(fd);
     }
 }
@@ -1297,14 +3244,57 @@ XFontStruct* GWindow::queryFont(Font fontID) const {
     FontDescriptor* fd = findFont(fontID);
     if (fd != 0) {
         return fd->font_struct;
-    } else {
+    } else if (m_Display != 0) {
         // Should not come here!
         return XQueryFont(m_Display, fontID);
     }
+    return 0;
+}
+
+int GWindow::charAdvance(Font fontID, int c) {
+    FontDescriptor* fd = findFont(fontID);
+    if (fd == 0)
+        return 0;
+    return fd->advance[c & 0xFF];
+}
+
+int GWindow::textWidth(Font fontID, const char* str, int len /* = (-1) */) {
+    FontDescriptor* fd = findFont(fontID);
+    if (fd == 0)
+        return 0;
+    if (len < 0)
+        len = (int) strlen(str);
+    int w = 0;
+    for (int i = 0; i < len; ++i)
+        w += fd->advance[(unsigned char) str[i]];
+    return w;
 }
 
 void GWindow::setFont(Font fontID) {
-    XSetFont(m_Display, m_GC, fontID);
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->setFont(fontID);
+        return;
+    }
+    if (m_GC != 0)
+        XSetFont(m_Display, m_GC, fontID);
+    m_Font = fontID;
+}
+
+void GWindow::setTextBackend(TextBackend backend) {
+    m_TextBackend = backend;
+}
+
+void GWindow::setOffscreenBackend(OffscreenBackend backend) {
+    m_OffscreenBackend = backend;
+}
+
+void GWindow::setRasterThreads(int numThreads) {
+    tileRenderer.setNumThreads(numThreads);
+}
+
+int GWindow::rasterThreads() {
+    return tileRenderer.numThreads();
 }
 
 // Message from Window Manager, such as "Close Window"
@@ -1342,13 +3332,31 @@ void GWindow::setLineAttributes(
     unsigned int line_width, int line_style,
     int cap_style, int join_style
 ) {
-    XSetLineAttributes(
-        m_Display, m_GC,
-        line_width, line_style, cap_style, join_style
-    );
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->setLineAttributes(
+            (int) line_width, line_style, cap_style, join_style
+        );
+        return;
+    }
+    if (m_GC != 0) {
+        XSetLineAttributes(
+            m_Display, m_GC,
+            line_width, line_style, cap_style, join_style
+        );
+    }
+    m_LineWidth = (int) line_width;
+    m_LineSolid = (line_style == LineSolid);
+    m_ThinSolidLines = (line_width <= 1 && m_LineSolid);
 }
 
 void GWindow::setLineWidth(unsigned int line_width) {
+    flushLines();
+    if (m_DisplayList != 0) {
+        // Style < 0 means "change the width only"
+        m_DisplayList->setLineAttributes((int) line_width, -1, 0, 0);
+        return;
+    }
     XGCValues values;
     unsigned long valuemask = GCLineWidth;
     /*...
@@ -1358,17 +3366,45 @@ void GWindow::setLineWidth(unsigned int line_width) {
     );
     ...*/
     values.line_width = (int) line_width;
-    XChangeGC(
-        m_Display, m_GC,
-        valuemask, &values
-    );
+    if (m_GC != 0) {
+        XChangeGC(
+            m_Display, m_GC,
+            valuemask, &values
+        );
+    }
+    m_LineWidth = (int) line_width;
+    m_ThinSolidLines = (line_width <= 1 && m_LineSolid);
 }
 
 void GWindow::drawEllipse(const I2Rectangle& r, bool offscreen /* = false */) {
+    flushLines();
+    if (m_DisplayList != 0) {
+        m_DisplayList->addEllipse(r, false);
+        return;
+    }
+    if (isBoxOutside(r.left(), r.top(), r.right(), r.bottom()))
+        return;
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
 
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(raster, r.left(), r.top(), r.right(), r.bottom());
+        raster->drawEllipse(
+            r.left(), r.top(), r.width(), r.height(), (uint32_t) m_fgPixel, m_LineWidth
+        );
+        return;
+    }
+    if (
+        drawLargeEllipse(
+            r.left(), r.top(), r.width(), r.height(), false, offscreen
+        )
+    )
+        return;
+    if (draw == m_Pixmap)
+        addOffscreenDamage(r.left(), r.top(), r.right(), r.bottom());
+
     ::XDrawArc(
         m_Display,
         draw,
@@ -1379,13 +3415,52 @@ void GWindow::drawEllipse(const I2Rectangle& r, bool offscreen /* = false */) {
 }
 
 void GWindow::drawEllipse(const R2Rectangle& r, bool offscreen /* = false */) {
+    flushLines();
     I2Point leftTop = map(R2Point(r.left(), r.top()));
     I2Point rightBottom = map(R2Point(r.right(), r.bottom()));
 
+    if (m_DisplayList != 0) {
+        m_DisplayList->addEllipse(
+            I2Rectangle(
+                leftTop,
+                rightBottom.x - leftTop.x, rightBottom.y - leftTop.y
+            ), false
+        );
+        return;
+    }
+    if (isBoxOutside(leftTop.x, leftTop.y, rightBottom.x, rightBottom.y))
+        return;
+
     Drawable draw = m_Window;
     if (offscreen && m_Pixmap != 0)
         draw = m_Pixmap;
 
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        addRasterDamage(
+            raster, leftTop.x, leftTop.y, rightBottom.x, rightBottom.y
+        );
+        raster->drawEllipse(
+            leftTop.x, leftTop.y,
+            rightBottom.x - leftTop.x, rightBottom.y - leftTop.y,
+            (uint32_t) m_fgPixel, m_LineWidth
+        );
+        return;
+    }
+    if (
+        drawLargeEllipse(
+            leftTop.x, leftTop.y,
+            rightBottom.x - leftTop.x, rightBottom.y - leftTop.y,
+            false, offscreen
+        )
+    )
+        return;
+    if (draw == m_Pixmap) {
+        addOffscreenDamage(
+            leftTop.x, leftTop.y, rightBottom.x, rightBottom.y
+        );
+    }
+
     ::XDrawArc(
         m_Display,
         draw,
@@ -1421,6 +3496,8 @@ void GWindow::drawCircle(
 }
 
 bool GWindow::supportsDepth(int d) const {
+    if (m_Headless)
+        return (d == 24 || d == 32);    // Rasters of 32-bit pixels
     if (m_Display == 0)
         return false;
     int numDepths = 0;
@@ -1447,67 +3524,866 @@ bool GWindow::supportsDepth32() const {
     return supportsDepth(32);
 }
 
+// The offscreen buffer grows by at least a half, rounded up
+// to PIXMAP_GRANULARITY pixels; it shrinks only after the window
+// has been smaller than the buffer for PIXMAP_SHRINK_DELAY
+static const int PIXMAP_GRANULARITY = 256;
+static const long long PIXMAP_SHRINK_DELAY = 2000000000LL;   // 2 sec
+
+static int roundPixmapSize(int n) {
+    if (n < 1)
+        n = 1;
+    return (n + PIXMAP_GRANULARITY - 1) / PIXMAP_GRANULARITY *
+        PIXMAP_GRANULARITY;
+}
+
+static int grownPixmapSize(int allocated, int needed) {
+    if (needed <= allocated)
+        return allocated;
+    int n = allocated + allocated / 2;
+    if (n < needed)
+        n = needed;
+    return roundPixmapSize(n);
+}
+
+// Raster offscreen buffer.
+// Errors of XShmAttach (e.g. the server is on another host)
+// are caught by a temporary error handler.
+static bool shmAttachFailed = false;
+
+static int shmErrorHandler(Display*, XErrorEvent*) {
+    shmAttachFailed = true;
+    return 0;
+}
+
+static bool attachSharedMemory(Display* display, XShmSegmentInfo* info) {
+    shmAttachFailed = false;
+    XErrorHandler oldHandler = XSetErrorHandler(shmErrorHandler);
+    Status res = XShmAttach(display, info);
+    XSync(display, False);
+    XSetErrorHandler(oldHandler);
+    return (res != 0 && !shmAttachFailed);
+}
+
+static int hostByteOrder() {
+    unsigned int one = 1;
+    return (*((unsigned char*) &one) == 1)? LSBFirst : MSBFirst;
+}
+
+static void destroyRasterImage(Display* display, RasterImage* ri) {
+    if (ri->image != 0) {
+        if (ri->shared) {
+            XShmDetach(display, &(ri->shmInfo));
+            XSync(display, False);
+            shmdt(ri->shmInfo.shmaddr);
+            ri->image->data = 0;
+        }
+        XDestroyImage(ri->image);   // Frees the data of a plain image
+    }
+    delete ri;
+}
+
+// Image in the shared memory, if MIT-SHM is available
+static RasterImage* createRasterImage(
+    Display* display, Visual* visual, int depth, int width, int height
+) {
+    RasterImage* ri = new RasterImage;
+    ri->image = 0;
+    ri->shared = false;
+    ri->pending = 0;
+    memset(&(ri->shmInfo), 0, sizeof(ri->shmInfo));
+
+    if (XShmQueryExtension(display)) {
+        ri->image = XShmCreateImage(
+            display, visual, depth, ZPixmap, 0, &(ri->shmInfo),
+            width, height
+        );
+    }
+    if (ri->image != 0) {
+        ri->shmInfo.shmid = shmget(
+            IPC_PRIVATE, ri->image->bytes_per_line * ri->image->height,
+            IPC_CREAT | 0600
+        );
+        ri->shmInfo.shmaddr = (char*) (-1);
+        if (ri->shmInfo.shmid >= 0) {
+            ri->shmInfo.shmaddr = (char*) shmat(ri->shmInfo.shmid, 0, 0);
+            if (ri->shmInfo.shmaddr != (char*) (-1)) {
+                ri->image->data = ri->shmInfo.shmaddr;
+                ri->shmInfo.readOnly = False;
+                ri->shared = attachSharedMemory(display, &(ri->shmInfo));
+                if (ri->shared) {
+                    shmCompletionType =
+                        XShmGetEventBase(display) + ShmCompletion;
+                }
+            }
+            // The segment is removed when both sides detach from it
+            shmctl(ri->shmInfo.shmid, IPC_RMID, 0);
+        }
+        if (!ri->shared) {
+            if (ri->shmInfo.shmaddr != (char*) (-1))
+                shmdt(ri->shmInfo.shmaddr);
+            ri->image->data = 0;
+            XDestroyImage(ri->image);
+            ri->image = 0;
+        }
+    }
+
+    if (ri->image == 0) {
+        // Plain image, sent through the socket by XPutImage
+        ri->image = XCreateImage(
+            display, visual, depth, ZPixmap, 0, 0, width, height, 32, 0
+        );
+        if (ri->image != 0) {
+            ri->image->data = (char*) calloc(
+                ri->image->bytes_per_line, ri->image->height
+            );
+            if (ri->image->data == 0) {
+                XDestroyImage(ri->image);
+                ri->image = 0;
+            }
+        }
+    }
+
+    // The raster writes 32-bit pixels of the host byte order
+    if (
+        ri->image == 0 ||
+        ri->image->bits_per_pixel != 32 ||
+        ri->image->byte_order != hostByteOrder()
+    ) {
+        destroyRasterImage(display, ri);
+        return 0;
+    }
+    return ri;
+}
+
+// Render 256 characters of a font in a bitmap and read it back
+static GGlyphMasks* createRasterGlyphs(
+    Display* display, Font fontID, XFontStruct* fs
+) {
+    GGlyphMasks* g = new GGlyphMasks;
+    FontDescriptor metrics(fontID, fs);
+    memcpy(g->advance, metrics.advance, sizeof(g->advance));
+    g->originX = (fs->min_bounds.lbearing < 0)? (-fs->min_bounds.lbearing) : 0;
+    int right = fs->max_bounds.rbearing;
+    if (right < fs->max_bounds.width)
+        right = fs->max_bounds.width;
+    g->cellWidth = g->originX + right;
+    if (g->cellWidth < 1)
+        g->cellWidth = 1;
+    g->ascent = fs->max_bounds.ascent;
+    g->descent = fs->max_bounds.descent;
+    int h = g->ascent + g->descent;
+    if (h < 1) {
+        h = 1;
+        g->descent = 1 - g->ascent;
+    }
+
+    int w = 16 * g->cellWidth;
+    int height = 16 * h;
+    g->mask.assign((size_t) w * height, 0);
+
+    Pixmap bitmap = XCreatePixmap(
+        display, DefaultRootWindow(display), w, height, 1
+    );
+    GC gc = XCreateGC(display, bitmap, 0, 0);
+    XSetForeground(display, gc, 0);
+    XFillRectangle(display, bitmap, gc, 0, 0, w, height);
+    XSetForeground(display, gc, 1);
+    if (fontID != 0)
+        XSetFont(display, gc, fontID);
+    for (int c = 0; c < 256; ++c) {
+        char ch = (char) c;
+        XDrawString(
+            display, bitmap, gc,
+            (c & 15) * g->cellWidth + g->originX, (c >> 4) * h + g->ascent,
+            &ch, 1
+        );
+    }
+    XImage* img = XGetImage(display, bitmap, 0, 0, w, height, 1, XYPixmap);
+    if (img != 0) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < w; ++x)
+                g->mask[(size_t) y * w + x] = (XGetPixel(img, x, y) != 0);
+        }
+        XDestroyImage(img);
+    }
+    XFreeGC(display, gc);
+    XFreePixmap(display, bitmap);
+    return g;
+}
+
 bool GWindow::createOffscreenBuffer() {
-    if (m_Display == 0)
+    if (m_Display == 0 && !m_Headless)
         return false;
+    if (m_Pixmap != 0 || m_Raster != 0)
+        return true;
+    return reallocateOffscreenBuffer(
+        roundPixmapSize(m_IWinRect.width()),
+        roundPixmapSize(m_IWinRect.height())
+    );
+}
+
+// Allocate a new pixmap and copy the contents of the old one
+bool GWindow::reallocateOffscreenBuffer(int width, int height) {
+    flushLines();
+    if (
+        m_Raster != 0 ||
+        (m_Pixmap == 0 && m_OffscreenBackend == OFFSCREEN_BACKEND_RASTER)
+    ) {
+        if (reallocateRaster(width, height))
+            return true;
+        if (m_Raster != 0 || m_Headless)
+            return false;
+        // The visual is not supported by the raster: use a pixmap
+    }
     int depth = DefaultDepth(
         m_Display, DefaultScreen(m_Display)
     );
-    m_Pixmap = ::XCreatePixmap(
+    Pixmap pixmap = ::XCreatePixmap(
         m_Display, m_Window,
-        m_IWinRect.width(), m_IWinRect.height(),
+        width, height,
         depth
     );
+    if (pixmap == 0)
+        return false;
 
     /*...
     printf(
         "Creating offscreen pixmap: width=%d, height=%d, pixmap=%ld\n",
-        m_IWinRect.width(), m_IWinRect.height(),
-        (long) m_Pixmap
+        width, height, (long) pixmap
     );
     ...*/
 
-    return (m_Pixmap > 0);
+    if (m_Pixmap != 0) {
+        // Keep the old picture; the GC may be clipped by onExpose
+        XSetClipMask(m_Display, m_GC, None);
+        ::XCopyArea(
+            m_Display, m_Pixmap, pixmap, m_GC,
+            0, 0,
+            (m_PixmapWidth < width)? m_PixmapWidth : width,
+            (m_PixmapHeight < height)? m_PixmapHeight : height,
+            0, 0
+        );
+        if (m_ExposeRegion != 0)
+            XSetRegion(m_Display, m_GC, m_ExposeRegion);
+        ::XFreePixmap(m_Display, m_Pixmap);
+    }
+    m_Pixmap = pixmap;
+    m_PixmapWidth = width;
+    m_PixmapHeight = height;
+    m_PixmapShrinkTime = 0;
+    return true;
+}
+
+// Allocate a new image for the raster buffer and copy the old picture
+bool GWindow::reallocateRaster(int width, int height) {
+    GRaster* raster = new GRaster();
+    RasterImage* ri = 0;
+    if (m_Headless) {
+        // Nothing is shown by a server: the raster has its own memory
+        if (!raster->create(width, height)) {
+            delete raster;
+            return false;
+        }
+    } else {
+        Visual* visual = DefaultVisual(m_Display, m_Screen);
+        int depth = DefaultDepth(m_Display, m_Screen);
+        if (visual->c_class == TrueColor && (depth == 24 || depth == 32))
+            ri = createRasterImage(m_Display, visual, depth, width, height);
+        if (ri == 0) {
+            delete raster;
+            return false;
+        }
+        raster->attach(
+            (uint32_t*) ri->image->data, width, height,
+            ri->image->bytes_per_line / 4
+        );
+    }
+    if (m_Raster != 0) {
+        drawingRaster(true);      // Wait for the last XShmPutImage
+        raster->copyFrom(*m_Raster, m_PixmapWidth, m_PixmapHeight);
+        releaseRaster();
+    }
+    m_Raster = raster;
+    m_RasterImage = ri;
+    m_PixmapWidth = width;
+    m_PixmapHeight = height;
+    m_PixmapShrinkTime = 0;
+    return true;
+}
+
+void GWindow::releaseRaster() {
+    delete m_Raster;
+    m_Raster = 0;
+    if (m_RasterImage != 0) {
+        destroyRasterImage(m_Display, m_RasterImage);
+        m_RasterImage = 0;
+    }
+}
+
+// Raster to draw in: the raster offscreen buffer, or the window itself
+// in the headless mode; 0 if drawing is performed by X requests
+GRaster* GWindow::drawingRaster(bool offscreen) {
+    if (m_DisplayList != 0)
+        return 0;
+    if (!offscreen || m_Raster == 0)
+        return m_Framebuffer;
+    while (m_RasterImage != 0 && m_RasterImage->pending > 0) {
+        // The server may still be reading the shared memory: wait for
+        // its completion event only, other events stay in the queue
+        XEvent e;
+        XIfEvent(m_Display, &e, isShmCompletion, (XPointer) m_RasterImage);
+        --(m_RasterImage->pending);
+    }
+    return m_Raster;
+}
+
+// Glyph masks of a font, created when the font is used first time
+GGlyphMasks* GWindow::findRasterGlyphs(Font fontID) {
+    GGlyphTable::const_iterator i = rasterGlyphs.find(fontID);
+    if (i != rasterGlyphs.end())
+        return i->second;
+
+    GGlyphMasks* g;
+    FontDescriptor* fd = (fontID != 0)? findFont(fontID) : 0;
+    if (m_Headless) {
+        // The default font is "fixed"
+        XFontStruct* fs = (fd != 0)?
+            fd->font_struct : headlessCreateFont(0, "fixed");
+        if (fs == 0)
+            return 0;
+        g = headlessCreateGlyphs(fs);
+        if (fd == 0)
+            headlessFreeFont(fs);
+    } else if (fd != 0) {
+        g = createRasterGlyphs(m_Display, fontID, fd->font_struct);
+    } else {
+        XFontStruct* fs = XQueryFont(
+            m_Display, (fontID != 0)? fontID : XGContextFromGC(m_GC)
+        );
+        if (fs == 0)
+            return 0;
+        g = createRasterGlyphs(m_Display, fontID, fs);
+        XFreeFontInfo(0, fs, 1);
+    }
+    rasterGlyphs[fontID] = g;
+    return g;
+}
+
+// Text in a raster is drawn with glyph masks
+void GWindow::drawRasterString(
+    GRaster* raster, int x, int y, const char* str, int len
+) {
+    GGlyphMasks* g = findRasterGlyphs(m_Font);
+    if (g == 0)
+        return;
+    int w = raster->drawString(x, y, str, len, *g, (uint32_t) m_fgPixel);
+    addRasterDamage(
+        raster,
+        x - g->originX, y - g->ascent, x + w + g->cellWidth, y + g->descent
+    );
+}
+
+// Drawing in a raster: the offscreen buffer records the damaged area;
+// the picture of a headless window is marked to be written in a frame
+void GWindow::addRasterDamage(
+    GRaster* raster, int x1, int y1, int x2, int y2
+) {
+    if (raster == m_Raster)
+        addOffscreenDamage(x1, y1, x2, y2);
+    else
+        m_FramebufferChanged = true;
+}
+
+// Adjust the offscreen buffer to the window size
+bool GWindow::resizeOffscreenBuffer() {
+    int width = m_IWinRect.width();
+    int height = m_IWinRect.height();
+    if (width > m_PixmapWidth || height > m_PixmapHeight) {
+        return reallocateOffscreenBuffer(
+            grownPixmapSize(m_PixmapWidth, width),
+            grownPixmapSize(m_PixmapHeight, height)
+        );
+    }
+
+    int fitWidth = roundPixmapSize(width);
+    int fitHeight = roundPixmapSize(height);
+    if (fitWidth >= m_PixmapWidth && fitHeight >= m_PixmapHeight) {
+        m_PixmapShrinkTime = 0;
+        return true;
+    }
+
+    // The buffer is too large
+    long long now = monotonicTime();
+    if (m_PixmapShrinkTime == 0) {
+        m_PixmapShrinkTime = now;
+    } else if (now - m_PixmapShrinkTime >= PIXMAP_SHRINK_DELAY) {
+        return reallocateOffscreenBuffer(fitWidth, fitHeight);
+    }
+    return true;
+}
+
+void GWindow::damageOffscreen(const I2Rectangle& r) {
+    if (r.width() <= 0 || r.height() <= 0)
+        return;
+    addOffscreenDamage(r.left(), r.top(), r.right(), r.bottom());
+}
+
+void GWindow::damageOffscreen() {
+    damageOffscreen(
+        I2Rectangle(0, 0, m_IWinRect.width(), m_IWinRect.height())
+    );
+}
+
+// Add a bounding box of a drawing (corners in any order);
+// the box is extended by a half of line width for wide lines
+void GWindow::addOffscreenDamage(int x1, int y1, int x2, int y2) {
+    if (m_DisplayList != 0)
+        return;                 // Nothing is drawn while recording
+    if (x1 > x2) { int t = x1; x1 = x2; x2 = t; }
+    if (y1 > y2) { int t = y1; y1 = y2; y2 = t; }
+    int margin = m_LineWidth / 2 + 1;
+    x1 -= margin; y1 -= margin;
+    x2 += margin; y2 += margin;
+
+    // Only the window part of the buffer is shown
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > m_IWinRect.width()) x2 = m_IWinRect.width();
+    if (y2 > m_IWinRect.height()) y2 = m_IWinRect.height();
+    if (x1 >= x2 || y1 >= y2)
+        return;
+
+    XRectangle rect;
+    rect.x = (short) x1;
+    rect.y = (short) y1;
+    rect.width = (unsigned short) (x2 - x1);
+    rect.height = (unsigned short) (y2 - y1);
+    if (m_OffscreenDamage == 0)
+        m_OffscreenDamage = XCreateRegion();
+    XUnionRectWithRegion(&rect, m_OffscreenDamage, m_OffscreenDamage);
 }
 
 void GWindow::swapBuffers() {
-    if (m_Pixmap > 0) {
-        ::XCopyArea(
-            m_Display, m_Pixmap, m_Window, m_GC,
-            0, 0,       // Source
-            m_IWinRect.width(), m_IWinRect.height(),
-            0, 0        // Destination
+    flushLines();
+    if (m_Pixmap != 0 || m_Raster != 0) {
+        // Inside onExpose, the exposed area must be copied as well
+        if (m_ExposeRegion != 0) {
+            if (m_OffscreenDamage == 0)
+                m_OffscreenDamage = XCreateRegion();
+            XUnionRegion(
+                m_ExposeRegion, m_OffscreenDamage, m_OffscreenDamage
+            );
+        }
+
+        if (m_OffscreenDamage != 0) {
+            // Copy only the damaged rectangles: the damage region
+            // is used as the clip mask for one copy of its bounding box
+            XRectangle box;
+            XClipBox(m_OffscreenDamage, &box);
+            if (m_Framebuffer != 0) {
+                // Headless mode: the box is copied in the picture
+                // of the window, regardless of the exposed area
+                m_Framebuffer->resetClip();
+                m_Framebuffer->copyArea(
+                    *m_Raster, box.x, box.y, box.width, box.height,
+                    box.x, box.y
+                );
+                m_FramebufferChanged = true;
+                if (m_ExposeRegion != 0) {
+                    XClipBox(m_ExposeRegion, &box);
+                    m_Framebuffer->setClip(box.x, box.y, box.width, box.height);
+                }
+            } else {
+                XSetRegion(m_Display, m_GC, m_OffscreenDamage);
+                if (m_Raster != 0 && m_RasterImage->shared) {
+                    XShmPutImage(
+                        m_Display, m_Window, m_GC, m_RasterImage->image,
+                        box.x, box.y,       // Source
+                        box.x, box.y,       // Destination
+                        box.width, box.height,
+                        True        // Send ShmCompletion
+                    );
+                    ++(m_RasterImage->pending);
+                } else if (m_Raster != 0) {
+                    XPutImage(
+                        m_Display, m_Window, m_GC, m_RasterImage->image,
+                        box.x, box.y,       // Source
+                        box.x, box.y,       // Destination
+                        box.width, box.height
+                    );
+                } else {
+                    ::XCopyArea(
+                        m_Display, m_Pixmap, m_Window, m_GC,
+                        box.x, box.y,       // Source
+                        box.width, box.height,
+                        box.x, box.y        // Destination
+                    );
+                }
+                if (m_ExposeRegion != 0)
+                    XSetRegion(m_Display, m_GC, m_ExposeRegion);
+                else
+                    XSetClipMask(m_Display, m_GC, None);
+            }
+            XDestroyRegion(m_OffscreenDamage);
+            m_OffscreenDamage = 0;
+        }
+
+        // A buffer that stayed too large is released
+        // after the picture is shown
+        if (m_PixmapShrinkTime != 0)
+            resizeOffscreenBuffer();
+    }
+}
+
+// Picture of a headless window. As a server does, the old contents
+// are kept, and the new area is filled with the background.
+void GWindow::resizeFramebuffer(int width, int height) {
+    GRaster* framebuffer = new GRaster();
+    if (framebuffer->create(width, height)) {
+        framebuffer->fillRectangle(
+            0, 0, width, height, (uint32_t) m_bgPixel
+        );
+        if (m_Framebuffer != 0)
+            framebuffer->copyFrom(*m_Framebuffer, width, height);
+    }
+    delete m_Framebuffer;
+    m_Framebuffer = framebuffer;
+    m_FramebufferChanged = true;
+}
+
+void GWindow::copyArea(
+    int x, int y, int width, int height, int dstX, int dstY
+) {
+    flushLines();
+    if (m_Framebuffer != 0) {
+        m_Framebuffer->copyArea(
+            *m_Framebuffer, x, y, width, height, dstX, dstY
+        );
+        m_FramebufferChanged = true;
+        return;
+    }
+    ::XCopyArea(
+        m_Display, m_Window, m_Window, m_GC,
+        x, y, width, height,
+        dstX, dstY
+    );
+}
+
+void GWindow::drawImage(
+    int x, int y, int width, int height, const uint32_t* pixels,
+    bool offscreen /* = false */
+) {
+    flushLines();
+    if (width <= 0 || height <= 0 || m_DisplayList != 0)
+        return;
+    if (isBoxOutside(x, y, x + width, y + height))
+        return;
+    GRaster* raster = drawingRaster(offscreen);
+    if (raster != 0) {
+        GRaster image;
+        image.attach((uint32_t*) pixels, width, height, width);
+        addRasterDamage(raster, x, y, x + width, y + height);
+        raster->copyArea(image, 0, 0, width, height, x, y);
+        return;
+    }
+    if (m_Display == 0)
+        return;
+    Drawable draw = m_Window;
+    if (offscreen && m_Pixmap != 0)
+        draw = m_Pixmap;
+
+    // The image uses the pixels in place; XPutImage splits
+    // a large image in several requests
+    XImage* img = XCreateImage(
+        m_Display, DefaultVisual(m_Display, m_Screen),
+        DefaultDepth(m_Display, m_Screen), ZPixmap, 0,
+        (char*) pixels, width, height, 32, width * 4
+    );
+    if (img == 0)
+        return;
+    if (img->bits_per_pixel == 32 && img->byte_order == hostByteOrder()) {
+        if (draw == m_Pixmap)
+            addOffscreenDamage(x, y, x + width, y + height);
+        XPutImage(m_Display, draw, m_GC, img, 0, 0, x, y, width, height);
+    }
+    img->data = 0;
+    XDestroyImage(img);
+}
+
+GC GWindow::createGC() {
+    if (m_Display == 0 || m_Window == 0)
+        return 0;
+    return XCreateGC(m_Display, m_Window, 0, 0);
+}
+
+void GWindow::freeGC(GC gc) {
+    if (gc == 0 || m_Display == 0)
+        return;
+    if (gc == lineBatchGC)
+        flushLines();
+    XFreeGC(m_Display, gc);
+}
+
+bool GWindow::writePPM(const char* path) const {
+    const GRaster* raster = (m_Framebuffer != 0)? m_Framebuffer : m_Raster;
+    if (raster == 0)
+        return false;
+    return writeRasterPPM(
+        *raster, m_IWinRect.width(), m_IWinRect.height(), path
+    );
+}
+
+void GWindow::beginDisplayList(GDisplayList& list) {
+    flushLines();
+    list.clear();
+    m_DisplayList = &list;
+}
+
+void GWindow::endDisplayList() {
+    m_DisplayList = 0;
+}
+
+// Is a bounding box (xmin, ymin, xmax, ymax) in the window
+// and in the exposed region?
+bool GWindow::isBoxVisible(const int* box) const {
+    int margin = m_LineWidth / 2 + 1;
+    int x1 = box[0] - margin, y1 = box[1] - margin;
+    int x2 = box[2] + margin, y2 = box[3] + margin;
+    if (
+        x2 < 0 || y2 < 0 ||
+        x1 > m_IWinRect.width() || y1 > m_IWinRect.height()
+    )
+        return false;
+    return isExposed(I2Rectangle(x1, y1, x2 - x1 + 1, y2 - y1 + 1));
+}
+
+void GWindow::drawDisplayList(
+    const GDisplayList& list, bool offscreen /* = false */
+) {
+    GRaster* raster = drawingRaster(offscreen);
+    if (list.numCommands() >= TILED_MIN_COMMANDS && raster != 0) {
+        drawDisplayListTiled(list, raster);
+        return;
+    }
+
+    const std::vector<int>& d = list.m_Data;
+    std::vector<I2Point> points;
+    size_t i = 0;
+    while (i < d.size()) {
+        int op = d[i++];
+        switch (op) {
+        case GDisplayList::OP_FOREGROUND:
+            setForeground((unsigned long)(unsigned int) d[i]);
+            ++i;
+            continue;
+        case GDisplayList::OP_BACKGROUND:
+            setBackground((unsigned long)(unsigned int) d[i]);
+            ++i;
+            continue;
+        case GDisplayList::OP_FONT:
+            setFont((Font)(unsigned int) d[i]);
+            ++i;
+            continue;
+        case GDisplayList::OP_LINE_ATTRIBUTES:
+            if (d[i + 1] < 0)
+                setLineWidth((unsigned int) d[i]);
+            else
+                setLineAttributes((unsigned int) d[i], d[i+1], d[i+2], d[i+3]);
+            i += 4;
+            continue;
+        }
+
+        // Drawing commands
+        const int* box = &(d[i]);
+        i += 4;
+        bool visible = isBoxVisible(box);
+        if (
+            op == GDisplayList::OP_POLYLINE ||
+            op == GDisplayList::OP_FILL_POLYGON
+        ) {
+            int n = d[i++];
+            if (visible) {
+                points.resize(n);
+                for (int k = 0; k < n; ++k)
+                    points[k] = I2Point(d[i + 2*k], d[i + 2*k + 1]);
+                if (op == GDisplayList::OP_POLYLINE)
+                    drawPolyline(&(points[0]), n, offscreen);
+                else
+                    fillPolygon(&(points[0]), n, offscreen);
+            }
+            i += 2*n;
+        } else if (op == GDisplayList::OP_STRING) {
+            if (visible && d[i+3] > 0) {
+                drawString(
+                    d[i], d[i+1], &(list.m_Text[d[i+2]]), d[i+3], offscreen
+                );
+            }
+            i += 4;
+        } else {
+            if (visible) {
+                I2Rectangle r(d[i], d[i+1], d[i+2], d[i+3]);
+                if (op == GDisplayList::OP_FILL_RECTANGLE)
+                    fillRectangle(r, offscreen);
+                else if (op == GDisplayList::OP_FILL_ELLIPSE)
+                    fillEllipse(r, offscreen);
+                else
+                    drawEllipse(r, offscreen);
+            }
+            i += 4;
+        }
+    }
+}
+
+// Replay a list in a raster by tiles on several threads
+void GWindow::drawDisplayListTiled(
+    const GDisplayList& list, GRaster* raster
+) {
+    // Glyphs are read from the server before the threads start;
+    // the state at the end of the list is set after the replay
+    const std::vector<int>& d = list.m_Data;
+    int foreground = (-1), background = (-1), font = (-1);
+    int lineAttributes = (-1), lineWidth = (-1);
+    findRasterGlyphs(m_Font);
+    size_t i = 0;
+    while (i < d.size()) {
+        int op = d[i];
+        switch (op) {
+        case GDisplayList::OP_FOREGROUND:
+            foreground = (int) i;
+            i += 2;
+            continue;
+        case GDisplayList::OP_BACKGROUND:
+            background = (int) i;
+            i += 2;
+            continue;
+        case GDisplayList::OP_FONT:
+            font = (int) i;
+            findRasterGlyphs((Font)(unsigned int) d[i+1]);
+            i += 2;
+            continue;
+        case GDisplayList::OP_LINE_ATTRIBUTES:
+            if (d[i+2] < 0)
+                lineWidth = (int) i;        // Width only
+            else
+                lineAttributes = (int) i;
+            i += 5;
+            continue;
+        }
+        if (
+            op == GDisplayList::OP_POLYLINE ||
+            op == GDisplayList::OP_FILL_POLYGON
+        )
+            i += 6 + 2 * d[i+5];
+        else
+            i += 9;
+    }
+
+    I2Rectangle area(0, 0, m_IWinRect.width(), m_IWinRect.height());
+    if (m_ExposeRegion != 0) {
+        XRectangle box;
+        XClipBox(m_ExposeRegion, &box);
+        area = I2Rectangle(box.x, box.y, box.width, box.height);
+    }
+    GTileState state;
+    state.foreground = (uint32_t) m_fgPixel;
+    state.lineWidth = m_LineWidth;
+    state.font = m_Font;
+    I2Rectangle drawn =
+        tileRenderer.render(list, *raster, area, state, rasterGlyphs);
+    if (drawn.width() > 0 && drawn.height() > 0) {
+        addRasterDamage(
+            raster, drawn.left(), drawn.top(), drawn.right(), drawn.bottom()
         );
     }
+
+    if (foreground >= 0)
+        setForeground((unsigned long)(unsigned int) d[foreground + 1]);
+    if (background >= 0)
+        setBackground((unsigned long)(unsigned int) d[background + 1]);
+    if (font >= 0)
+        setFont((Font)(unsigned int) d[font + 1]);
+    if (lineAttributes >= 0) {
+        const int* a = &(d[lineAttributes + 1]);
+        setLineAttributes((unsigned int) a[0], a[1], a[2], a[3]);
+    }
+    if (lineWidth > lineAttributes)
+        setLineWidth((unsigned int) d[lineWidth + 1]);
 }
 
 // Work with the list of font descriptors
-FontDescriptor* GWindow::findFont(Font fontID) {
-    FontDescriptor* fd = (FontDescriptor*)(m_FontList.next);
-    int n = 0;  // for safety
-    while (fd != (FontDescriptor*)(&m_FontList)) {
-        if (fd->font_id == fontID)
-            return fd;
-        fd = (FontDescriptor*)(fd->next);
-        ++n;
-        assert(n < SHRT_MAX); // Avoid infinite loop
+FontDescriptor::FontDescriptor(
+    Font id, XFontStruct* fstr, const char* fontName /* = 0 */
+):
+    ListHeader(),
+    font_id(id),
+    font_struct(fstr),
+    name(0),
+    ref_count(1)
+{
+    if (fontName != 0) {
+        name = new char[strlen(fontName) + 1];
+        strcpy(name, fontName);
     }
-    return 0;
+
+    // Precompute advances of 1-byte characters. Characters outside
+    // the font range are drawn as the default character.
+    const XCharStruct* defaultChar = 0;
+    if (
+        fstr->per_char != 0 && fstr->min_byte1 == 0 && fstr->max_byte1 == 0 &&
+        fstr->default_char >= fstr->min_char_or_byte2 &&
+        fstr->default_char <= fstr->max_char_or_byte2
+    )
+        defaultChar =
+            fstr->per_char + (fstr->default_char - fstr->min_char_or_byte2);
+    for (int c = 0; c < 256; ++c) {
+        if (fstr->per_char == 0 || fstr->min_byte1 != 0) {
+            advance[c] = fstr->max_bounds.width;
+        } else if (
+            (unsigned) c >= fstr->min_char_or_byte2 &&
+            (unsigned) c <= fstr->max_char_or_byte2
+        ) {
+            advance[c] = fstr->per_char[c - fstr->min_char_or_byte2].width;
+        } else if (defaultChar != 0) {
+            advance[c] = defaultChar->width;
+        } else {
+            advance[c] = 0;
+        }
+    }
+}
+
+FontDescriptor::~FontDescriptor() {
+    delete[] name;
+}
+
+FontDescriptor* GWindow::findFont(Font fontID) {
+    std::unordered_map<Font, FontDescriptor*>::const_iterator i =
+        fontsByID.find(fontID);
+    if (i == fontsByID.end())
+        return 0;
+    return i->second;
 }
 
 void GWindow::removeFontDescriptor(FontDescriptor* fd) {
     assert(fd != 0);
+    fontsByID.erase(fd->font_id);
+    if (fd->name != 0)
+        fontsByName.erase(fd->name);
     fd->prev->link(*(fd->next));
     delete fd;
 }
 
-void GWindow::addFontDescriptor(
-    Font fontID, XFontStruct* fontStructure
+FontDescriptor* GWindow::addFontDescriptor(
+    Font fontID, XFontStruct* fontStructure, const char* fontName /* = 0 */
 ) {
-    FontDescriptor* fd = new FontDescriptor(fontID, fontStructure);
+    FontDescriptor* fd = new FontDescriptor(fontID, fontStructure, fontName);
     // Add in the head of the list
     fd->link(*(m_FontList.next));
     m_FontList.link(*fd);
+    fontsByID[fontID] = fd;
+    if (fontName != 0)
+        fontsByName[fontName] = fd;
+    return fd;
 }
 
 void GWindow::releaseFonts() {
@@ -1516,12 +4392,210 @@ void GWindow::releaseFonts() {
     while (fd != (FontDescriptor*)(&m_FontList)) {
         if (m_Display != 0)
             XFreeFont(m_Display, fd->font_struct);
+        else if (m_Headless)
+            headlessFreeFont(fd->font_struct);
         m_FontList.link(*(fd->next));
         delete fd;
         fd = (FontDescriptor*)(m_FontList.next);
         ++n;
         assert(n < SHRT_MAX);   // Avoid infinite loop
     }
+    fontsByName.clear();
+    fontsByID.clear();
+}
+
+// Work with the list of glyph atlases.
+// Returns the atlas for the current font and colors;
+// an atlas is created when the pair of colors is used first time.
+GlyphAtlas* GWindow::findAtlas(Font fontID) {
+    GlyphAtlas* a = (GlyphAtlas*)(m_AtlasList.next);
+    while (a != (GlyphAtlas*)(&m_AtlasList)) {
+        if (
+            a->font_id == fontID &&
+            a->fg == m_fgPixel && a->bg == m_bgPixel
+        ) {
+            if (a != (GlyphAtlas*)(m_AtlasList.next)) {
+                // Move to the head of the list
+                a->prev->link(*(a->next));
+                a->link(*(m_AtlasList.next));
+                m_AtlasList.link(*a);
+            }
+            return a;
+        }
+        a = (GlyphAtlas*)(a->next);
+    }
+    return createAtlas(fontID, m_fgPixel, m_bgPixel);
+}
+
+GlyphAtlas* GWindow::createAtlas(
+    Font fontID, unsigned long fg, unsigned long bg
+) {
+    FontDescriptor* fd = findFont(fontID);
+    if (fd == 0)
+        return 0;
+    const XFontStruct* fs = fd->font_struct;
+    if (
+        fs->min_byte1 != 0 || fs->max_byte1 != 0 ||     // 2-byte font
+        fs->min_bounds.width != fs->max_bounds.width    // Not fixed width
+    )
+        return 0;
+
+    GlyphAtlas* a = new GlyphAtlas(fontID, fg, bg);
+    a->cell_width = fs->max_bounds.width;
+    a->ascent = fs->max_bounds.ascent;
+    a->descent = fs->max_bounds.descent;
+    int w = a->cell_width;
+    int h = a->ascent + a->descent;
+    int numRows = 256 / ATLAS_COLUMNS;
+    if (
+        w <= 0 || w * ATLAS_COLUMNS > SHRT_MAX ||
+        h <= 0 || h * numRows > SHRT_MAX
+    ) {
+        delete a;
+        return 0;
+    }
+
+    if (m_NumAtlases >= MAX_ATLASES) {
+        // Release the least recently used atlas
+        GlyphAtlas* last = (GlyphAtlas*)(m_AtlasList.prev);
+        last->prev->link(*(last->next));
+        freeAtlas(last);
+        --m_NumAtlases;
+    }
+
+    a->pixmap = ::XCreatePixmap(
+        m_Display, DefaultRootWindow(m_Display),
+        ATLAS_COLUMNS * w, numRows * h,
+        DefaultDepth(m_Display, m_Screen)
+    );
+
+    // Render all the glyphs once. Every glyph is drawn in its own
+    // cell, since a character missing in the font has no advance.
+    XGCValues values;
+    values.foreground = bg;
+    values.background = bg;
+    values.font = fontID;
+    values.graphics_exposures = False;
+    GC gc = XCreateGC(
+        m_Display, a->pixmap,
+        GCForeground | GCBackground | GCFont | GCGraphicsExposures,
+        &values
+    );
+    XFillRectangle(
+        m_Display, a->pixmap, gc, 0, 0, ATLAS_COLUMNS * w, numRows * h
+    );
+    XSetForeground(m_Display, gc, fg);
+    for (int c = 0; c < 256; ++c) {
+        const XCharStruct* cs = 0;
+        if (
+            fs->per_char != 0 &&
+            (unsigned) c >= fs->min_char_or_byte2 &&
+            (unsigned) c <= fs->max_char_or_byte2
+        )
+            cs = fs->per_char + (c - fs->min_char_or_byte2);
+        if (
+            cs != 0 && cs->width != 0 &&
+            (cs->lbearing >= cs->rbearing || cs->ascent + cs->descent <= 0)
+        ) {
+            // Nothing to draw: a run of such glyphs is a filled box
+            a->blank[c] = true;
+            continue;
+        }
+        char ch = (char) c;
+        XDrawString(
+            m_Display, a->pixmap, gc,
+            (c % ATLAS_COLUMNS) * w, (c / ATLAS_COLUMNS) * h + a->ascent,
+            &ch, 1
+        );
+    }
+    XFreeGC(m_Display, gc);
+
+    // Add in the head of the list
+    a->link(*(m_AtlasList.next));
+    m_AtlasList.link(*a);
+    ++m_NumAtlases;
+    return a;
+}
+
+// A string is composed of the cells of its glyphs. Glyphs with
+// consecutive codes in one row of the atlas are copied by one request,
+// a run of blank glyphs is filled by one request. The copies are made
+// by a GC of the window without graphics exposures (a pixmap is always
+// available, NoExpose events would only load the queue); it follows
+// the clip of m_GC, which is set only in paintExposeRegion.
+void GWindow::drawAtlasString(
+    GlyphAtlas* atlas, Drawable draw,
+    int x, int y, const char* str, int len
+) {
+    if (m_AtlasGC == 0) {
+        XGCValues values;
+        values.graphics_exposures = False;
+        m_AtlasGC = XCreateGC(
+            m_Display, m_Window, GCGraphicsExposures, &values
+        );
+        if (m_ExposeRegion != 0)
+            XSetRegion(m_Display, m_AtlasGC, m_ExposeRegion);
+    }
+    // Xlib sends the foreground only when it is changed
+    XSetForeground(m_Display, m_AtlasGC, atlas->bg);
+
+    const short* advance = findFont(atlas->font_id)->advance;
+    int w = atlas->cell_width;
+    int h = atlas->ascent + atlas->descent;
+    int top = y - atlas->ascent;
+    int i = 0;
+    while (i < len) {
+        int c = (unsigned char) str[i];
+        if (advance[c] == 0) {
+            // Not in the font: nothing is drawn, as by XDrawString
+            ++i;
+            continue;
+        }
+        int n = 1;
+        if (atlas->blank[c]) {
+            while (
+                i + n < len && atlas->blank[(unsigned char) str[i + n]]
+            )
+                ++n;
+            XFillRectangle(m_Display, draw, m_AtlasGC, x, top, n * w, h);
+        } else {
+            while (
+                i + n < len &&
+                (unsigned char) str[i + n] == c + n &&
+                (c + n) % ATLAS_COLUMNS != 0 &&
+                !atlas->blank[c + n]
+            )
+                ++n;
+            ::XCopyArea(
+                m_Display, atlas->pixmap, draw, m_AtlasGC,
+                (c % ATLAS_COLUMNS) * w, (c / ATLAS_COLUMNS) * h,
+                n * w, h,       // Cells of the glyphs
+                x, top          // Destination
+            );
+        }
+        x += n * w;
+        i += n;
+    }
+}
+
+void GWindow::freeAtlas(GlyphAtlas* atlas) {
+    if (m_Display != 0 && atlas->pixmap != 0)
+        XFreePixmap(m_Display, atlas->pixmap);
+    delete atlas;
+}
+
+// Release atlases of a font (of all fonts, if fontID == 0)
+void GWindow::releaseAtlases(Font fontID /* = 0 */) {
+    GlyphAtlas* a = (GlyphAtlas*)(m_AtlasList.next);
+    while (a != (GlyphAtlas*)(&m_AtlasList)) {
+        GlyphAtlas* next = (GlyphAtlas*)(a->next);
+        if (fontID == 0 || a->font_id == fontID) {
+            a->prev->link(*(a->next));
+            freeAtlas(a);
+            --m_NumAtlases;
+        }
+        a = next;
+    }
 }
 
 //
@@ -14,10 +14,20 @@ extern "C" {
 
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <X11/Xresource.h>     // XrmUniqueQuark for XUniqueContext
 #include <X11/Xos.h>
 
 }
 
+#include <poll.h>       // POLLIN, POLLOUT for file descriptor handlers
+#include <string>
+#include <unordered_map>
+
+#include "gdisplaylist.h"   // Recorded drawing commands
+#include "graster.h"        // Client-side framebuffer
+#include "gtiles.h"         // Parallel rasterization of display lists
+#include "gtasks.h"         // Background tasks
+
 //===============================
 
 class ListHeader {
@@ -58,21 +68,93 @@ public:
     }
 };
 
+// A font loaded by GWindow::loadFont. Fonts are shared by all windows:
+// loading a font by the same name again increments the reference count
+// and returns the same Font and XFontStruct.
 class FontDescriptor: public ListHeader {
 public:
     Font font_id;
     XFontStruct* font_struct;
+    char* name;             // Name used to load the font (0 if unknown)
+    int ref_count;
+    short advance[256];     // Advances of 1-byte characters
+
+    FontDescriptor(Font id, XFontStruct* fstr, const char* fontName = 0);
+    ~FontDescriptor();
+
+private:
+    // Not copyable
+    FontDescriptor(const FontDescriptor&);
+    FontDescriptor& operator=(const FontDescriptor&);
+};
 
-    FontDescriptor(Font id, XFontStruct* fstr):
+// Glyphs of a fixed width font pre-rendered, with a given
+// foreground/background pair, into the cells of a pixmap in the
+// order of their codes. A string is composed of copies of its glyphs;
+// glyphs without ink are filled with the background.
+class GlyphAtlas: public ListHeader {
+public:
+    Font font_id;
+    unsigned long fg;
+    unsigned long bg;
+    Pixmap pixmap;
+    int cell_width;
+    int ascent;
+    int descent;
+    bool blank[256];            // Glyph has no ink
+
+    GlyphAtlas(
+        Font id, unsigned long foreground, unsigned long background
+    ):
         ListHeader(),
         font_id(id),
-        font_struct(fstr)
-    {}
+        fg(foreground),
+        bg(background),
+        pixmap(0),
+        cell_width(0),
+        ascent(0),
+        descent(0)
+    {
+        for (int c = 0; c < 256; ++c)
+            blank[c] = false;
+    }
 };
 
-
 const int DEFAULT_BORDER_WIDTH = 2;
 
+// How "drawString" renders text
+enum TextBackend {
+    TEXT_BACKEND_CORE,      // XDrawString: the server rasterizes glyphs
+    TEXT_BACKEND_ATLAS      // Glyphs are copied from an atlas pixmap
+};
+
+// How the offscreen buffer is kept
+enum OffscreenBackend {
+    OFFSCREEN_BACKEND_PIXMAP,   // Server pixmap, drawn by X requests
+    OFFSCREEN_BACKEND_RASTER    // Client framebuffer, shown by XShmPutImage
+};
+
+// Image of a raster offscreen buffer (defined in gwindow.cpp)
+struct RasterImage;
+
+// Drawing posted to a window by another thread (see GWindow::postDisplayList)
+struct GDrawCommand {
+    enum Type {
+        DISPLAY_LIST,           // list, in pixel coordinates
+        IMAGE                   // x, y, width, height, pixels
+    };
+    Type          type;
+    Window        window;
+    bool          offscreen;    // Draw in the offscreen buffer, if any
+    GDisplayList* list;         // Owned by the command
+    int           x, y, width, height;
+    std::vector<uint32_t> pixels;   // In the format of the raster
+
+    GDrawCommand(): type(DISPLAY_LIST), window(0), offscreen(true),
+        list(0), x(0), y(0), width(0), height(0), pixels() {}
+    ~GDrawCommand() { delete list; }
+};
+
 class GWindow: public ListHeader {
 public:
     // Xlib objects:
@@ -81,10 +163,50 @@ public:
     static int          m_Screen;
     static Atom         m_WMProtocolsAtom;
     static Atom         m_WMDeleteWindowAtom;
+    static XContext     m_WindowContext;    // Window -> GWindow* map
+
+    // Headless mode: there is no display (m_Display == 0), windows
+    // are drawn in client rasters, and events are taken from a script
+    static bool         m_Headless;
 
     Window   m_Window;
     Pixmap   m_Pixmap;
     GC       m_GC;
+    GC       m_AtlasGC;         // Copies glyphs of atlases, see drawString
+
+    // Offscreen buffer is allocated with a margin, so that it is not
+    // reallocated on every step of an interactive resize
+    int       m_PixmapWidth;
+    int       m_PixmapHeight;
+    long long m_PixmapShrinkTime;   // When the buffer became too large
+
+    // Area of the offscreen buffer drawn since the last swapBuffers
+    Region    m_OffscreenDamage;
+    int       m_LineWidth;          // Used to extend the damaged area
+    bool      m_LineSolid;
+
+    // Segments are merged in XDrawLines only when it does not change
+    // the picture: thin solid lines. The flag is kept by
+    // setLineWidth and setLineAttributes, so no GC values are read.
+    bool      m_ThinSolidLines;
+
+    // Display list being recorded (0 if drawing is performed)
+    GDisplayList* m_DisplayList;
+
+    // Raster offscreen buffer (used instead of m_Pixmap, see
+    // "setOffscreenBackend"); the raster draws in the image memory
+    GRaster*      m_Raster;
+    RasterImage*  m_RasterImage;
+
+    // Picture of the window in the headless mode
+    GRaster*      m_Framebuffer;
+    bool          m_FramebufferChanged;     // Since the last frame dump
+
+    // Posted commands were drawn in the offscreen buffer
+    bool          m_SwapAfterCommands;
+
+    // "onFlushed" is to be called after the next flush of the loop
+    bool          m_NotifyFlush;
 
     // Coordinates in window
     I2Point     m_WindowPosition;   // Window position in screen coord
@@ -108,6 +230,12 @@ public:
     static int          m_NumCreatedWindows;
     static ListHeader   m_WindowList;
     static ListHeader   m_FontList;
+    static ListHeader   m_AtlasList;
+    static int          m_NumAtlases;
+    static TextBackend  m_TextBackend;
+    static OffscreenBackend m_OffscreenBackend;
+    static bool         m_InvalidWindows;   // Some window must be painted
+    static bool         m_FlushRequested;   // Some window waits for a flush
 
 protected:
 
@@ -120,9 +248,20 @@ protected:
     // Border width
     int m_BorderWidth;
 
-    // Clip rectangle
-    XRectangle          m_ClipRectangle;
-    bool                m_BeginExposeSeries;
+    // Font set in the graphic context (0 if default)
+    Font                m_Font;
+
+    // Damaged area accumulated from a series of Expose events
+    // (0 when there is no series in progress)
+    Region              m_ExposeRegion;
+
+    // Merge pending MotionNotify, ConfigureNotify and Expose events
+    // (see "setEventCoalescing")
+    bool                m_CoalesceEvents;
+
+    // Area invalidated by redraw/redrawRectangle, painted when
+    // the message loop becomes idle (0 if nothing is invalid)
+    Region              m_InvalidRegion;
 
 public:
 
@@ -162,7 +301,16 @@ public:
         int borderWidth = DEFAULT_BORDER_WIDTH
     );
 
-    static bool initX();
+    // The headless mode is selected by "headless" or by the
+    // environment variable GWINDOW_HEADLESS (non-empty, not "0").
+    // Then GWINDOW_EVENTS is the file of the event script (see
+    // GEventScript in "gheadless.h"; without a script, timers run
+    // for 10 seconds), and GWINDOW_PPM is the prefix of the files
+    // "prefix-00001.ppm", ... where the frames are written. Time is
+    // virtual: it passes only in the "wait" steps of the script.
+    // When the script is over, the windows are asked to close.
+    static bool initX(bool headless = false);
+    static bool isHeadless() { return m_Headless; }
     static void closeX();
     static int  screenMaxX();
     static int  screenMaxY();
@@ -170,13 +318,61 @@ public:
 
 private:
     static GWindow* findWindow(Window w);
+    void releaseExposeRegion();
+    void addExposeRectangle(const XEvent& event);
+    static void coalesceEvent(XEvent& e);
+    bool resizeOffscreenBuffer();
+    bool reallocateOffscreenBuffer(int width, int height);
+    bool reallocateRaster(int width, int height);
+    void releaseRaster();
+    GRaster* drawingRaster(bool offscreen);
+    void drawRasterString(
+        GRaster* raster, int x, int y, const char* str, int len
+    );
+    GGlyphMasks* findRasterGlyphs(Font fontID);
+    void drawDisplayListTiled(const GDisplayList& list, GRaster* raster);
+    void addOffscreenDamage(int x1, int y1, int x2, int y2);
+    void addRasterDamage(GRaster* raster, int x1, int y1, int x2, int y2);
+    void resizeFramebuffer(int width, int height);
+    static void readEnvironment();
+    static bool initHeadless();
+    static bool waitForHeadlessEvents();
+    static void performCommands();
+    static void notifyFlushed();
+    static void runScriptStep();
+    void batchLine(Drawable draw, const I2Point& p1, const I2Point& p2);
+    void drawMappedPolyline(
+        const I2Point* points, int numPoints, bool offscreen
+    );
+    static void toXPoints(const I2Point* points, int numPoints, XPoint* result);
+    bool isBoxOutside(int x1, int y1, int x2, int y2) const;
+    R2Rectangle guardBand() const;
+    bool clipBox(int& x1, int& y1, int& x2, int& y2) const;
+    bool clipLine(I2Point& p1, I2Point& p2) const;
+    bool drawLargeEllipse(
+        int x, int y, int w, int h, bool fill, bool offscreen
+    );
+    I2Rectangle textBox(int x, int y, const char* str, int len) const;
+    bool isBoxVisible(const int* box) const;
+    void paintExposeRegion(XEvent& event);
 
     static FontDescriptor* findFont(Font fontID);
     static void removeFontDescriptor(FontDescriptor* fd);
-    static void addFontDescriptor(
-        Font fontID, XFontStruct* fontStructure
+    static FontDescriptor* addFontDescriptor(
+        Font fontID, XFontStruct* fontStructure, const char* fontName = 0
     );
 
+    GlyphAtlas* findAtlas(Font fontID);
+    void drawAtlasString(
+        GlyphAtlas* atlas, Drawable draw,
+        int x, int y, const char* str, int len
+    );
+    static void freeAtlas(GlyphAtlas* atlas);
+    static GlyphAtlas* createAtlas(
+        Font fontID, unsigned long fg, unsigned long bg
+    );
+    static void releaseAtlases(Font fontID = 0);
+
 public:
     void drawFrame();
     void setCoordinates(double xmin, double ymin, double xmax, double ymax);
@@ -213,6 +409,17 @@ public:
     void drawLineTo(int x, int y, bool offscreen = false);
     void drawLineTo(double x, double y, bool offscreen = false);
 
+    // Consecutive drawLineTo/drawLineRel calls with a thin solid line
+    // are sent to the server as one polyline (XDrawLines); wide and
+    // dashed lines are drawn by segments. The batch is flushed automatically
+    // before any other drawing, a change of the graphic context and
+    // reading of events; call flushLines before using Xlib directly.
+    static void flushLines();
+
+    // Draw a polyline through the points (clipped by the window)
+    void drawPolyline(const R2Point* points, int numPoints, bool offscreen = false);
+    void drawPolyline(const I2Point* points, int numPoints, bool offscreen = false);
+
     void drawLineRel(const I2Vector& p, bool offscreen = false);
     void drawLineRel(const R2Vector& p, bool offscreen = false);
     void drawLineRel(int x, int y, bool offscreen = false);
@@ -266,10 +473,19 @@ public:
     void fillEllipse(const I2Rectangle&, bool offscreen = false);
     void fillEllipse(const R2Rectangle&, bool offscreen = false);
 
+    // Invalidate a window area. The invalid areas are accumulated and
+    // painted by one call of onExpose when the message loop is idle.
     void redraw();
     void redrawRectangle(const R2Rectangle&);
     void redrawRectangle(const I2Rectangle&);
 
+    // Window contents have been copied by (dx, dy) pixels: the areas
+    // still waiting to be painted are moved as well
+    void scrollInvalidRegion(int dx, int dy);
+
+    // Paint invalid areas of all windows now (called by waitForEvents)
+    static void paintInvalidWindows();
+
     void setWindowTitle(const char* title);
 
     I2Point map(const R2Point& p) const;
@@ -279,22 +495,120 @@ public:
 
     R2Point invMap(const I2Point& p) const;
 
+    // Array of points: the results are the same as of map
+    // for every point
+    void map(const R2Point* points, int numPoints, I2Point* result) const;
+
     void recalculateMap();
 
-    // Font methods
+    // Font methods.
+    // Fonts are cached by name: a font already loaded is not requested
+    // from the server again. Every loadFont must be paired with unloadFont.
     Font loadFont(const char* fontName, XFontStruct **fontStruct = 0);
     void unloadFont(Font fontID);
+
+    // Resources that will be needed soon may be requested in advance:
+    // with XCB (GWINDOW_XCB) the requests are sent at once, and their
+    // replies are collected by allocateColor and loadFont, so that
+    // a number of colors and fonts costs one round trip to the server.
+    // With a TrueColor visual a color name is resolved by the client.
+    static void prefetchColor(const char* colorName);
+    static void prefetchFont(const char* fontName);
+    // Fonts prefetched as alternatives and not loaded are closed
+    static void releasePrefetchedFonts();
     XFontStruct* queryFont(Font fontID) const;
     void setFont(Font fontID);
 
+    // Advance of a character / width of a string, computed from
+    // the cached metrics without a request to the server
+    static int charAdvance(Font fontID, int c);
+    static int textWidth(Font fontID, const char* str, int len = (-1));
+
+    // Text backend may be switched at any moment, for instance,
+    // to compare the drawing speed. The initial value is taken from
+    // the environment variable GWINDOW_TEXT_BACKEND ("core" or "atlas").
+    // The atlas backend works with fixed width fonts only and, as
+    // XDrawImageString, fills the character cells with the background.
+    // The glyphs are rendered once per font and colors; a run of
+    // consecutive codes or of blank characters takes one request.
+    static void setTextBackend(TextBackend backend);
+    static TextBackend getTextBackend() { return m_TextBackend; }
+
+    // Offscreen buffers created after the call use the given backend.
+    // The initial value is taken from the environment variable
+    // GWINDOW_OFFSCREEN ("pixmap" or "raster"). The raster backend
+    // rasterizes lines, rectangles, polygons, ellipses and text
+    // in the client and requires a 24/32-bit TrueColor visual;
+    // otherwise a pixmap is used. Line styles other than LineSolid
+    // are drawn solid.
+    static void setOffscreenBackend(OffscreenBackend backend);
+    static OffscreenBackend getOffscreenBackend() {
+        return m_OffscreenBackend;
+    }
+
     // Depths supported
     bool supportsDepth24() const;
     bool supportsDepth32() const;
     bool supportsDepth(int d) const;
 
-    // Work with offscreen buffer
+    // Work with offscreen buffer.
+    // Drawing with "offscreen == true" records the damaged area of the
+    // buffer, and swapBuffers copies only this area to the window (and,
+    // inside onExpose, the exposed area). Drawing in the buffer by other
+    // means must be reported with damageOffscreen.
     bool createOffscreenBuffer();
+    bool hasOffscreenBuffer() const { return m_Pixmap != 0 || m_Raster != 0; }
     void swapBuffers();
+    void damageOffscreen(const I2Rectangle& r);
+    void damageOffscreen();     // The whole window
+
+    // Display lists. Between beginDisplayList and endDisplayList,
+    // drawing and changes of colors, font and line attributes are
+    // recorded in a list (in pixel coordinates) instead of being
+    // performed. drawDisplayList replays a list; inside onExpose
+    // the commands outside of the exposed region are skipped.
+    // A list must be recorded again when the coordinates change.
+    void beginDisplayList(GDisplayList& list);     // Clears the list
+    void endDisplayList();
+    bool isRecording() const { return m_DisplayList != 0; }
+    void drawDisplayList(const GDisplayList& list, bool offscreen = false);
+
+    // A large display list replayed in the raster offscreen buffer is
+    // rasterized by tiles on several threads (see GTileRenderer); the
+    // picture is the same for any number of threads. The initial number
+    // is taken from the environment variable GWINDOW_THREADS
+    // (0 or unset: one thread per processor).
+    static void setRasterThreads(int numThreads);
+    static int rasterThreads();
+
+    // Draw an image of 32-bit pixels in the format of the raster
+    // (0x00RRGGBB for usual TrueColor visuals), "width" pixels per row.
+    // Images are not recorded in display lists.
+    void drawImage(
+        int x, int y, int width, int height, const uint32_t* pixels,
+        bool offscreen = false
+    );
+
+    // Copy an area of the window to (dstX, dstY), as XCopyArea
+    void copyArea(int x, int y, int width, int height, int dstX, int dstY);
+
+    // A graphic context for the window, or 0 in the headless mode
+    GC createGC();
+    void freeGC(GC gc);
+
+    // Write the picture of the window (in the headless mode) or of the
+    // raster offscreen buffer as a PPM image
+    bool writePPM(const char* path) const;
+
+    // Damaged area of the window while onExpose is called. The region
+    // is also set as the clip mask of the graphic context, so drawing
+    // outside of it is discarded; a renderer may skip such areas.
+    // Returns 0 outside of onExpose.
+    Region exposeRegion() const { return m_ExposeRegion; }
+
+    // Does a rectangle intersect the damaged area?
+    // (Always true outside of onExpose.)
+    bool isExposed(const I2Rectangle& r) const;
 
     // Callbacks:
     virtual void onExpose(XEvent& event);
@@ -308,6 +622,14 @@ public:
     virtual void onFocusIn(XEvent& event);
     virtual void onFocusOut(XEvent& event);
 
+    virtual void onTimer(int timerID, int missed); // See "setTimer"
+
+    // Called once after the loop has painted the invalid areas
+    // and flushed the requests, following "requestFlushNotification";
+    // for instance, to measure the time from an event to its pixels
+    void requestFlushNotification();
+    virtual void onFlushed();
+
     // Message from Window Manager, such as "Close Window"
     virtual void onClientMessage(XEvent& event);
 
@@ -319,11 +641,121 @@ public:
     // "true" to close the window or "false" to leave the window open.
     virtual bool onWindowClosing();
 
-    // Message loop
+    // Message loop.
+    // getNextEvent coalesces events of a window (unless disabled by
+    // "setEventCoalescing"): a series of MotionNotify is replaced by
+    // the last motion, pending ConfigureNotify events by the final size,
+    // and pending Expose events are merged in one damaged region.
     static bool getNextEvent(XEvent& e);
+
+    // Put a synthetic event in the queue (headless mode),
+    // or send it to its window with XSendEvent
+    static void postEvent(XEvent& e);
+
+    // XLookupString that works for synthetic key events
+    // of the headless mode as well
+    static int lookupString(
+        XKeyEvent* event, char* buffer, int bufferLength, KeySym* keysym
+    );
     static void dispatchEvent(XEvent& e);
     static void messageLoop(GWindow* = 0);
 
+    // Work of the loop besides X events: drawing commands posted by
+    // other threads, completions of background tasks, due timers and
+    // painting of the invalid areas.
+    // "waitForEvents" does it before sleeping; a loop calls it after
+    // every event as well, so that a flow of events does not delay it.
+    // The windows are painted there only when the queued events are
+    // over, or once per frame (16 ms) under a steady flow.
+    static void processPendingWork();
+
+    // Drawing from other threads. Any thread may post a display list
+    // (recorded directly in GDisplayList, in pixel coordinates; the
+    // window takes it over) or an image tile (the pixels are copied)
+    // for a window. The commands are queued without locks; the message
+    // loop performs them by "onCommand" once per iteration, before
+    // the invalid areas are painted, so Xlib is called only from the
+    // thread of the loop and XInitThreads is not needed. Commands for
+    // a window destroyed meanwhile are dropped.
+    static void postDisplayList(
+        Window w, GDisplayList* list, bool offscreen = true
+    );
+    static void postImage(
+        Window w, int x, int y, int width, int height,
+        const uint32_t* pixels, bool offscreen = true
+    );
+
+    // Draws the command, in the offscreen buffer if the window has
+    // one (the buffer is swapped after all the commands of the
+    // iteration). A window may override it, e.g. to keep the result
+    // and redraw.
+    virtual void onCommand(GDrawCommand& command);
+
+    // Background tasks. "task" is performed by a thread of the pool
+    // owned by GWindow; when it is done, "completion" (if any) is called
+    // by the message loop, in the thread of the loop, so it may draw
+    // and use the results. Completions are called with the posted
+    // commands, before painting. The pool is stopped by "closeX":
+    // queued tasks and completions not yet called are dropped.
+    // In the headless mode the loop waits for the tasks before
+    // every step of the script.
+    static void runInBackground(
+        const GTaskPool::Task& task,
+        const GTaskPool::Task& completion = GTaskPool::Task()
+    );
+
+    // The same, but the completion is dropped if the window
+    // has been destroyed meanwhile
+    void runTask(
+        const GTaskPool::Task& task,
+        const GTaskPool::Task& completion = GTaskPool::Task()
+    );
+
+    // Threads of the pool (0 is one per processor); the number
+    // may be changed before the first task is run
+    static void setNumTaskThreads(int numThreads);
+
+    // Block until an X event arrives, a registered file descriptor
+    // becomes ready or "timeoutMs" milliseconds pass (-1 means
+    // no timeout). Handlers of ready descriptors are called before
+    // return. Returns true if there are X events to be read.
+    static bool waitForEvents(int timeoutMs = (-1));
+
+    // Additional file descriptors watched by the message loop;
+    // "events" are poll(2) flags (POLLIN, POLLOUT)
+    typedef void (*FdHandler)(int fd, short revents, void* data);
+    static void addFdHandler(
+        int fd, short events, FdHandler handler, void* data = 0
+    );
+    static void removeFdHandler(int fd);
+
+    // Timers. A timer calls "onTimer" of its window from the message
+    // loop (or from "waitForEvents") when its deadline comes; the loop
+    // sleeps until the nearest deadline. A periodic timer
+    // ("intervalMs" > 0) keeps the phase of its deadlines. If some
+    // of them were missed (the loop was busy), they are skipped, and
+    // their number is passed to "onTimer" as "missed".
+    // Timers of a window are killed when the window is destroyed.
+    int setTimer(int delayMs, int intervalMs = 0);  // Returns timer ID
+    int setFrameRate(double framesPerSecond);       // Periodic timer
+    void killTimer(int timerID);
+    void killTimers();
+
+    // Call "onTimer" for all expired timers. Returns the number
+    // of milliseconds to the next deadline, or -1 if there are no timers
+    static int dispatchTimers();
+
+    // Total number of deadlines missed by periodic timers
+    static unsigned long missedDeadlines();
+
+    // Event coalescing is on by default; a window that needs every
+    // motion event (e.g. to draw a freehand line) may switch it off
+    void setEventCoalescing(bool on) { m_CoalesceEvents = on; }
+    bool isEventCoalescing() const { return m_CoalesceEvents; }
+
+    // Total number of events dropped by coalescing
+    static unsigned long coalescedEvents();
+
     // For dialog windows
     void doModal();
 
@@ -26,7 +26,7 @@ public:
 class RectangleShape: public Shape {
 public:
     virtual void draw(GWindow* w) {
-        bool offscreen = (w->m_Pixmap != 0);
+        bool offscreen = w->hasOffscreenBuffer();
         w->setForeground(color);
         w->fillRectangle(rect, offscreen);
     }
@@ -35,7 +35,7 @@ public:
 class EllipticShape: public Shape {
 public:
     virtual void draw(GWindow* w) {
-        bool offscreen = (w->m_Pixmap != 0);
+        bool offscreen = w->hasOffscreenBuffer();
         w->setForeground(color);
         w->fillEllipse(rect, offscreen);
     }
@@ -44,7 +44,7 @@ public:
 class TriangleShape: public Shape {
 public:
     virtual void draw(GWindow* w) {
-        bool offscreen = (w->m_Pixmap != 0);
+        bool offscreen = w->hasOffscreenBuffer();
         R2Point triangle[3];
         triangle[0] = R2Point(rect.left(), rect.bottom());
         triangle[1] = R2Point(rect.right(), rect.bottom());
@@ -70,7 +70,6 @@ size_t MAX_SHAPES = 256;
 
 static void sigHandler(int sigID);      // Handler of Ctrl+C
 
-static clock_t clocks_per_sec = CLOCKS_PER_SEC;
 static const int ANIMATION_DT = 333;    // milliseconds
 static bool finished = false;
 
@@ -82,27 +81,27 @@ public:
     std::deque<Shape*> shapes;
 
     // Animation
-    clock_t prevMoment;
-    clock_t currentMoment;
-    clock_t animation_dt;
+    int animation_dt;           // milliseconds
+    int animationTimer;
 
     bool stopped;
 
     // Offscreen buffer
     bool initialUpdate;
     bool offscreenDrawing;
+    GDisplayList frame;     // All shapes, replayed in the buffer
 
     Mondrian():                     // Constructor
         shapes(),
-        prevMoment(0),
-        currentMoment(0),
-        animation_dt(CLOCKS_PER_SEC / 2),
+        animation_dt(ANIMATION_DT),
+        animationTimer(0),
         stopped(false),
         initialUpdate(true),
-        offscreenDrawing(false)
+        offscreenDrawing(false),
+        frame()
     {}
 
-    void animate();
+    void startAnimation();
     void drawInOffscreen();
 
     virtual void onExpose(XEvent& event);
@@ -110,6 +109,7 @@ public:
     virtual void onButtonPress(XEvent& event);
     virtual bool onWindowClosing();
     virtual void onResize(XEvent& event);
+    virtual void onTimer(int timerID, int missed);
 };
 
 //
@@ -137,12 +137,14 @@ void Mondrian::onExpose(XEvent& /* event */) {
 
     for (size_t i = 0; i < shapes.size(); ++i)
         shapes[i]->draw(this);
-
-    struct tms tim;
-    prevMoment = times(&tim); // Remember the moment of drawing
 }
 
+// The shapes are recorded in a display list: with the raster
+// backend (GWINDOW_OFFSCREEN=raster) a large list is rasterized
+// in parallel
 void Mondrian::drawInOffscreen() {
+    beginDisplayList(frame);
+
     // Erase a window
     setForeground(getBackground());
     fillRectangle(m_RWinRect, true);
@@ -150,63 +152,64 @@ void Mondrian::drawInOffscreen() {
     for (size_t i = 0; i < shapes.size(); ++i)
         shapes[i]->draw(this);
 
-    struct tms tim;
-    prevMoment = times(&tim); // Remember the moment of drawing
+    endDisplayList();
+    drawDisplayList(frame, true);
 }
 
-void Mondrian::animate() {
+// (Re)start the animation timer with the current frame interval
+void Mondrian::startAnimation() {
+    if (animationTimer != 0)
+        killTimer(animationTimer);
+    animationTimer = 0;
+    if (!stopped)
+        animationTimer = setTimer(animation_dt, animation_dt);
+}
+
+void Mondrian::onTimer(int /* timerID */, int /* missed */) {
     if (finished || stopped)
         return;
 
-    struct tms tim;
-    currentMoment = times(&tim);
-    if (prevMoment == 0)
-        prevMoment = currentMoment;     // Initialization
-    clock_t dt = currentMoment - prevMoment;
-    if (dt >= animation_dt) {
-        double x = (double) rand() / double(RAND_MAX);
-        double y = (double) rand() / double(RAND_MAX);
-        double w = 0.1 + 0.4 * (double) rand() / double(RAND_MAX);
-        double h = 0.1 + 0.4 * (double) rand() / double(RAND_MAX);
-
-        int t = rand() % 4;
-        Shape* s;
-        if (t <= 1)
-            s = new RectangleShape();
-        else if (t <= 2)
-            s = new EllipticShape();
-        else
-            s = new TriangleShape();
-
-        s->rect.setLeft(m_RWinRect.left() + m_RWinRect.width() * x);
-        s->rect.setBottom(m_RWinRect.bottom() + m_RWinRect.height() * y);
-        s->rect.setWidth(
-            (
-                m_RWinRect.width() -
-                (s->rect.left() - m_RWinRect.left())
-            ) * w
-        );
-        s->rect.setHeight(
-            (
-                m_RWinRect.height() -
-                (s->rect.bottom() - m_RWinRect.bottom())
-            ) * h
-        );
-        int c = rand() % NUM_COLORS;
-        s->color = COLORS[c];
-
-        if (shapes.size() >= MAX_SHAPES) {
-            delete shapes.front();
-            shapes.pop_front();
-        }
-        shapes.push_back(s);
-
-        s->draw(this);
+    double x = (double) rand() / double(RAND_MAX);
+    double y = (double) rand() / double(RAND_MAX);
+    double w = 0.1 + 0.4 * (double) rand() / double(RAND_MAX);
+    double h = 0.1 + 0.4 * (double) rand() / double(RAND_MAX);
+
+    int t = rand() % 4;
+    Shape* s;
+    if (t <= 1)
+        s = new RectangleShape();
+    else if (t <= 2)
+        s = new EllipticShape();
+    else
+        s = new TriangleShape();
+
+    s->rect.setLeft(m_RWinRect.left() + m_RWinRect.width() * x);
+    s->rect.setBottom(m_RWinRect.bottom() + m_RWinRect.height() * y);
+    s->rect.setWidth(
+        (
+            m_RWinRect.width() -
+            (s->rect.left() - m_RWinRect.left())
+        ) * w
+    );
+    s->rect.setHeight(
+        (
+            m_RWinRect.height() -
+            (s->rect.bottom() - m_RWinRect.bottom())
+        ) * h
+    );
+    int c = rand() % NUM_COLORS;
+    s->color = COLORS[c];
 
-        prevMoment = times(&tim);
-        if (offscreenDrawing)
-            swapBuffers();
+    if (shapes.size() >= MAX_SHAPES) {
+        delete shapes.front();
+        shapes.pop_front();
     }
+    shapes.push_back(s);
+
+    s->draw(this);
+
+    if (offscreenDrawing)
+        swapBuffers();
 }
 
 void Mondrian::onResize(XEvent& /* event */) {
@@ -223,7 +226,7 @@ void Mondrian::onResize(XEvent& /* event */) {
 void Mondrian::onKeyPress(XEvent& event) {
     KeySym key;
     char keyName[256];
-    int nameLen = XLookupString(&(event.xkey), keyName, 255, &key, 0);
+    int nameLen = lookupString(&(event.xkey), keyName, 255, &key);
     printf("KeyPress: keycode=0x%x, state=0x%x, KeySym=0x%x\n",
         event.xkey.keycode, event.xkey.state, (int) key);
     if (nameLen > 0) {
@@ -234,14 +237,17 @@ void Mondrian::onKeyPress(XEvent& event) {
             destroyWindow();
         } else if (keyName[0] == ' ') { // space => pause/run
             stopped = !stopped;
+            startAnimation();   // A stopped animation costs nothing
         } else if (keyName[0] == 'f') { // faster
             animation_dt /= 2;
             if (animation_dt < 1)
                 animation_dt = 1;
+            startAnimation();
         } else if (keyName[0] == 's') { // slower
             animation_dt *= 2;
-            if (animation_dt > 10*clocks_per_sec)
-                animation_dt = 10*clocks_per_sec;
+            if (animation_dt > 10*1000)
+                animation_dt = 10*1000;
+            startAnimation();
         }
     }
 }
@@ -271,10 +277,11 @@ bool Mondrian::onWindowClosing() {
 /////////////////////////////////////////////////////////////
 // Main: initialize X, create an instance of Mondrian class,
 //       and start the message loop
-int main() {
-    // Initialize random generator
-    struct tms tim;
-    srand(times(&tim));
+// Usage: mondrian [max_shapes]
+//        (the environment variable MONDRIAN_SEED sets the random seed)
+int main(int argc, char* argv[]) {
+    if (argc > 1 && atoi(argv[1]) > 0)
+        MAX_SHAPES = (size_t) atoi(argv[1]);
 
     // Set signal handler for Ctrl+C
     if (signal(SIGINT, &sigHandler) == SIG_ERR) {
@@ -287,6 +294,18 @@ int main() {
         exit(1);
     }
 
+    // Initialize random generator. The seed may be given by MONDRIAN_SEED;
+    // in the headless mode it is fixed, so that the frames are reproducible.
+    const char* seed = getenv("MONDRIAN_SEED");
+    if (seed != 0) {
+        srand((unsigned) strtoul(seed, 0, 10));
+    } else if (GWindow::isHeadless()) {
+        srand(1);
+    } else {
+        struct tms tim;
+        srand(times(&tim));
+    }
+
     Mondrian w;
     int s = GWindow::screenMaxX()*2/3;
     if (GWindow::screenMaxY() < GWindow::screenMaxX())
@@ -307,8 +326,6 @@ int main() {
     w.setBackground("black");
 
     // GWindow::messageLoop();
-    clocks_per_sec = (clock_t) sysconf(_SC_CLK_TCK);
-    w.animation_dt = (clocks_per_sec*ANIMATION_DT)/1000;
 
     // Offscreen buffer
     if (w.createOffscreenBuffer()) {
@@ -316,23 +333,18 @@ int main() {
         w.drawInOffscreen();            // Initial drawing
     }
 
+    // Animation timer
+    w.startAnimation();
+
     // Message loop, animation
     XEvent e;
     while (!finished) {
         if (GWindow::getNextEvent(e)) {
             GWindow::dispatchEvent(e);
+            GWindow::processPendingWork();
         } else {
-
-            // Sleep a bit (we use select for sleeping)
-            timeval dt;
-
-            // Sleep 0.01 sec
-            dt.tv_sec = 0;
-            dt.tv_usec = 10000; // sleeping time 0.01 sec
-
-            select(1, 0, 0, 0, &dt);
-
-            w.animate();
+            // Sleep until an X event or the next timer
+            GWindow::waitForEvents();
         }
     }
 
@@ -0,0 +1,112 @@
+//
+// File "queueTst.cpp"
+// Test of GMpscQueue with concurrent producers, and of GTaskPool
+//
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gqueue.h"
+#include "gtasks.h"
+
+static int numErrors = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s: %s\n", what, ok? "ok" : "FAILED");
+    if (!ok)
+        ++numErrors;
+}
+
+// Items of a producer are its number and a sequence number
+static const long PRODUCER_STEP = 10000000L;
+
+static void testQueue(int numProducers, int numItems) {
+    printf(
+        "GMpscQueue: %d producers, %d items each\n",
+        numProducers, numItems
+    );
+    GMpscQueue<long> queue;
+    check(queue.empty(), "new queue is empty");
+
+    std::atomic<int> numWakeups(0);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < numProducers; ++p) {
+        producers.push_back(std::thread([&queue, &numWakeups, p, numItems]() {
+            for (long i = 0; i < numItems; ++i) {
+                if (queue.push(p * PRODUCER_STEP + i))
+                    ++numWakeups;
+            }
+        }));
+    }
+
+    // The items of every producer must come in the order they were pushed
+    std::vector<long> last(numProducers, -1);
+    long total = 0;
+    int numDrains = 0;
+    bool ordered = true;
+    while (total < (long) numProducers * numItems) {
+        size_t n = queue.drain([&](long v) {
+            int p = (int) (v / PRODUCER_STEP);
+            long i = v % PRODUCER_STEP;
+            if (i != last[p] + 1)
+                ordered = false;
+            last[p] = i;
+        });
+        if (n > 0)
+            ++numDrains;
+        total += (long) n;
+    }
+    for (size_t p = 0; p < producers.size(); ++p)
+        producers[p].join();
+
+    check(ordered, "order of every producer kept");
+    check(
+        total == (long) numProducers * numItems && queue.empty(),
+        "all items drained"
+    );
+    // Every drain empties the queue, so the next push reports it
+    check(numWakeups.load() == numDrains, "push reports an empty queue");
+}
+
+static void testTaskPool() {
+    printf("GTaskPool\n");
+    GTaskPool pool(4);
+    const int NUM_TASKS = 1000;
+    std::atomic<int> numDone(0);
+    std::atomic<long> sum(0);
+
+    // Every task submits one more task from a worker
+    for (int i = 0; i < NUM_TASKS; ++i) {
+        pool.submit([&pool, &numDone, &sum, i]() {
+            sum += i;
+            ++numDone;
+            pool.submit([&numDone]() { ++numDone; });
+        });
+    }
+    pool.wait();
+    check(numDone.load() == 2 * NUM_TASKS, "wait for nested tasks");
+    check(
+        sum.load() == (long) NUM_TASKS * (NUM_TASKS - 1) / 2,
+        "every task performed once"
+    );
+
+    pool.stop();
+    pool.submit([&numDone]() { ++numDone; });
+    pool.wait();
+    check(numDone.load() == 2 * NUM_TASKS + 1, "restart after stop");
+}
+
+int main() {
+    testQueue(1, 100000);
+    testQueue(4, 200000);
+    testTaskPool();
+    if (numErrors > 0) {
+        printf("%d test(s) failed\n", numErrors);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
@@ -96,7 +96,7 @@ void MyWindow::onKeyPress(XEvent& event) {
     KeySym key;
     char keyName[256];
     if (!started) {
-        int nameLen = XLookupString(&(event.xkey), keyName, 255, &key, 0);
+        int nameLen = lookupString(&(event.xkey), keyName, 255, &key);
         printf("KeyPress: keycode=0x%x, state=0x%x, KeySym=0x%x\n",
             event.xkey.keycode, event.xkey.state, (int) key);
         if (nameLen > 0) {
@@ -211,6 +211,7 @@ int main() {
     while (!finished) {
         if (GWindow::getNextEvent(e)) {
             GWindow::dispatchEvent(e);
+            GWindow::processPendingWork();
         } else {
             if (w.started && !starting && !w.measuring) {
                 // Wait random time 1..5 sec
@@ -263,14 +264,8 @@ int main() {
                 }
             }
 
-            // Sleep a bit (we use select for sleeping)
-            timeval dt;
-
-            // Sleep 0.01 sec
-            dt.tv_sec = 0;
-            dt.tv_usec = 10000; // sleeping time 0.01 sec
-
-            select(1, 0, 0, 0, &dt);
+            // Sleep at most 0.01 sec, wake up at once on X events
+            GWindow::waitForEvents(10);
         }
     }
 
@@ -0,0 +1,371 @@
+//
+// File "BatchEdit.cpp"
+// Non-interactive mode, implementation
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <thread>
+
+#include "BatchEdit.h"
+#include "EditorEngine.h"
+#include "Latency.h"
+
+//
+// class BatchScript
+//
+
+// Split a line into words; a quoted string is one word
+static bool splitLine(
+    const char* line, std::vector<std::string>& words
+) {
+    words.clear();
+    const char* p = line;
+    while (true) {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            ++p;
+        if (*p == 0)
+            break;
+        std::string word;
+        if (*p == '"') {
+            ++p;
+            while (*p != '"') {
+                if (*p == 0 || *p == '\n')
+                    return false;           // Unterminated string
+                if (*p == '\\' && p[1] != 0) {
+                    ++p;
+                    if (*p == 't')
+                        word += '\t';
+                    else if (*p == 'n')
+                        word += '\n';
+                    else
+                        word += *p;
+                } else {
+                    word += *p;
+                }
+                ++p;
+            }
+            ++p;
+        } else {
+            while (
+                *p != 0 && *p != ' ' && *p != '\t' &&
+                *p != '\r' && *p != '\n'
+            )
+                word += *p++;
+        }
+        words.push_back(word);
+    }
+    return true;
+}
+
+bool BatchScript::load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == 0) {
+        perror(path);
+        return false;
+    }
+
+    ops.clear();
+    bool success = true;
+    int lineNumber = 0;
+    char line[4096];
+    std::vector<std::string> words;
+    while (fgets(line, 4095, f) != 0) {
+        ++lineNumber;
+        if (!splitLine(line, words)) {
+            fprintf(stderr, "%s:%d: unterminated string\n", path, lineNumber);
+            success = false;
+            continue;
+        }
+        if (words.size() == 0 || words[0][0] == '#')
+            continue;
+
+        Op op;
+        op.type = OP_COMMAND;
+        op.command = (-1);
+        const std::string& name = words[0];
+        size_t numArgs = 0;
+        if (name == "type") {
+            op.type = OP_TYPE; numArgs = 1;
+        } else if (name == "search") {
+            op.type = OP_SEARCH; numArgs = 1;
+        } else if (name == "replace") {
+            op.type = OP_REPLACE; numArgs = 2;
+        } else if (name == "save") {
+            op.type = OP_SAVE;
+        } else if (name == "quit") {
+            op.type = OP_QUIT;
+        } else {
+            op.command = EditorEngine::findCommand(name.c_str());
+            if (op.command < 0) {
+                fprintf(
+                    stderr, "%s:%d: unknown command \"%s\"\n",
+                    path, lineNumber, name.c_str()
+                );
+                success = false;
+                continue;
+            }
+        }
+        if (words.size() != numArgs + 1) {
+            fprintf(
+                stderr, "%s:%d: \"%s\" takes %d argument(s)\n",
+                path, lineNumber, name.c_str(), (int) numArgs
+            );
+            success = false;
+            continue;
+        }
+        if (numArgs >= 1)
+            op.arg1 = words[1];
+        if (numArgs >= 2)
+            op.arg2 = words[2];
+        ops.push_back(op);
+    }
+    fclose(f);
+    return success;
+}
+
+//
+// class BatchEditor
+//
+static const int enterCommand = EditorEngine::findCommand("enter");
+
+BatchEditor::BatchEditor(const BatchScript& s, int workers):
+    script(s),
+    numWorkers(workers)
+{
+    if (numWorkers <= 0)
+        numWorkers = 1;
+}
+
+bool BatchEditor::saveAtomically(const Text& text, const char* path) {
+    std::string tmpName = std::string(path) + ".XXXXXX";
+    std::vector<char> name(tmpName.begin(), tmpName.end());
+    name.push_back(0);
+    int fd = mkstemp(&(name[0]));
+    if (fd < 0)
+        return false;
+
+    // Keep the permissions of the original file
+    struct stat st;
+    if (stat(path, &st) == 0)
+        fchmod(fd, st.st_mode & 07777);
+
+    bool success = false;
+    FILE* f = fdopen(fd, "w");
+    if (f == 0) {
+        close(fd);
+    } else {
+        success = text.save(f) && fsync(fd) == 0;
+        if (fclose(f) != 0)
+            success = false;
+    }
+
+    if (success && rename(&(name[0]), path) == 0)
+        return true;
+    unlink(&(name[0]));
+    return false;
+}
+
+bool BatchEditor::save(
+    EditorEngine& engine, const char* path, BatchFileResult& result
+) {
+    if (!saveAtomically(engine.getText(), path)) {
+        result.ok = false;
+        result.error = "cannot save";
+        return false;
+    }
+    engine.setSaved();
+    result.saved = true;
+    return true;
+}
+
+// Performs the script operations; returns true if the script stopped
+// at "quit" or on a save error
+bool BatchEditor::runScript(
+    EditorEngine& engine, const char* path, BatchFileResult& result
+) const {
+    bool quit = false;
+    for (size_t i = 0; i < script.ops.size() && !quit; ++i) {
+        const BatchScript::Op& op = script.ops[i];
+        switch (op.type) {
+        case BatchScript::OP_COMMAND:
+            engine.execute(op.command);
+            break;
+        case BatchScript::OP_TYPE:
+            for (size_t k = 0; k < op.arg1.size(); ++k) {
+                if (op.arg1[k] == '\n')
+                    engine.execute(enterCommand);
+                else
+                    engine.typeChar((unsigned char) op.arg1[k]);
+            }
+            break;
+        case BatchScript::OP_SEARCH:
+            engine.search(op.arg1.c_str());
+            break;
+        case BatchScript::OP_REPLACE:
+            result.replacements +=
+                engine.replaceAll(op.arg1.c_str(), op.arg2.c_str());
+            break;
+        case BatchScript::OP_SAVE:
+            if (engine.isTextChanged() && !save(engine, path, result))
+                quit = true;
+            break;
+        case BatchScript::OP_QUIT:
+            quit = true;
+            break;
+        }
+        if (!engine.cursorInWindow())
+            engine.scrollToCursor();
+        engine.commandDone();
+    }
+    return quit;
+}
+
+void BatchEditor::processFile(
+    const char* path, BatchFileResult& result
+) const {
+    unsigned long start = LatencyStats::now();
+    result.ok = true;
+    result.saved = false;
+    result.error = 0;
+    result.bytes = 0;
+    result.replacements = 0;
+
+    struct stat st;
+    if (stat(path, &st) == 0)
+        result.bytes = (long) st.st_size;
+
+    EditorEngine engine;        // One text per worker at a time
+    // The lines not changed by the script are saved byte for byte
+    if (!engine.loadFile(path, true)) {
+        result.ok = false;
+        result.error = "cannot read";
+        result.ns = LatencyStats::now() - start;
+        return;
+    }
+
+    bool quit = false;
+    try {
+        quit = runScript(engine, path, result);
+    } catch (OutOfRangeException&) {
+        result.ok = false;
+        result.error = "index out of range";
+        quit = true;
+    }
+
+    // On "quit", changes made after the last "save" are dropped
+    if (!quit && engine.isTextChanged())
+        save(engine, path, result);
+    result.ns = LatencyStats::now() - start;
+}
+
+static double megabytesPerSecond(long bytes, unsigned long ns) {
+    if (ns == 0)
+        return 0.;
+    return ((double) bytes / 1e6) / ((double) ns / 1e9);
+}
+
+int BatchEditor::run(
+    const std::vector<const char*>& files, bool verbose /* = true */
+) {
+    int numFiles = (int) files.size();
+    std::vector<BatchFileResult> results(numFiles);
+    std::atomic<int> nextFile(0);
+
+    int workers = numWorkers;
+    if (workers > numFiles)
+        workers = numFiles;
+
+    unsigned long start = LatencyStats::now();
+
+    // Every worker takes the next file until all are processed
+    std::vector<std::thread> pool;
+    for (int w = 0; w < workers; ++w) {
+        pool.push_back(std::thread([&]() {
+            int i;
+            while ((i = nextFile.fetch_add(1)) < numFiles)
+                processFile(files[i], results[i]);
+        }));
+    }
+    for (size_t w = 0; w < pool.size(); ++w)
+        pool[w].join();
+
+    unsigned long elapsed = LatencyStats::now() - start;
+
+    int numFailed = 0;
+    int numSaved = 0;
+    long totalBytes = 0;
+    for (int i = 0; i < numFiles; ++i) {
+        const BatchFileResult& r = results[i];
+        totalBytes += r.bytes;
+        if (!r.ok)
+            ++numFailed;
+        if (r.saved)
+            ++numSaved;
+        if (!r.ok) {
+            fprintf(stderr, "%s: %s\n", files[i], r.error);
+        } else if (verbose) {
+            printf(
+                "%s: %ld bytes, %d replaced, %s, %.3f ms, %.2f MB/s\n",
+                files[i], r.bytes, r.replacements,
+                r.saved? "saved" : "unchanged",
+                (double) r.ns / 1e6, megabytesPerSecond(r.bytes, r.ns)
+            );
+        }
+    }
+
+    double seconds = (double) elapsed / 1e9;
+    printf(
+        "Total: %d files (%d saved, %d failed), %ld bytes, "
+        "%.3f s, %.1f files/s, %.2f MB/s, %d workers\n",
+        numFiles, numSaved, numFailed, totalBytes, seconds,
+        (seconds > 0.)? (double) numFiles / seconds : 0.,
+        megabytesPerSecond(totalBytes, elapsed), workers
+    );
+    return numFailed;
+}
+
+static void batchUsage() {
+    fprintf(
+        stderr,
+        "Usage: textedit --batch script [-j workers] [-q] file...\n"
+    );
+}
+
+int batchEditMain(int argc, char* argv[]) {
+    // argv[0] is "--batch"
+    if (argc < 2) {
+        batchUsage();
+        return 2;
+    }
+    const char* scriptPath = argv[1];
+    int workers = (int) std::thread::hardware_concurrency();
+    bool verbose = true;
+    std::vector<const char*> files;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strncmp(argv[i], "-j", 2) == 0 && argv[i][2] != 0) {
+            workers = atoi(argv[i] + 2);
+        } else if (strcmp(argv[i], "-q") == 0) {
+            verbose = false;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.size() == 0) {
+        batchUsage();
+        return 2;
+    }
+
+    BatchScript script;
+    if (!script.load(scriptPath))
+        return 2;
+
+    BatchEditor editor(script, workers);
+    return (editor.run(files, verbose) == 0)? 0 : 1;
+}
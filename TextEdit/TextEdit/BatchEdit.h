@@ -0,0 +1,91 @@
+//
+// File "BatchEdit.h"
+// Non-interactive mode: applies a script of editor commands
+// to many files on a pool of worker threads
+//
+#ifndef BATCH_EDIT_H
+#define BATCH_EDIT_H
+
+#include <string>
+#include <vector>
+
+class Text;
+class EditorEngine;
+
+//
+// A script is a sequence of lines:
+//     command-name                 (a name from the editor command table)
+//     type "string"                (type characters at the cursor)
+//     search "string"              (move the cursor to the next match)
+//     replace "from" "to"          (replace all matches in the text)
+//     save                         (save the file now)
+//     quit                         (stop, unsaved changes are dropped)
+// Strings may be quoted, with \" \\ \t \n escapes inside.
+// Lines starting with '#' are comments. A file changed by the script
+// is saved at the end of the script.
+//
+class BatchScript {
+public:
+    enum OpType {
+        OP_COMMAND,
+        OP_TYPE,
+        OP_SEARCH,
+        OP_REPLACE,
+        OP_SAVE,
+        OP_QUIT
+    };
+
+    struct Op {
+        OpType type;
+        int command;            // For OP_COMMAND
+        std::string arg1;
+        std::string arg2;
+    };
+
+    std::vector<Op> ops;
+
+    // Compile a script; errors are reported on stderr
+    bool load(const char* path);
+};
+
+// Result of processing of one file
+struct BatchFileResult {
+    bool ok;
+    bool saved;
+    const char* error;          // Static string, if !ok
+    long bytes;                 // Size of the file read
+    int replacements;
+    unsigned long ns;           // Processing time
+};
+
+class BatchEditor {
+    const BatchScript& script;
+    int numWorkers;
+
+public:
+    BatchEditor(const BatchScript& s, int workers);
+
+    // Process files in parallel, print per-file and total throughput.
+    // Returns the number of files that failed.
+    int run(const std::vector<const char*>& files, bool verbose = true);
+
+    // Apply the script to one file
+    void processFile(const char* path, BatchFileResult& result) const;
+
+    // Write a text in a temporary file in the same directory,
+    // then rename it over "path"
+    static bool saveAtomically(const Text& text, const char* path);
+
+private:
+    bool runScript(
+        EditorEngine& engine, const char* path, BatchFileResult& result
+    ) const;
+    static bool save(
+        EditorEngine& engine, const char* path, BatchFileResult& result
+    );
+};
+
+// textedit --batch script [-j workers] [-q] file...
+int batchEditMain(int argc, char* argv[]);
+
+#endif /* BATCH_EDIT_H */
@@ -0,0 +1,458 @@
+//
+// File "EditorEngine.cpp"
+// Editing model of the text editor, implementation
+//
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "EditorEngine.h"
+
+//
+// class EditorListener
+//
+EditorListener::~EditorListener() {}
+
+void EditorListener::onTextDamaged(
+    int /* x */, int /* y */, int /* w */, int /* h */
+) {}
+
+void EditorListener::onWindowScrolled(int /* dx */, int /* dy */) {}
+
+void EditorListener::onQuitRequested() {}
+
+// Used when no listener is set
+static EditorListener nullListener;
+
+//
+// Editor commands. The names are used in keymap files.
+//
+const struct EditorEngine::CommandDsc EditorEngine::editorCommands[] = {
+    {"down", false, &EditorEngine::onDown},
+    {"up", false, &EditorEngine::onUp},
+    {"left", false, &EditorEngine::onLeft},
+    {"right", false, &EditorEngine::onRight},
+    {"home", false, &EditorEngine::onHome},
+    {"end", false, &EditorEngine::onEnd},
+    {"text-begin", false, &EditorEngine::onTextBeg},
+    {"text-end", false, &EditorEngine::onTextEnd},
+    {"tab", false, &EditorEngine::onTab},
+    {"tab-left", false, &EditorEngine::onTabLeft},
+    {"page-up", false, &EditorEngine::onPageUp},
+    {"page-down", false, &EditorEngine::onPageDown},
+    {"backspace", true, &EditorEngine::onBackSpace},
+    {"delete", true, &EditorEngine::onDelete},
+    {"delete-line", true, &EditorEngine::onDeleteLine},
+    {"insert", true, &EditorEngine::onInsert},
+    {"insert-line", true, &EditorEngine::onInsertLine},
+    {"enter", true, &EditorEngine::onEnter},
+    {"quit", false, &EditorEngine::onQuit},
+    {"save", false, &EditorEngine::onSave},
+    {"delete-word", true, &EditorEngine::onDeleteWord},
+
+    {0, false, 0}                                           // Terminator
+};
+
+EditorEngine::EditorEngine():
+    text(),             // Text storage
+
+    cursorX(0),         // Cursor position in the text
+    cursorY(0),
+
+    windowX(0),         // Window position in the text
+    windowY(0),
+
+    windowWidth(80),    // Window size in characters
+    windowHeight(24),
+
+    lastChar(0),        // The character typed
+
+    fileName("noname.txt"),     // Path to a file
+    fileNameSet(false),         // File name is assigned
+
+    textChanged(false),
+    textSaved(false),
+
+    listener(&nullListener)
+{}
+
+void EditorEngine::setListener(EditorListener* l) {
+    if (l == 0)
+        listener = &nullListener;
+    else
+        listener = l;
+}
+
+int EditorEngine::findCommand(const char* name) {
+    for (int i = 0; editorCommands[i].name != 0; ++i) {
+        if (strcmp(editorCommands[i].name, name) == 0)
+            return i;
+    }
+    return (-1);
+}
+
+const char* EditorEngine::commandName(int command) {
+    if (command < 0 || command >= numCommands())
+        return 0;
+    return editorCommands[command].name;
+}
+
+int EditorEngine::numCommands() {
+    static const int n =
+        (int)(sizeof(editorCommands) / sizeof(editorCommands[0])) - 1;
+    return n;
+}
+
+bool EditorEngine::execute(int command) {
+    if (command < 0 || command >= numCommands())
+        return false;
+    const struct CommandDsc& dsc = editorCommands[command];
+    (this->*(dsc.method))();        // Perform the command
+    if (dsc.change) {
+        textChanged = true;         // Command changes the text
+    }
+    return dsc.change;
+}
+
+void EditorEngine::typeChar(int c) {
+    lastChar = c;
+    onCharTyped();
+    textChanged = true;
+}
+
+bool EditorEngine::search(const char* str) {
+    if (*str == 0)
+        return false;
+    int y = cursorY;
+    int x = cursorX + 1;
+    Text::iterator i = text.begin();
+    for (int k = 0; k < y && i != text.end(); ++k)
+        ++i;
+    for (; y < text.size() && i != text.end(); ++y, ++i, x = 0) {
+        const TextLine& line = *i;
+        if (x >= line.length())
+            continue;
+        const char* found = strstr(line.getString() + x, str);
+        if (found != 0) {
+            cursorX = (int)(found - line.getString());
+            cursorY = y;
+            return true;
+        }
+    }
+    return false;
+}
+
+int EditorEngine::replaceAll(const char* from, const char* to) {
+    int fromLen = strlen(from);
+    if (fromLen == 0)
+        return 0;
+    int toLen = strlen(to);
+
+    int numReplaced = 0;
+    int firstY = (-1);
+    int y = 0;
+    TextLine result;
+    Text::iterator i = text.begin();
+    for (; y < text.size() && i != text.end(); ++y, ++i) {
+        TextLine& line = *i;
+        const char* s = line.getString();
+        const char* found = strstr(s, from);
+        if (found == 0)
+            continue;
+        result.truncate(0);
+        while (found != 0) {
+            result.ensureCapacity(
+                result.length() + (int)(found - s) + toLen + 1
+            );
+            while (s < found)
+                result.append(*s++);
+            result.append(to);
+            s += fromLen;
+            ++numReplaced;
+            found = strstr(s, from);
+        }
+        result.append(s);
+        trimLine(result);
+        line = result;
+        if (firstY < 0)
+            firstY = y;
+    }
+    if (numReplaced > 0) {
+        textChanged = true;
+        damage(0, firstY, INT_MAX, INT_MAX);
+    }
+    return numReplaced;
+}
+
+void EditorEngine::commandDone() {
+    if (textChanged)
+        textSaved = false;
+
+    // Set pointer in the text
+    text.setPointer(cursorY);
+}
+
+bool EditorEngine::cursorInWindow() const {
+    return (
+        cursorX >= windowX && cursorX <= windowX + windowWidth - 1 &&
+        cursorY >= windowY && cursorY <= windowY + windowHeight - 1
+    );
+}
+
+void EditorEngine::scrollToCursor() {
+    int n = 0;
+    if (cursorX < windowX) {
+        n = cursorX - windowX;
+    } else if (cursorX > windowX + windowWidth - 1) {
+        n = cursorX - (windowX + windowWidth - 1);
+    }
+    if (n != 0) {
+        windowX += n;
+        listener->onWindowScrolled(n, 0);
+    }
+
+    n = 0;
+    if (cursorY < windowY) {
+        n = cursorY - windowY;
+    } else if (cursorY > windowY + windowHeight - 1) {
+        n = cursorY - (windowY + windowHeight - 1);
+    }
+    if (n != 0) {
+        windowY += n;
+        listener->onWindowScrolled(0, n);
+    }
+}
+
+void EditorEngine::setCursor(int x, int y) {
+    if (x < 0)
+        x = 0;
+    if (y < 0)
+        y = 0;
+    if (y > text.size())
+        y = text.size();
+    cursorX = x; cursorY = y;
+}
+
+void EditorEngine::setWindowSize(int width, int height) {
+    windowWidth = (width > 0)? width : 1;
+    windowHeight = (height > 0)? height : 1;
+}
+
+void EditorEngine::setFileName(const char* filePath) {
+    fileName = filePath;
+    fileNameSet = true;
+}
+
+bool EditorEngine::loadFile(const char* filePath, bool exact /* = false */) {
+    setFileName(filePath);
+    if (exact)
+        return text.loadExact(filePath);
+    return text.load(filePath);
+}
+
+bool EditorEngine::save() {
+    onSave();
+    return !textChanged;
+}
+
+void EditorEngine::setSaved() {
+    textChanged = false;
+    textSaved = true;
+}
+
+void EditorEngine::onDown() {
+    if (cursorY < text.size())
+        ++cursorY;
+}
+
+void EditorEngine::onUp() {
+    if (cursorY > 0)
+        --cursorY;
+}
+
+void EditorEngine::onLeft() {
+    if (cursorX > 0)
+        --cursorX;
+}
+
+void EditorEngine::onRight() {
+    ++cursorX;
+}
+
+void EditorEngine::onPageUp() {
+    cursorY -= windowHeight;
+    if (cursorY < 0)
+        cursorY = 0;
+}
+
+void EditorEngine::onPageDown() {
+    cursorY += windowHeight;
+    if (cursorY > text.size())
+        cursorY = text.size();
+}
+
+void EditorEngine::onHome() {
+    cursorX = 0;
+}
+
+void EditorEngine::onEnd() {
+    if (cursorY >= text.size()) {
+        cursorX = 0;
+    } else {
+        cursorX = text.getLine(cursorY).length();
+    }
+}
+
+void EditorEngine::onTextBeg() {
+    cursorX = 0;
+    cursorY = 0;
+}
+
+void EditorEngine::onTextEnd() {
+    cursorX = 0;
+    cursorY = text.size();
+}
+
+static const int TAB_DX = 4;
+
+void EditorEngine::onTab() {
+    ++cursorX;
+    if ((cursorX % TAB_DX) != 0)
+        cursorX += TAB_DX - (cursorX % TAB_DX);
+}
+
+void EditorEngine::onTabLeft() {
+    if (cursorX > 0) {
+        --cursorX;
+        if ((cursorX % TAB_DX) != 0)
+            cursorX -= (cursorX % TAB_DX);
+    }
+}
+
+void EditorEngine::onBackSpace() { // Delete previous character
+    if (cursorX <= 0 || cursorY >= text.size())
+        return;
+    --cursorX;
+    onDelete();
+}
+
+void EditorEngine::onDelete() { // Delete current character
+    if (cursorY >= text.size())
+        return;
+    TextLine& line = text.getLine(cursorY);
+    if (cursorX < line.length()) {
+        line.removeAt(cursorX);
+    }
+    trimLine(line);
+    damage(cursorX, cursorY, INT_MAX, 1);
+}
+
+void EditorEngine::onInsert() { // Insert a space
+    lastChar = ' ';
+    onCharTyped();
+    --cursorX;
+}
+
+void EditorEngine::onCharTyped() {
+    if (lastChar == 0)
+        return;
+
+    if (cursorY == text.size())
+        onInsertLine();
+    text.setPointer(cursorY);
+    TextLine& line = text.getLine(cursorY);
+
+    if (cursorX > line.length()) {
+        int extraSpaces = cursorX - line.length();
+        line.ensureCapacity(line.length() + extraSpaces + 2);
+        while(--extraSpaces >= 0)
+            line.append(' ');   // Add space to the end of line
+    }
+    line.insert(cursorX, lastChar);
+    trimLine(line);
+    cursorX++;
+    damage(cursorX - 1, cursorY, INT_MAX, 1);
+}
+
+void EditorEngine::onDeleteLine() {
+    if (cursorY >= text.size())
+        return;
+    text.setPointer(cursorY);
+    text.removeAfter();
+    damage(0, cursorY, INT_MAX, INT_MAX);
+}
+
+void EditorEngine::onInsertLine() {
+    text.setPointer(cursorY);
+    text.addAfter(new TextLine());
+    damage(0, cursorY, INT_MAX, INT_MAX);
+}
+
+void EditorEngine::onEnter() {
+    text.setPointer(cursorY);
+    if (cursorY < text.size()) {
+        TextLine& line = text.getLine(cursorY);
+        text.moveForward();
+        int l = line.length();
+        if (cursorX >= l) {
+            text.addBefore(new TextLine());
+        } else {
+            text.addBefore(
+                new TextLine(line.getString() + cursorX)
+            );
+            line.truncate(cursorX);
+            trimLine(line);
+        }
+        // The second piece ends as the line did
+        text.getLine(cursorY + 1).setLineEnd(line.getLineEnd());
+        line.setLineEnd(TextLine::LINE_END_DEFAULT);
+    } else {
+        text.addBefore(new TextLine());
+    }
+    cursorX = 0;
+    ++cursorY;
+    damage(0, cursorY - 1, INT_MAX, INT_MAX);
+}
+
+void EditorEngine::onSave() {
+    if (textChanged) {
+        if (text.save(fileName)) {
+            textChanged = false;
+            textSaved = true;
+        }
+    }
+}
+
+void EditorEngine::onQuit() {
+    listener->onQuitRequested();
+}
+
+static bool isWordChar(char c) {
+    return (isalnum((unsigned char) c) || c == '_');
+}
+
+// Delete the spaces at the cursor and the word after them
+// (or one character that is not a part of a word)
+void EditorEngine::onDeleteWord() {
+    if (cursorY >= text.size())
+        return;
+    TextLine& line = text.getLine(cursorY);
+    const char* s = line.getString();
+    int l = line.length();
+    if (cursorX >= l)
+        return;
+    int end = cursorX;
+    while (end < l && isspace((unsigned char) s[end]))
+        ++end;
+    if (end < l && isWordChar(s[end])) {
+        while (end < l && isWordChar(s[end]))
+            ++end;
+    } else if (end < l) {
+        ++end;
+    }
+    for (int i = cursorX; i < end; ++i)
+        line.removeAt(cursorX);
+    trimLine(line);
+    damage(cursorX, cursorY, INT_MAX, 1);
+}
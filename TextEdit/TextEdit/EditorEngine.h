@@ -0,0 +1,170 @@
+//
+// File "EditorEngine.h"
+// Editing model of the text editor: a text, a cursor, a window
+// into the text and the editor commands. Does not depend on X11.
+//
+#ifndef EDITOR_ENGINE_H
+#define EDITOR_ENGINE_H
+
+#include "Text.h"               // Text based on L2List
+
+//
+// Receives notifications from an editor engine. All coordinates
+// are in characters (column, line) of the text; a width or height
+// equal to INT_MAX means "up to the end of line/text".
+// The default implementation ignores everything, so a headless
+// client may use the engine without a listener.
+//
+class EditorListener {
+public:
+    virtual ~EditorListener();
+
+    // A rectangle of the text has been changed
+    virtual void onTextDamaged(int x, int y, int w, int h);
+
+    // The window has been moved in the text by (dx, dy) characters.
+    // Called after the window position is updated.
+    virtual void onWindowScrolled(int dx, int dy);
+
+    // The "quit" command has been executed
+    virtual void onQuitRequested();
+};
+
+class EditorEngine {
+    Text text;          // Text storage
+
+    int cursorX;        // Cursor position in the text
+    int cursorY;
+
+    int windowX;        // Window position in the text
+    int windowY;
+
+    int windowWidth;    // Window size in characters
+    int windowHeight;
+
+    int lastChar;       // The character typed
+
+    TextLine fileName;      // Path to a file
+    bool fileNameSet;       // File name is assigned
+
+    bool textChanged;
+    bool textSaved;
+
+    EditorListener* listener;
+
+public:
+    EditorEngine();
+
+    void setListener(EditorListener* l);
+
+    // Command vocabulary. The names are used in keymap files
+    // and in batch scripts.
+    static int findCommand(const char* name);  // Index or -1
+    static const char* commandName(int command);
+    static int numCommands();
+
+    // Perform a command; returns true if the command changes a text
+    bool execute(int command);
+
+    // Insert a character at the cursor position
+    void typeChar(int c);
+
+    // Move the cursor to the next occurrence of a string after the
+    // cursor. Returns false (and keeps the cursor) if there is none.
+    bool search(const char* str);
+
+    // Replace all occurrences of a string in the text, line by line.
+    // Returns the number of replacements.
+    int replaceAll(const char* from, const char* to);
+
+    // Actions performed after any command: updates the saved state
+    // and the text pointer. Scrolling is done by scrollToCursor().
+    void commandDone();
+
+    // Scroll the window to the cursor, if necessary
+    bool cursorInWindow() const;
+    void scrollToCursor();
+
+    void setCursor(int x, int y);
+    void setWindowSize(int width, int height);
+
+    void setFileName(const char* filePath);
+    const char* getFileName() const { return fileName; }
+    bool isFileNameSet() const { return fileNameSet; }
+    // With "exact", the bytes and line endings of the file are kept
+    // (Text::loadExact), as the batch mode needs
+    bool loadFile(const char* filePath, bool exact = false);
+    bool save();                    // Save a text, if it was changed
+    void setSaved();                // The text has been saved elsewhere
+
+    Text& getText() { return text; }
+    const Text& getText() const { return text; }
+
+    int getCursorX() const { return cursorX; }
+    int getCursorY() const { return cursorY; }
+    int getWindowX() const { return windowX; }
+    int getWindowY() const { return windowY; }
+    int getWindowWidth() const { return windowWidth; }
+    int getWindowHeight() const { return windowHeight; }
+
+    bool isTextChanged() const { return textChanged; }
+    bool isTextSaved() const { return textSaved; }
+
+    // Editor commands
+
+    // Cursor movement
+    void onDown();      // Down arrow
+    void onUp();        // Up arrow
+    void onLeft();      // Left arrow
+    void onRight();     // Right arrow
+    void onHome();      // To the beginning of line
+    void onEnd();       // To the end of line
+    void onTextBeg();   // To the beginning of text
+    void onTextEnd();   // To the end of text
+    void onTab();       // Tabulation
+    void onTabLeft();   // Tabulation to the left
+    void onPageUp();    // Page Up
+    void onPageDown();  // Page Down
+
+    // "Horizontal" (inline) text changing commands
+    void onBackSpace(); // Delete previous character
+    void onDelete();    // Delete current character
+    void onInsert();    // Insert a space
+    void onCharTyped(); // Insert a character typed
+
+    // "Vertical" text changing commands
+    void onDeleteLine();   // Delete a complete line
+    void onInsertLine();   // Insert an empty above the current
+    void onEnter();        // Divide a current line in two pieces
+
+    void onSave();      // Save a text in a file
+    void onQuit();      // Notify the listener
+    void onDeleteWord();   // Delete a word at the cursor
+
+private:
+    void damage(int x, int y, int w, int h) {
+        listener->onTextDamaged(x, y, w, h);
+    }
+
+    // Trailing spaces are removed, unless the text is exact
+    void trimLine(TextLine& line) {
+        if (!text.exact)
+            line.trim();
+    }
+
+    // Command description
+    struct CommandDsc {
+        const char* name;       // Command name used in keymap files
+        bool change;            // A command changes a text
+        void (EditorEngine::*method)(); // Pointer to method processing the command
+    };
+
+    // Table of commands
+    static const struct CommandDsc editorCommands[];
+
+    // Not copyable
+    EditorEngine(const EditorEngine&);
+    EditorEngine& operator=(const EditorEngine&);
+};
+
+#endif /* EDITOR_ENGINE_H */
@@ -0,0 +1,328 @@
+//
+// File "KeyMap.cpp"
+// Compiled keymap, implementation
+//
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+extern "C" {
+#include <X11/Xutil.h>
+}
+
+#include "KeyMap.h"
+
+static const int MIN_CAPACITY = 64;
+static const int MAX_CHORD_LENGTH = 8;
+
+KeyMap::KeyMap():
+    m_Table(0),
+    m_Capacity(0),
+    m_NumEntries(0),
+    m_NumPrefixes(0),
+    m_Chord(0)
+{
+    rehash(MIN_CAPACITY);
+}
+
+KeyMap::~KeyMap() {
+    delete[] m_Table;
+}
+
+void KeyMap::clear() {
+    for (int i = 0; i < m_Capacity; ++i)
+        m_Table[i].used = false;
+    m_NumEntries = 0;
+    m_NumPrefixes = 0;
+    m_Chord = 0;
+}
+
+unsigned int KeyMap::hash(
+    unsigned int prefix, KeySym keysym, unsigned int state
+) {
+    unsigned int h = (unsigned int) keysym * 0x9E3779B1U;
+    h ^= (state << 24) ^ (prefix * 0x85EBCA6BU);
+    h ^= h >> 15;
+    h *= 0x2C1B3C6DU;
+    h ^= h >> 13;
+    return h;
+}
+
+KeyMap::Entry* KeyMap::find(
+    unsigned int prefix, KeySym keysym, unsigned int state
+) const {
+    unsigned int mask = (unsigned int) m_Capacity - 1;
+    unsigned int i = hash(prefix, keysym, state) & mask;
+    while (m_Table[i].used) {
+        const Entry& e = m_Table[i];
+        if (e.keysym == keysym && e.state == state && e.prefix == prefix)
+            return &(m_Table[i]);
+        i = (i + 1) & mask;
+    }
+    return 0;
+}
+
+KeyMap::Entry* KeyMap::insert(
+    unsigned int prefix, KeySym keysym, unsigned int state
+) {
+    Entry* e = find(prefix, keysym, state);
+    if (e != 0)
+        return e;
+
+    // Keep the load factor below 1/2, so that probes stay short
+    if (2*(m_NumEntries + 1) > m_Capacity)
+        rehash(2*m_Capacity);
+
+    unsigned int mask = (unsigned int) m_Capacity - 1;
+    unsigned int i = hash(prefix, keysym, state) & mask;
+    while (m_Table[i].used)
+        i = (i + 1) & mask;
+    e = &(m_Table[i]);
+    e->prefix = prefix;
+    e->keysym = keysym;
+    e->state = state;
+    e->command = NO_BINDING;
+    e->next = 0;
+    e->used = true;
+    ++m_NumEntries;
+    return e;
+}
+
+void KeyMap::rehash(int newCapacity) {
+    Entry* oldTable = m_Table;
+    int oldCapacity = m_Capacity;
+
+    m_Table = new Entry[newCapacity];
+    m_Capacity = newCapacity;
+    for (int i = 0; i < m_Capacity; ++i)
+        m_Table[i].used = false;
+
+    unsigned int mask = (unsigned int) m_Capacity - 1;
+    for (int k = 0; k < oldCapacity; ++k) {
+        if (!oldTable[k].used)
+            continue;
+        const Entry& e = oldTable[k];
+        unsigned int i = hash(e.prefix, e.keysym, e.state) & mask;
+        while (m_Table[i].used)
+            i = (i + 1) & mask;
+        m_Table[i] = e;
+    }
+    delete[] oldTable;
+}
+
+// Create (or reuse) the prefix number for the key inside a chord
+unsigned int KeyMap::bindPrefix(
+    unsigned int prefix,
+    KeySym keysym, unsigned int state, unsigned int stateMask
+) {
+    unsigned int freeBits = MODIFIER_MASK & ~stateMask;
+    unsigned int fixedBits = state & stateMask & MODIFIER_MASK;
+
+    // Reuse a prefix, if some variant of the key already has one
+    unsigned int next = 0;
+    unsigned int s = freeBits;
+    while (true) {
+        Entry* e = find(prefix, keysym, fixedBits | s);
+        if (e != 0 && e->next != 0) {
+            next = e->next;
+            break;
+        }
+        if (s == 0)
+            break;
+        s = (s - 1) & freeBits;
+    }
+    if (next == 0)
+        next = ++m_NumPrefixes;
+
+    bindKey(prefix, keysym, state, stateMask, NO_BINDING, next, true);
+    return next;
+}
+
+void KeyMap::bindKey(
+    unsigned int prefix,
+    KeySym keysym, unsigned int state, unsigned int stateMask,
+    int command, unsigned int next, bool replace
+) {
+    // Expand the binding into all the modifier combinations it accepts
+    unsigned int freeBits = MODIFIER_MASK & ~stateMask;
+    unsigned int fixedBits = state & stateMask & MODIFIER_MASK;
+    unsigned int s = freeBits;
+    while (true) {
+        unsigned int st = fixedBits | s;
+        if (replace || find(prefix, keysym, st) == 0) {
+            Entry* e = insert(prefix, keysym, st);
+            e->command = command;
+            e->next = next;
+        }
+        if (s == 0)
+            break;
+        s = (s - 1) & freeBits;
+    }
+}
+
+void KeyMap::bind(
+    KeySym keysym, unsigned int state, unsigned int stateMask,
+    int command, bool replace /* = true */
+) {
+    bindKey(0, keysym, state, stateMask, command, 0, replace);
+}
+
+void KeyMap::bind(
+    const KeySym* keys,
+    const unsigned int* states,
+    const unsigned int* stateMasks,
+    int numKeys,
+    int command,
+    bool replace /* = true */
+) {
+    if (numKeys <= 0)
+        return;
+    unsigned int prefix = 0;
+    for (int i = 0; i < numKeys - 1; ++i) {
+        prefix = bindPrefix(prefix, keys[i], states[i], stateMasks[i]);
+    }
+    int last = numKeys - 1;
+    bindKey(
+        prefix, keys[last], states[last], stateMasks[last],
+        command, 0, replace
+    );
+}
+
+int KeyMap::lookup(KeySym keysym, unsigned int state) {
+    const Entry* e = find(m_Chord, keysym, state & MODIFIER_MASK);
+    if (e == 0) {
+        if (m_Chord != 0) {
+            if (IsModifierKey(keysym))
+                return PREFIX_KEY;  // Shift, Control... inside a chord
+            m_Chord = 0;
+            return CHORD_ABORTED;
+        }
+        return NO_BINDING;
+    }
+    if (e->next != 0) {
+        m_Chord = e->next;
+        return PREFIX_KEY;
+    }
+    m_Chord = 0;
+    return e->command;
+}
+
+static bool parseModifier(const char* name, unsigned int& modifier) {
+    if (strcasecmp(name, "Shift") == 0) {
+        modifier = ShiftMask;
+    } else if (
+        strcasecmp(name, "Ctrl") == 0 ||
+        strcasecmp(name, "Control") == 0
+    ) {
+        modifier = ControlMask;
+    } else if (
+        strcasecmp(name, "Alt") == 0 ||
+        strcasecmp(name, "Meta") == 0 ||
+        strcasecmp(name, "Mod1") == 0
+    ) {
+        modifier = Mod1Mask;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool KeyMap::parseKey(
+    const char* spec,
+    KeySym& keysym, unsigned int& state, unsigned int& stateMask
+) {
+    char buffer[128];
+    strncpy(buffer, spec, 127);
+    buffer[127] = 0;
+
+    state = 0;
+    stateMask = 0;
+
+    char* part = buffer;
+    char* plus;
+    while ((plus = strchr(part, '+')) != 0 && plus[1] != 0) {
+        *plus = 0;
+        bool released = false;
+        if (*part == '-') {
+            released = true;
+            ++part;
+        }
+        unsigned int modifier;
+        if (!parseModifier(part, modifier))
+            return false;
+        stateMask |= modifier;
+        if (!released)
+            state |= modifier;
+        part = plus + 1;
+    }
+
+    // XStringToKeysym works locally, without a request to X server
+    keysym = XStringToKeysym(part);
+    return (keysym != NoSymbol);
+}
+
+int KeyMap::load(const char* filePath, CommandResolver resolve) {
+    FILE* f = fopen(filePath, "r");
+    if (f == 0)
+        return (-1);
+
+    int numBindings = 0;
+    int lineNumber = 0;
+    char line[1024];
+    while (fgets(line, 1023, f) != 0) {
+        ++lineNumber;
+        char* tokens[MAX_CHORD_LENGTH + 1];
+        int numTokens = 0;
+        bool tooLong = false;
+        char* t = strtok(line, " \t\r\n");
+        if (t == 0 || *t == '#')
+            continue;
+        while (t != 0) {
+            if (numTokens > MAX_CHORD_LENGTH) {
+                tooLong = true;
+                break;
+            }
+            tokens[numTokens++] = t;
+            t = strtok(0, " \t\r\n");
+        }
+        if (tooLong || numTokens < 2) {
+            fprintf(
+                stderr, "%s:%d: bad key binding\n", filePath, lineNumber
+            );
+            continue;
+        }
+
+        int numKeys = numTokens - 1;
+        int command = resolve(tokens[numKeys]);
+        if (command < 0) {
+            fprintf(
+                stderr, "%s:%d: unknown command \"%s\"\n",
+                filePath, lineNumber, tokens[numKeys]
+            );
+            continue;
+        }
+
+        KeySym keys[MAX_CHORD_LENGTH];
+        unsigned int states[MAX_CHORD_LENGTH];
+        unsigned int masks[MAX_CHORD_LENGTH];
+        bool keysValid = true;
+        for (int i = 0; i < numKeys; ++i) {
+            if (!parseKey(tokens[i], keys[i], states[i], masks[i])) {
+                fprintf(
+                    stderr, "%s:%d: unknown key \"%s\"\n",
+                    filePath, lineNumber, tokens[i]
+                );
+                keysValid = false;
+                break;
+            }
+        }
+        if (!keysValid)
+            continue;
+
+        bind(keys, states, masks, numKeys, command);
+        ++numBindings;
+    }
+    fclose(f);
+    return numBindings;
+}
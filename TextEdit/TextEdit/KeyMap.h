@@ -0,0 +1,124 @@
+//
+// File "KeyMap.h"
+// Compiled keymap: hashed lookup of key bindings and multi-key chords
+//
+#ifndef KEY_MAP_H
+#define KEY_MAP_H
+
+extern "C" {
+#include <X11/Xlib.h>
+}
+
+//
+// A binding maps a key (KeySym plus the state of modifier keys)
+// to a command number. Bindings may consist of several keys
+// (chords, like "Ctrl+x Ctrl+s"); all keys except the last one
+// are prefix keys.
+//
+// Every binding is expanded at bind time into all the combinations
+// of modifiers it accepts, so that a lookup is a single probe in
+// an open-addressing hash table keyed on
+// (chord prefix, KeySym, state & MODIFIER_MASK).
+//
+class KeyMap {
+public:
+    // Modifier bits taken into account; all other bits of
+    // XKeyEvent::state (Lock, NumLock, mouse buttons) are ignored
+    static const unsigned int MODIFIER_MASK =
+        ShiftMask | ControlMask | Mod1Mask;
+
+    enum {
+        NO_BINDING = (-1),      // The key is not bound
+        PREFIX_KEY = (-2),      // The key starts/continues a chord
+        CHORD_ABORTED = (-3)    // Unknown key inside a chord
+    };
+
+    // Maps a command name to a command number (or -1 if unknown)
+    typedef int (*CommandResolver)(const char* name);
+
+    KeyMap();
+    ~KeyMap();
+
+    // Bind a single key. The key matches when
+    // (event state & stateMask) == state; bits outside stateMask
+    // are ignored. If "replace" is false, existing bindings are
+    // kept (the first binding wins, as in a linear table scan).
+    void bind(
+        KeySym keysym, unsigned int state, unsigned int stateMask,
+        int command, bool replace = true
+    );
+
+    // Bind a sequence of keys (a chord)
+    void bind(
+        const KeySym* keys,
+        const unsigned int* states,
+        const unsigned int* stateMasks,
+        int numKeys,
+        int command,
+        bool replace = true
+    );
+
+    // Look up a key pressed. Returns a command number (>= 0),
+    // or NO_BINDING, PREFIX_KEY, CHORD_ABORTED.
+    int lookup(KeySym keysym, unsigned int state);
+
+    bool inChord() const { return (m_Chord != 0); }
+    void resetChord() { m_Chord = 0; }
+
+    int size() const { return m_NumEntries; }
+    void clear();
+
+    // Load bindings from a keymap file. Each line has the form
+    //     key [key ...] command
+    // where a key is written as "Ctrl+Shift+Left", "Alt+q", "F5";
+    // a modifier with a minus sign ("-Ctrl+Left") must be released.
+    // Modifiers not mentioned are ignored. Lines starting with '#'
+    // are comments. Returns the number of bindings loaded, or -1
+    // if the file cannot be opened.
+    int load(const char* filePath, CommandResolver resolve);
+
+    // Parse a key description, such as "Ctrl+x"
+    static bool parseKey(
+        const char* spec,
+        KeySym& keysym, unsigned int& state, unsigned int& stateMask
+    );
+
+private:
+    struct Entry {
+        unsigned int prefix;    // Chord prefix, 0 for the first key
+        KeySym keysym;
+        unsigned int state;     // Masked by MODIFIER_MASK
+        int command;            // Command number or NO_BINDING
+        unsigned int next;      // Prefix number for a next key, or 0
+        bool used;
+    };
+
+    Entry*       m_Table;
+    int          m_Capacity;    // Power of 2
+    int          m_NumEntries;
+    unsigned int m_NumPrefixes;
+    unsigned int m_Chord;       // Current chord prefix
+
+    static unsigned int hash(
+        unsigned int prefix, KeySym keysym, unsigned int state
+    );
+    Entry* find(unsigned int prefix, KeySym keysym, unsigned int state) const;
+    Entry* insert(unsigned int prefix, KeySym keysym, unsigned int state);
+    void rehash(int newCapacity);
+
+    unsigned int bindPrefix(
+        unsigned int prefix,
+        KeySym keysym, unsigned int state, unsigned int stateMask
+    );
+    void bindKey(
+        unsigned int prefix,
+        KeySym keysym, unsigned int state, unsigned int stateMask,
+        int command, unsigned int next, bool replace
+    );
+
+    // Not copyable
+    KeyMap(const KeyMap&);
+    KeyMap& operator=(const KeyMap&);
+};
+
+#endif /* KEY_MAP_H */
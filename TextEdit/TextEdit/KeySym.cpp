@@ -171,8 +171,8 @@ void MyWindow::onExpose(XEvent& /* event */) {
 void MyWindow::onKeyPress(XEvent& event) {
     keycode = event.xkey.keycode;
     state = event.xkey.state;
-    keyNameLen = XLookupString(
-        &(event.xkey), keyName, 255, &key, 0
+    keyNameLen = lookupString(
+        &(event.xkey), keyName, 255, &key
     );
     // printf("KeyPress: keycode=0x%x, state=0x%x, KeySym=0x%x\n",
     //     event.xkey.keycode, event.xkey.state, (int) key);
@@ -0,0 +1,274 @@
+//
+// File "Latency.cpp"
+// Lock-free latency histograms, implementation
+//
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "Latency.h"
+
+LatencyHistogram::LatencyHistogram():
+    count(0),
+    totalNs(0),
+    maxNs(0)
+{
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+        buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+        buckets[i].store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    totalNs.store(0, std::memory_order_relaxed);
+    maxNs.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketIndex(unsigned long ns) {
+    if (ns < (unsigned long) SUB_BUCKETS)
+        return (int) ns;
+    int log2 = 0;
+    unsigned long v = ns;
+    while (v >= 2*(unsigned long) SUB_BUCKETS) {
+        v >>= 1;
+        ++log2;
+    }
+    // Now SUB_BUCKETS <= v < 2*SUB_BUCKETS
+    int i = (log2 + 1) * SUB_BUCKETS + (int)(v - SUB_BUCKETS);
+    if (i >= NUM_BUCKETS)
+        i = NUM_BUCKETS - 1;
+    return i;
+}
+
+unsigned long LatencyHistogram::bucketUpperBound(int i) {
+    if (i < SUB_BUCKETS)
+        return (unsigned long) i + 1;
+    int log2 = i / SUB_BUCKETS - 1;
+    unsigned long v = (unsigned long)(SUB_BUCKETS + i % SUB_BUCKETS + 1);
+    return v << log2;
+}
+
+void LatencyHistogram::add(unsigned long ns) {
+    buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    totalNs.fetch_add(ns, std::memory_order_relaxed);
+    unsigned long m = maxNs.load(std::memory_order_relaxed);
+    while (
+        ns > m &&
+        !maxNs.compare_exchange_weak(m, ns, std::memory_order_relaxed)
+    ) {}
+}
+
+unsigned long LatencyHistogram::getMean() const {
+    unsigned long n = getCount();
+    if (n == 0)
+        return 0;
+    return totalNs.load(std::memory_order_relaxed) / n;
+}
+
+unsigned long LatencyHistogram::percentile(int p) const {
+    unsigned long n = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+        n += bucketCount(i);
+    if (n == 0)
+        return 0;
+    unsigned long rank = (n * (unsigned long) p + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    unsigned long s = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        s += bucketCount(i);
+        if (s >= rank) {
+            unsigned long upper = bucketUpperBound(i);
+            unsigned long m = getMax();
+            return (upper < m || m == 0)? upper : m;
+        }
+    }
+    return getMax();
+}
+
+//
+// class LatencyStats
+//
+LatencyHistogram LatencyStats::histograms[NUM_LATENCY_PHASES];
+
+const char* const LatencyStats::phaseNames[NUM_LATENCY_PHASES] = {
+    "key_press",
+    "handler",
+    "lookup",
+    "execute",
+    "scroll",
+    "redraw",
+    "status_line",
+    "expose"
+};
+
+unsigned long LatencyStats::now() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long) t.tv_sec * 1000000000UL +
+        (unsigned long) t.tv_nsec;
+}
+
+// Local time minus server time; more than a few seconds above
+// the smallest one means that the server clock has jumped
+static long long clockOffset = 0;
+static bool clockOffsetKnown = false;
+static const long long CLOCK_JUMP = 10000000000LL;     // 10 s
+
+unsigned long LatencyStats::eventTime(unsigned long serverMs) {
+    long long server = (long long) serverMs * 1000000LL;
+    long long offset = (long long) now() - server;
+    if (
+        !clockOffsetKnown || offset < clockOffset ||
+        offset > clockOffset + CLOCK_JUMP
+    ) {
+        clockOffset = offset;
+        clockOffsetKnown = true;
+    }
+    return (unsigned long)(server + clockOffset);
+}
+
+void LatencyStats::reset() {
+    for (int i = 0; i < NUM_LATENCY_PHASES; ++i)
+        histograms[i].reset();
+}
+
+// A tiny output buffer that does not use stdio or malloc
+class SignalSafeWriter {
+    char buffer[4096];
+    int len;
+    int fd;
+    bool ok;
+public:
+    SignalSafeWriter(int f):
+        len(0),
+        fd(f),
+        ok(true)
+    {}
+
+    void flush() {
+        int pos = 0;
+        while (pos < len) {
+            ssize_t n = write(fd, buffer + pos, len - pos);
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            pos += (int) n;
+        }
+        len = 0;
+    }
+
+    void put(const char* s) {
+        while (*s != 0) {
+            if (len >= (int) sizeof(buffer))
+                flush();
+            buffer[len++] = *s++;
+        }
+    }
+
+    void put(unsigned long v) {
+        char digits[24];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + v % 10);
+            v /= 10;
+        } while (v != 0);
+        char s[24];
+        for (int i = 0; i < n; ++i)
+            s[i] = digits[n - 1 - i];
+        s[n] = 0;
+        put(s);
+    }
+
+    bool success() const { return ok; }
+};
+
+bool LatencyStats::dumpJSON(int fd) {
+    SignalSafeWriter w(fd);
+    w.put("{\n  \"unit\": \"ns\",\n  \"phases\": [\n");
+    for (int p = 0; p < NUM_LATENCY_PHASES; ++p) {
+        const LatencyHistogram& h = histograms[p];
+        w.put("    {\"name\": \""); w.put(phaseNames[p]);
+        w.put("\", \"count\": "); w.put(h.getCount());
+        w.put(", \"mean\": "); w.put(h.getMean());
+        w.put(", \"p50\": "); w.put(h.percentile(50));
+        w.put(", \"p90\": "); w.put(h.percentile(90));
+        w.put(", \"p99\": "); w.put(h.percentile(99));
+        w.put(", \"max\": "); w.put(h.getMax());
+        w.put(",\n     \"buckets\": [");
+        bool first = true;
+        for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+            unsigned long c = h.bucketCount(i);
+            if (c == 0)
+                continue;
+            if (!first)
+                w.put(", ");
+            first = false;
+            w.put("["); w.put(LatencyHistogram::bucketUpperBound(i));
+            w.put(", "); w.put(c); w.put("]");
+        }
+        w.put("]}");
+        if (p < NUM_LATENCY_PHASES - 1)
+            w.put(",");
+        w.put("\n");
+    }
+    w.put("  ]\n}\n");
+    w.flush();
+    return w.success();
+}
+
+bool LatencyStats::dumpJSON(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool res = dumpJSON(fd);
+    close(fd);
+    return res;
+}
+
+static char dumpPath[1024];
+
+static void dumpSignalHandler(int /* sigID */) {
+    if (dumpPath[0] != 0)
+        LatencyStats::dumpJSON(dumpPath);
+    else
+        LatencyStats::dumpJSON(2);      // stderr
+}
+
+void LatencyStats::installSignalHandler(int sig, const char* path) {
+    dumpPath[0] = 0;
+    if (path != 0) {
+        strncpy(dumpPath, path, 1023);
+        dumpPath[1023] = 0;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &dumpSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(sig, &sa, 0) != 0)
+        perror("Cannot install a signal handler");
+}
+
+static void formatMs(char* buffer, int size, unsigned long ns) {
+    snprintf(buffer, size, "%lu.%02lums", ns / 1000000, (ns / 10000) % 100);
+}
+
+void LatencyStats::summary(char* buffer, int bufferSize) {
+    const LatencyHistogram& key = histograms[PHASE_KEY_PRESS];
+    const LatencyHistogram& expose = histograms[PHASE_EXPOSE];
+    char keyMedian[32], keyTail[32], exposeMedian[32];
+    formatMs(keyMedian, 32, key.percentile(50));
+    formatMs(keyTail, 32, key.percentile(99));
+    formatMs(exposeMedian, 32, expose.percentile(50));
+    snprintf(
+        buffer, bufferSize, "key %s/%s expose %s",
+        keyMedian, keyTail, exposeMedian
+    );
+}
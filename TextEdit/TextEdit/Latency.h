@@ -0,0 +1,106 @@
+//
+// File "Latency.h"
+// Lock-free latency histograms for the phases of keystroke processing
+//
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <atomic>
+
+// Phases of processing of a key press
+enum LatencyPhase {
+    PHASE_KEY_PRESS,    // From the key event to the flush of its pixels
+    PHASE_HANDLER,      // Complete onKeyPress, from the handler to the cursor
+    PHASE_LOOKUP,       // XLookupString + keymap lookup
+    PHASE_EXECUTE,      // Editor command (includes its redraw requests)
+    PHASE_SCROLL,       // scrollToCursor
+    PHASE_REDRAW,       // redrawTextRectangle
+    PHASE_STATUS_LINE,  // drawStatusLine
+    PHASE_EXPOSE,       // onExpose: painting of damaged area
+    NUM_LATENCY_PHASES
+};
+
+//
+// Histogram with logarithmic buckets: every power of 2 nanoseconds
+// is divided into 4 sub-buckets, so the relative error of percentiles
+// is below 25%. All counters are atomic, so a histogram may be updated
+// and read (for instance, from a signal handler) without locks.
+//
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKETS = 4;
+    static const int NUM_BUCKETS = 40 * SUB_BUCKETS;
+
+private:
+    std::atomic<unsigned long> buckets[NUM_BUCKETS];
+    std::atomic<unsigned long> count;
+    std::atomic<unsigned long> totalNs;
+    std::atomic<unsigned long> maxNs;
+
+public:
+    LatencyHistogram();
+
+    void add(unsigned long ns);
+    void reset();
+
+    unsigned long getCount() const { return count.load(std::memory_order_relaxed); }
+    unsigned long getMax() const { return maxNs.load(std::memory_order_relaxed); }
+    unsigned long getMean() const;
+    unsigned long percentile(int p) const;  // p = 0..100, in nanoseconds
+    unsigned long bucketCount(int i) const {
+        return buckets[i].load(std::memory_order_relaxed);
+    }
+
+    static int bucketIndex(unsigned long ns);
+    static unsigned long bucketUpperBound(int i);
+};
+
+class LatencyStats {
+public:
+    static LatencyHistogram histograms[NUM_LATENCY_PHASES];
+    static const char* const phaseNames[NUM_LATENCY_PHASES];
+
+    // Monotonic time in nanoseconds
+    static unsigned long now();
+
+    // Monotonic time of an X event with the server timestamp "serverMs".
+    // The offset of the clocks is the smallest difference seen so far
+    // (the fastest event is taken as delivered at once); it is taken
+    // anew when the server clock jumps, e.g. wraps around.
+    static unsigned long eventTime(unsigned long serverMs);
+
+    static void add(LatencyPhase phase, unsigned long ns) {
+        histograms[phase].add(ns);
+    }
+    static void reset();
+
+    // Write the statistics in JSON format. Uses only a stack buffer
+    // and write(2), so it may be called from a signal handler.
+    static bool dumpJSON(int fd);
+    static bool dumpJSON(const char* path);
+
+    // Dump statistics in the file "path" (or to stderr, if path == 0)
+    // when the signal "sig" is received
+    static void installSignalHandler(int sig, const char* path);
+
+    // Short summary for the status line: median and 99th percentile
+    // of key press processing, median of painting
+    static void summary(char* buffer, int bufferSize);
+};
+
+// Measures the time of a scope and adds it to a histogram
+class LatencyTimer {
+    LatencyPhase phase;
+    unsigned long start;
+public:
+    LatencyTimer(LatencyPhase p):
+        phase(p),
+        start(LatencyStats::now())
+    {}
+
+    ~LatencyTimer() {
+        LatencyStats::add(phase, LatencyStats::now() - start);
+    }
+};
+
+#endif /* LATENCY_H */
@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+
+#include <vector>
+
 #include "Text.h"
 
 static const int MIN_EXTENT = 16;
@@ -12,7 +15,8 @@ TextLine::TextLine():
     L2ListHeader(),
     capacity(0),
     len(0),
-    str(0)
+    str(0),
+    lineEnd(LINE_END_DEFAULT)
 {
 }
 
@@ -20,7 +24,8 @@ TextLine::TextLine(const TextLine& line):
     L2ListHeader(),
     capacity(line.capacity),
     len(line.len),
-    str(0)
+    str(0),
+    lineEnd(line.lineEnd)
 {
     if (capacity > 0) {
         str = new char[capacity];
@@ -33,7 +38,8 @@ TextLine::TextLine(const char* line):
     L2ListHeader(),
     capacity(0),
     len(0),
-    str(0)
+    str(0),
+    lineEnd(LINE_END_DEFAULT)
 {
     setString(line);
 }
@@ -235,6 +241,8 @@ void TextLine::trim() {    // Remove white space at the end of line
 
 bool Text::load(const char *filePath) {
     removeAll();
+    exact = false;
+    defaultLineEnd = TextLine::LINE_END_LF;
     FILE* f = fopen(filePath, "r");
     if (f == 0)
         return false;
@@ -289,11 +297,66 @@ bool Text::load(const char *filePath) {
     return true;
 }
 
+bool Text::loadExact(const char *filePath) {
+    removeAll();
+    exact = true;
+    defaultLineEnd = TextLine::LINE_END_LF;
+    FILE* f = fopen(filePath, "r");
+    if (f == 0)
+        return false;
+
+    char buffer[4096];
+    std::vector<char> line;
+    bool firstEnd = true;
+    size_t buffLen;
+    while ((buffLen = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        for (size_t i = 0; i < buffLen; ++i) {
+            if (buffer[i] != '\n') {
+                line.push_back(buffer[i]);
+                continue;
+            }
+            TextLine::LineEnd e = TextLine::LINE_END_LF;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+                e = TextLine::LINE_END_CRLF;
+            }
+            if (firstEnd) {
+                // New lines get the ending of the first line
+                defaultLineEnd = e;
+                firstEnd = false;
+            }
+            TextLine* l = new TextLine();
+            if (!line.empty())
+                l->setString(&(line[0]), (int) line.size());
+            l->setLineEnd(e);
+            addBefore(l);
+            line.clear();
+        }
+    }
+    bool success = (ferror(f) == 0);
+    if (!line.empty()) {
+        TextLine* l = new TextLine();
+        l->setString(&(line[0]), (int) line.size());
+        l->setLineEnd(TextLine::LINE_END_NONE);
+        addBefore(l);
+    }
+
+    fclose(f);
+    return success;
+}
+
 bool Text::save(const char *filePath) const {
-    int ret = true;
     FILE* f = fopen(filePath, "w");
     if (f == 0)
         return false;
+    bool ret = save(f);
+    if (fclose(f) != 0)
+        ret = false;
+    return ret;
+}
+
+bool Text::save(FILE* f) const {
+    bool ret = true;
     const_iterator i = begin();
     const_iterator e = end();
     for (int k = 0; k < size() && i != e; ++k, ++i) {
@@ -306,13 +369,25 @@ bool Text::save(const char *filePath) const {
                 break;
             }
         }
-        // Write the "end of line" character
-        if (fputc('\n', f) < 0) {
+        // Write the "end of line" characters. Only the last line
+        // may be left without one.
+        TextLine::LineEnd lineEnd = line.getLineEnd();
+        if (
+            lineEnd == TextLine::LINE_END_DEFAULT ||
+            (lineEnd == TextLine::LINE_END_NONE && k < size() - 1)
+        )
+            lineEnd = defaultLineEnd;
+        if (lineEnd == TextLine::LINE_END_CRLF && fputc('\r', f) < 0) {
+            ret = false;    // Write error
+            break;
+        }
+        if (lineEnd != TextLine::LINE_END_NONE && fputc('\n', f) < 0) {
             ret = false;    // Write error
             break;
         }
     }
-    fclose(f);
+    if (fflush(f) != 0)
+        ret = false;
     return ret;
 }
 
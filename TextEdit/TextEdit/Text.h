@@ -1,6 +1,7 @@
 #ifndef L2LIST_TEXT_H
 #define L2LIST_TEXT_H
 
+#include <stdio.h>
 #include "L2List.h"
 
 class OutOfRangeException {
@@ -14,16 +15,28 @@ public:
 // TextLine is the dynamic array of characters
 //
 class TextLine: public L2ListHeader {
+public:
+    // Line ending written by Text::save; the text loaded by
+    // Text::loadExact remembers the ending of every line
+    enum LineEnd {
+        LINE_END_DEFAULT,   // The default ending of the text
+        LINE_END_LF,
+        LINE_END_CRLF,
+        LINE_END_NONE       // The last line of a file without final newline
+    };
+
+private:
     int     capacity;
     int     len;        // Not including the terminating zero character
     char*   str;
+    LineEnd lineEnd;
 public:
     TextLine();
     TextLine(const TextLine& line);     // Copy constructor
     TextLine(const char* line);
     virtual ~TextLine();
 
-    // Assignment
+    // Assignment of characters; the line ending is not changed
     TextLine& operator=(const TextLine& line);
     TextLine& operator=(const char* line);
     const char* getString() const;
@@ -47,6 +60,9 @@ public:
     // Covertion to C-style string
     operator const char*() const;
 
+    LineEnd getLineEnd() const { return lineEnd; }
+    void setLineEnd(LineEnd e) { lineEnd = e; }
+
     int size() const { return len; }
     int length() const { return size(); }
     void setSize(int s);
@@ -71,15 +87,26 @@ class Text: public L2List {
 public:
     int tabWidth;       // Size of tabulation
 
+    // Set by loadExact: the lines keep tabulations, trailing spaces
+    // and '\r' characters, and are not trimmed when edited
+    bool exact;
+    TextLine::LineEnd defaultLineEnd;   // LINE_END_LF or LINE_END_CRLF
+
     Text():
         L2List(),
-        tabWidth(8)
+        tabWidth(8),
+        exact(false),
+        defaultLineEnd(TextLine::LINE_END_LF)
     {
     }
 
-    // Load/save text in a file
+    // Load/save text in a file. "load" expands tabulations and trims
+    // the lines; "loadExact" keeps the bytes and the line endings,
+    // so that "save" writes the lines not changed as they were read.
     bool load(const char *filePath);
+    bool loadExact(const char *filePath);
     bool save(const char *filePath) const;
+    bool save(FILE* f) const;       // Does not close the file
 
     // Get a pointer to i-th line, i = 0..size-1
     TextLine& getLine(int i);
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <assert.h>
 
 #include <limits.h>
 
@@ -12,105 +13,122 @@
 #include <X11/Xutil.h>
 
 #include "TextEdit.h"
+#include "Latency.h"
+#include "BatchEdit.h"
 
 //
-// Editor commands
+// Commands of the view. The editing commands are defined in the engine
+// (see EditorEngine.cpp); both are named in keymap files.
 //
-const struct TextEdit::CommandDsc TextEdit::editorCommands[] = {
+const struct TextEdit::ViewCommandDsc TextEdit::viewCommands[] = {
+    {"toggle-text-backend", &TextEdit::onToggleTextBackend},
+    {"toggle-latency-overlay", &TextEdit::onToggleLatencyOverlay},
+
+    {0, 0}                                                  // Terminator
+};
+
+//
+// Default key bindings. They are compiled into the keymap before
+// the user keymap file is loaded; the first matching row wins.
+//
+const struct TextEdit::KeyBindingDsc TextEdit::defaultKeyBindings[] = {
     // Down
-    {XK_Down, 0, ControlMask, false, &TextEdit::onDown},      // down arrow
-    {XK_KP_Down, 0, ControlMask, false, &TextEdit::onDown},   // down arrow on keypad
+    {XK_Down, 0, ControlMask, "down"},      // down arrow
+    {XK_KP_Down, 0, ControlMask, "down"},   // down arrow on keypad
 
     // Up
-    {XK_Up, 0, ControlMask, false, &TextEdit::onUp},          // up arrow
-    {XK_KP_Up, 0, ControlMask, false, &TextEdit::onUp},       // up arrow on right keypad
+    {XK_Up, 0, ControlMask, "up"},          // up arrow
+    {XK_KP_Up, 0, ControlMask, "up"},       // up arrow on right keypad
 
     // Left
-    {XK_Left, 0, ControlMask, false, &TextEdit::onLeft},      // left arrow
-    {XK_KP_Left, 0, ControlMask, false, &TextEdit::onLeft},   // left arrow on keypad
+    {XK_Left, 0, ControlMask, "left"},      // left arrow
+    {XK_KP_Left, 0, ControlMask, "left"},   // left arrow on keypad
 
     // Right
-    {XK_Right, 0, ControlMask, false, &TextEdit::onRight},    // right arrow
-    {XK_KP_Right, 0, ControlMask, false, &TextEdit::onRight}, // right arrow on keypad
+    {XK_Right, 0, ControlMask, "right"},    // right arrow
+    {XK_KP_Right, 0, ControlMask, "right"}, // right arrow on keypad
 
     // To the beginning of line
-    {XK_Home, 0, ControlMask, false, &TextEdit::onHome},      // Home
-    {XK_KP_Home, 0, ControlMask, false, &TextEdit::onHome},   // Home on keypad
-    {XK_Left, ControlMask, ControlMask, false, &TextEdit::onHome},    // Ctrl+left
-    {XK_KP_Left, ControlMask, ControlMask, false, &TextEdit::onHome}, // Ctrl+left on keypad
+    {XK_Home, 0, ControlMask, "home"},      // Home
+    {XK_KP_Home, 0, ControlMask, "home"},   // Home on keypad
+    {XK_Left, ControlMask, ControlMask, "home"},    // Ctrl+left
+    {XK_KP_Left, ControlMask, ControlMask, "home"}, // Ctrl+left on keypad
 
     // To the end of line
-    {XK_End, 0, ControlMask, false, &TextEdit::onEnd},      // End
-    {XK_KP_End, 0, ControlMask, false, &TextEdit::onEnd},   // End on right keypad
-    {XK_Right, ControlMask, ControlMask, false, &TextEdit::onEnd},    // Ctrl+right arrow
-    {XK_KP_Right, ControlMask, ControlMask, false, &TextEdit::onEnd}, // Ctrl+right keypad
+    {XK_End, 0, ControlMask, "end"},      // End
+    {XK_KP_End, 0, ControlMask, "end"},   // End on right keypad
+    {XK_Right, ControlMask, ControlMask, "end"},    // Ctrl+right arrow
+    {XK_KP_Right, ControlMask, ControlMask, "end"}, // Ctrl+right keypad
 
     // To the beginning of text
-    {XK_Home, ControlMask, ControlMask, false, &TextEdit::onTextBeg},   // Ctrl+Home
-    {XK_KP_Home, ControlMask, ControlMask, false, &TextEdit::onTextBeg},// Ctrl+Home keypad
-    {XK_Up, ControlMask, ControlMask, false, &TextEdit::onTextBeg},     // Ctrl+Up
-    {XK_KP_Up, ControlMask, ControlMask, false, &TextEdit::onTextBeg},  // Ctrl+Up
+    {XK_Home, ControlMask, ControlMask, "text-begin"},   // Ctrl+Home
+    {XK_KP_Home, ControlMask, ControlMask, "text-begin"},// Ctrl+Home keypad
+    {XK_Up, ControlMask, ControlMask, "text-begin"},     // Ctrl+Up
+    {XK_KP_Up, ControlMask, ControlMask, "text-begin"},  // Ctrl+Up
 
     // To the end of text
-    {XK_End, ControlMask, ControlMask, false, &TextEdit::onTextEnd},    // Ctrl+End
-    {XK_KP_End, ControlMask, ControlMask, false, &TextEdit::onTextEnd}, // Ctrl+End
-    {XK_Down, ControlMask, ControlMask, false, &TextEdit::onTextEnd},   // Ctrl+Down
-    {XK_KP_Down, ControlMask, ControlMask, false, &TextEdit::onTextEnd},// Ctrl+Down keypad
+    {XK_End, ControlMask, ControlMask, "text-end"},    // Ctrl+End
+    {XK_KP_End, ControlMask, ControlMask, "text-end"}, // Ctrl+End
+    {XK_Down, ControlMask, ControlMask, "text-end"},   // Ctrl+Down
+    {XK_KP_Down, ControlMask, ControlMask, "text-end"},// Ctrl+Down keypad
 
     // Tabulation to the right
-    {XK_Tab, 0, ShiftMask, false, &TextEdit::onTab},                // Tab
+    {XK_Tab, 0, ShiftMask, "tab"},                // Tab
 
     // Tabulation to the left
-    {XK_Tab, ShiftMask, ShiftMask, false, &TextEdit::onTabLeft},    // Shift+Tab
-    {XK_ISO_Left_Tab, ShiftMask, ShiftMask, false, &TextEdit::onTabLeft}, // Shift+Tab
+    {XK_Tab, ShiftMask, ShiftMask, "tab-left"},    // Shift+Tab
+    {XK_ISO_Left_Tab, ShiftMask, ShiftMask, "tab-left"}, // Shift+Tab
 
     // Page Up, Down
-    {XK_Page_Up, 0, 0, false, &TextEdit::onPageUp},             // Page Up
-    {XK_Page_Down, 0, 0, false, &TextEdit::onPageDown},         // Page Down
+    {XK_Page_Up, 0, 0, "page-up"},             // Page Up
+    {XK_Page_Down, 0, 0, "page-down"},         // Page Down
 
     // Back Space (delete previous character)
-    {XK_BackSpace, 0, 0, true, &TextEdit::onBackSpace},         // Back Space
+    {XK_BackSpace, 0, 0, "backspace"},         // Back Space
 
     // Delete current character
-    {XK_Delete, 0, ShiftMask, true, &TextEdit::onDelete},       // Delete
-    {XK_KP_Delete, 0, ShiftMask, true, &TextEdit::onDelete},    // Delete on keypad
+    {XK_Delete, 0, ShiftMask, "delete"},       // Delete
+    {XK_KP_Delete, 0, ShiftMask, "delete"},    // Delete on keypad
 
     // Delete line
-    {XK_Delete, ShiftMask, ShiftMask, true, &TextEdit::onDeleteLine},  // Shift+Delete
-    {XK_KP_Delete, ShiftMask, ShiftMask, true, &TextEdit::onDeleteLine}, // Shift+Delete on keypad
-    {XK_k, ControlMask, ControlMask, true, &TextEdit::onDeleteLine},   // Ctrl+k
-    {XK_K, ControlMask, ControlMask, true, &TextEdit::onDeleteLine},   // Ctrl+K
+    {XK_Delete, ShiftMask, ShiftMask, "delete-line"},  // Shift+Delete
+    {XK_KP_Delete, ShiftMask, ShiftMask, "delete-line"}, // Shift+Delete on keypad
+    {XK_k, ControlMask, ControlMask, "delete-line"},   // Ctrl+k
+    {XK_K, ControlMask, ControlMask, "delete-line"},   // Ctrl+K
 
     // Insert space
-    {XK_Insert, 0, ShiftMask, true, &TextEdit::onInsert},       // Insert
-    {XK_KP_Insert, 0, ShiftMask, true, &TextEdit::onInsert},    // Insert on keypad
+    {XK_Insert, 0, ShiftMask, "insert"},       // Insert
+    {XK_KP_Insert, 0, ShiftMask, "insert"},    // Insert on keypad
 
     // Insert line
-    {XK_Insert, ShiftMask, ShiftMask, true, &TextEdit::onInsertLine}, // Shift+Insert
-    {XK_KP_Insert, ShiftMask, ShiftMask, true, &TextEdit::onInsertLine}, // Shift+Insert on keypad
-    {XK_l, ControlMask, ControlMask, true, &TextEdit::onInsertLine},  // Ctrl+l
-    {XK_L, ControlMask, ControlMask, true, &TextEdit::onInsertLine},  // Ctrl+L
+    {XK_Insert, ShiftMask, ShiftMask, "insert-line"}, // Shift+Insert
+    {XK_KP_Insert, ShiftMask, ShiftMask, "insert-line"}, // Shift+Insert on keypad
+    {XK_l, ControlMask, ControlMask, "insert-line"},  // Ctrl+l
+    {XK_L, ControlMask, ControlMask, "insert-line"},  // Ctrl+L
 
     // Return, Enter
-    {XK_Return, 0, ShiftMask, true, &TextEdit::onEnter},    // Enter
-    {XK_KP_Enter, 0, ShiftMask, true, &TextEdit::onEnter},  // Enter on keypad
+    {XK_Return, 0, ShiftMask, "enter"},    // Enter
+    {XK_KP_Enter, 0, ShiftMask, "enter"},  // Enter on keypad
 
     // Quit
-    {XK_q, ControlMask, ControlMask, false, &TextEdit::onQuit}, // Ctrl+q
-    {XK_Q, ControlMask, ControlMask, false, &TextEdit::onQuit}, // Ctrl+Q
-    {XK_q, Mod1Mask, Mod1Mask, false, &TextEdit::onQuit},   // Alt+q
-    {XK_Q, Mod1Mask, Mod1Mask, false, &TextEdit::onQuit},   // Alt+Q
+    {XK_q, ControlMask, ControlMask, "quit"}, // Ctrl+q
+    {XK_Q, ControlMask, ControlMask, "quit"}, // Ctrl+Q
+    {XK_q, Mod1Mask, Mod1Mask, "quit"},   // Alt+q
+    {XK_Q, Mod1Mask, Mod1Mask, "quit"},   // Alt+Q
 
     // Save text
-    {XK_s, ControlMask, ControlMask, false, &TextEdit::onSave}, // Ctrl+s
-    {XK_S, ControlMask, ControlMask, false, &TextEdit::onSave}, // Ctrl+S
-    {XK_s, Mod1Mask, Mod1Mask, false, &TextEdit::onSave},   // Alt+s
-    {XK_S, Mod1Mask, Mod1Mask, false, &TextEdit::onSave},   // Alt+S
+    {XK_s, ControlMask, ControlMask, "save"}, // Ctrl+s
+    {XK_S, ControlMask, ControlMask, "save"}, // Ctrl+S
+    {XK_s, Mod1Mask, Mod1Mask, "save"},   // Alt+s
+    {XK_S, Mod1Mask, Mod1Mask, "save"},   // Alt+S
+
+    {XK_a, ControlMask, ControlMask, "delete-word"}, // Ctrl+a
+    {XK_A, ControlMask, ControlMask, "delete-word"}, // Ctrl+A
 
-    {XK_a, ControlMask, ControlMask, false, &TextEdit::onDeleteWord}, // Ctrl+a
-    {XK_A, ControlMask, ControlMask, false, &TextEdit::onDeleteWord}, // Ctrl+A
+    {XK_F11, 0, 0, "toggle-text-backend"},  // F11: core/atlas text
+    {XK_F12, 0, 0, "toggle-latency-overlay"},   // F12: latency in status line
 
-    {0, 0, 0, false, 0}                                     // Terminator
+    {0, 0, 0, 0}                                            // Terminator
 };
 
 static int IOErrorHandler(Display* /* display */) {
@@ -119,6 +137,15 @@ static int IOErrorHandler(Display* /* display */) {
 }
 
 int main(int argc, char *argv[]) {
+    // Non-interactive mode: textedit --batch script file...
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+        return batchEditMain(argc - 1, argv + 1);
+
+    // Latency statistics are written in JSON format on exit,
+    // if TEXTEDIT_LATENCY_FILE is set, and on the signal SIGUSR1
+    const char* latencyFile = getenv("TEXTEDIT_LATENCY_FILE");
+    LatencyStats::installSignalHandler(SIGUSR1, latencyFile);
+
     GWindow::initX();
     TextEdit *editor = new TextEdit();
     if (argc > 1) {
@@ -132,22 +159,15 @@ int main(int argc, char *argv[]) {
 
     GWindow::closeX();
     delete editor;
+
+    if (latencyFile != 0 && !LatencyStats::dumpJSON(latencyFile))
+        perror("Cannot write latency statistics");
 }
 
 TextEdit::TextEdit():   // Constructor
     GWindow(),          // Base class constructor
-    text(),             // Text storage
-
-    cursorX(0),         // Cursor position in the text
-    cursorY(0),
-
-    windowX(0),         // Window position in the text
-    windowY(0),
-
-    windowWidth(80),    // Window size in characters (dx, dy)
-    windowHeight(24),
-
-    lastChar(0),        // The character typed
+    EditorListener(),
+    engine(),           // Editing model
 
     textFont(0),        // Font used
     fontStruct(),       // Font properties
@@ -165,20 +185,64 @@ TextEdit::TextEdit():   // Constructor
     rightMargin(4),
     bottomMargin(4),
 
-    fileName("noname.txt"),     // Path to a file
-    fileNameSet(false),         // File name is assigned
     endOfText("[* End of text *]"),
 
-    textChanged(false),
-    textSaved(false),
     inputDisabled(false),
     focusIn(true),
 
     bgColor(0),
     fgColor(0),
     bgStatusLineColor(0),
-    fgStatusLineColor(0)
+    fgStatusLineColor(0),
+
+    keyMap(),
+    latencyOverlay(getenv("TEXTEDIT_LATENCY_OVERLAY") != 0),
+    pendingKeys()
 {
+    engine.setListener(this);
+    buildKeyMap();
+}
+
+int TextEdit::findCommand(const char* name) {
+    int command = EditorEngine::findCommand(name);
+    if (command >= 0)
+        return command;
+    for (int i = 0; viewCommands[i].name != 0; ++i) {
+        if (strcmp(viewCommands[i].name, name) == 0)
+            return VIEW_COMMAND_BASE + i;
+    }
+    return (-1);
+}
+
+void TextEdit::buildKeyMap() {
+    keyMap.clear();
+
+    // Default bindings: the first row matching a key wins
+    const struct KeyBindingDsc* b = defaultKeyBindings;
+    for (; b->command != 0; ++b) {
+        int command = findCommand(b->command);
+        assert(command >= 0);
+        keyMap.bind(b->keysym, b->state, b->stateMask, command, false);
+    }
+
+    // User bindings override the default ones.
+    // At first, we read the value of TEXTEDIT_KEYMAP variable,
+    // then try the file "~/.textedit_keymap"
+    const char* keymapPath = getenv("TEXTEDIT_KEYMAP");
+    char homeKeymap[1024];
+    if (keymapPath == 0) {
+        const char* home = getenv("HOME");
+        if (home != 0) {
+            snprintf(homeKeymap, 1023, "%s/.textedit_keymap", home);
+            homeKeymap[1023] = 0;
+            keymapPath = homeKeymap;
+        }
+    }
+    if (keymapPath != 0) {
+        int n = keyMap.load(keymapPath, &TextEdit::findCommand);
+        if (n < 0 && getenv("TEXTEDIT_KEYMAP") != 0)
+            perror("Cannot open the keymap file");
+    }
 }
 
 void TextEdit::createWindow() {
@@ -189,6 +253,12 @@ void TextEdit::createWindow() {
         }
     }
 
+    // Colors of the window are requested together with the font
+    prefetchColor("LightGray");
+    prefetchColor("black");
+    prefetchColor("MidnightBlue");
+    prefetchColor("white");
+
     // Load font, calculate window size, etc.
     initialize();
 
@@ -225,7 +295,8 @@ void TextEdit::createWindow() {
     sizeHints.height_inc = dy;
 
     sizeHints.flags = (PMinSize | PBaseSize | PResizeInc);
-    XSetWMNormalHints(m_Display, m_Window, &sizeHints);
+    if (m_Display != 0)         // There is no window manager when headless
+        XSetWMNormalHints(m_Display, m_Window, &sizeHints);
 }
 
 void TextEdit::initialize() {
@@ -246,8 +317,12 @@ void TextEdit::initialize() {
     // Calculate window rectangle
     m_IWinRect.setLeft(10);
     m_IWinRect.setTop(10);
-    m_IWinRect.setWidth(leftMargin + windowWidth * dx + rightMargin);
-    m_IWinRect.setHeight(topMargin + windowHeight * dy + bottomMargin);
+    m_IWinRect.setWidth(
+        leftMargin + engine.getWindowWidth() * dx + rightMargin
+    );
+    m_IWinRect.setHeight(
+        topMargin + engine.getWindowHeight() * dy + bottomMargin
+    );
 }
 
 static const char* const DEFAULT_TEXT_FONT =
@@ -256,8 +331,15 @@ static const char* const DEFAULT_TEXT_FONT =
 void TextEdit::loadTextFont() {
     bool success = false;
 
-    // At first, we read the value of XMIMFONT variable
+    // All the candidates are requested at once, so that a missing
+    // font does not cost one more round trip
     const char *fontString = getenv("XMIMFONT");
+    if (fontString != 0)
+        prefetchFont(fontString);
+    prefetchFont(DEFAULT_TEXT_FONT);
+    prefetchFont("fixed");
+
+    // At first, we read the value of XMIMFONT variable
     if (fontString != 0) {
         if ((textFont = loadFont(fontString)) != 0)
             success = true;
@@ -279,6 +361,7 @@ void TextEdit::loadTextFont() {
         perror("Cannot load a font with name \"fixed\"");
         exit(1);
     }
+    releasePrefetchedFonts();     // The other candidates
 
     // Query the font metrics
     XFontStruct* fStruct = queryFont(textFont);
@@ -290,9 +373,7 @@ void TextEdit::loadTextFont() {
 }
 
 bool TextEdit::loadFile(const char* filePath) {
-    setFileName(filePath);
-    fileNameSet = true;
-    return text.load(filePath);
+    return engine.loadFile(filePath);
 }
 
 void TextEdit::redrawStatusLine() {
@@ -302,11 +383,11 @@ void TextEdit::redrawStatusLine() {
 }
 
 void TextEdit::drawStatusLine(bool createGC /* = false */) {
-    GC savedGC;
+    GC savedGC = 0;
     if (createGC) {
         // Save the previous graphic contex, create a temporary GC
         savedGC = m_GC;
-        m_GC = XCreateGC(m_Display, m_Window, 0, 0);
+        m_GC = GWindow::createGC();
         setFont(textFont);
     }
 
@@ -316,52 +397,86 @@ void TextEdit::drawStatusLine(bool createGC /* = false */) {
     );
 
     setForeground(fgStatusLineColor);
+    setBackground(bgStatusLineColor);   // Used by the atlas text backend
 
     char statusLine[256];
     int x = leftMargin;
     int y = statusLineMargin + ascent;
-    sprintf(statusLine, "col=%d", cursorX+1);
+    sprintf(statusLine, "col=%d", engine.getCursorX()+1);
     drawString(x, y, statusLine);
 
-    sprintf(statusLine, "row=%d", cursorY+1);
+    sprintf(statusLine, "row=%d", engine.getCursorY()+1);
     drawString(x + 8*dx, y, statusLine);
 
-    if (textChanged)
+    if (engine.isTextChanged())
         drawString(x + 19*dx, y, "Modified");
-    else if (textSaved)
+    else if (engine.isTextSaved())
         drawString(x + 19*dx, y, "Saved");
 
+    if (latencyOverlay) {
+        // Latency statistics between the state and the hint
+        int maxLen = (m_IWinRect.width() - 15*dx - (x + 29*dx)) / dx;
+        if (maxLen > 0) {
+            char latency[128];
+            LatencyStats::summary(latency, 128);
+            int len = strlen(latency);
+            if (len > maxLen)
+                len = maxLen;
+            drawString(x + 28*dx, y, latency, len);
+        }
+    }
+
     drawString(m_IWinRect.width() - 15*dx, y, "Ctrl+Q to quit");
+    setBackground(bgColor);
 
     if (createGC) {
         // Release the temporary graphic contex, restore the previous GC
-        XFreeGC(m_Display, m_GC);
+        freeGC(m_GC);
         m_GC = savedGC;
     }
 }
 
 void TextEdit::onExpose(XEvent& /* event */) {
-    // Draw a status line
-    drawStatusLine();
+    LatencyTimer timer(PHASE_EXPOSE);
 
-    // Erase a window
-    setForeground(bgColor);
-    fillRectangle(
-        I2Rectangle(
-            0, topMargin - statusLineMargin, 
-            m_IWinRect.width(), m_IWinRect.height()
-        )
+    // Draw a status line
+    I2Rectangle statusLineRect(
+        0, 0, m_IWinRect.width(), dy + statusLineMargin
     );
-
-    // Draw a text in a window
-    setForeground(fgColor);
+    if (isExposed(statusLineRect))
+        drawStatusLine();
+
+    // Draw a text in a window: only the rows intersecting
+    // the damaged region are erased and drawn
+    Text& text = engine.getText();
+    int windowX = engine.getWindowX();
+    int windowY = engine.getWindowY();
+    int windowWidth = engine.getWindowWidth();
+    int windowHeight = engine.getWindowHeight();
     int x = leftMargin;
     int y = topMargin + ascent;
-    for (int screenY = 0; screenY < windowHeight; screenY++, y += dy) {
+    int rowTop = topMargin - statusLineMargin;
+    for (
+        int screenY = 0;
+        rowTop < m_IWinRect.height();
+        screenY++, y += dy, rowTop = topMargin + screenY * dy
+    ) {
+        // The first row also covers the gap below the status line
+        int rowHeight = topMargin + (screenY + 1) * dy - rowTop;
+        I2Rectangle row(0, rowTop, m_IWinRect.width(), rowHeight);
+        if (!isExposed(row))
+            continue;
+
+        // Erase the row
+        setForeground(bgColor);
+        fillRectangle(row);
+        if (screenY >= windowHeight)
+            continue;
+
         int textY = windowY + screenY;
         const TextLine* currentLine;
         if (textY > text.size()) {
-            break;
+            continue;
         } else if (textY == text.size()) {
             currentLine = &(endOfText);
         } else {
@@ -372,6 +487,7 @@ void TextEdit::onExpose(XEvent& /* event */) {
             int restrictedLen = len - windowX;
             if (restrictedLen > windowWidth)
                 restrictedLen = windowWidth;
+            setForeground(fgColor);
             drawString(
                 x, y,
                 currentLine->getString() + windowX,
@@ -382,7 +498,7 @@ void TextEdit::onExpose(XEvent& /* event */) {
 
     // Draw cursor
     if (!inputDisabled) {
-        drawCursor(cursorX, cursorY, true);
+        drawCursor(engine.getCursorX(), engine.getCursorY(), true);
     }
 }
 
@@ -392,18 +508,20 @@ void TextEdit::drawCursor(
     bool cursorOn = on;
     if (!focusIn || inputDisabled)
         cursorOn = false;
+    int windowX = engine.getWindowX();
+    int windowY = engine.getWindowY();
     if (
         cx < windowX || cy < windowY ||
-        cx >= windowX + windowWidth || 
-        cy >= windowY + windowHeight
+        cx >= windowX + engine.getWindowWidth() ||
+        cy >= windowY + engine.getWindowHeight()
     )
         return;         // Cursor outside of window
 
-    GC savedGC;
+    GC savedGC = 0;
     if (createGC) {
         // Save the previous graphic contex, create a temporary GC
         savedGC = m_GC;
-        m_GC = XCreateGC(m_Display, m_Window, 0, 0);
+        m_GC = GWindow::createGC();
         setFont(textFont);
     }
 
@@ -417,9 +535,15 @@ void TextEdit::drawCursor(
         I2Rectangle(x, y, dx, ascent + descent)
     );
 
-    if (cursorOn) setForeground(bgColor);
-    else setForeground(fgColor);
+    if (cursorOn) {
+        setForeground(bgColor);
+        setBackground(fgColor);
+    } else {
+        setForeground(fgColor);
+        setBackground(bgColor);
+    }
 
+    Text& text = engine.getText();
     if (cy <= text.size()) {
         TextLine* line;
         if (cy == text.size()) {
@@ -435,25 +559,35 @@ void TextEdit::drawCursor(
             );
         }
     }
+    setBackground(bgColor);
 
     if (createGC) {
         // Release the temporary graphic contex, restore the previous GC
-        XFreeGC(m_Display, m_GC);
+        freeGC(m_GC);
         m_GC = savedGC;
     }
 }
 
 void TextEdit::setFileName(const char* filePath) {
-    fileName = filePath;
-    fileNameSet = true;
+    engine.setFileName(filePath);
 }
 
-const char* TextEdit::getFileName() const { return fileName; }
+const char* TextEdit::getFileName() const { return engine.getFileName(); }
 
 void TextEdit::onKeyPress(XEvent& event) {
     if (inputDisabled) 
         return;
 
+    // Keystroke to pixels: from the time of the event
+    // to the flush after its painting (see onFlushed)
+    unsigned long eventStart = LatencyStats::now();
+    if (event.xkey.time != 0 && !event.xkey.send_event)
+        eventStart = LatencyStats::eventTime(event.xkey.time);
+    pendingKeys.push_back(eventStart);
+    requestFlushNotification();
+
+    LatencyTimer timer(PHASE_HANDLER);
+
     preProcessCommand();
 
     // State of modifiers keys (Shift, Controld, Alt, etc.)
@@ -463,42 +597,39 @@ void TextEdit::onKeyPress(XEvent& event) {
     char keyName[256];
     int keyNameLen;
 
-    keyNameLen = XLookupString( // define keyboard symbol
-        &(event.xkey), keyName, 255, &keySymbol, 0
-    );
+    unsigned long t0 = LatencyStats::now();
 
-    // Look up the command in the table
-    const struct CommandDsc* command = editorCommands;
-    bool commandFound = false;
-    while (!commandFound && command->method != 0) {
-        if (
-            keySymbol == command->keysym &&
-            (state & command->stateMask) == command->state
-        ) {
-            commandFound = true; break;
-        }
-        ++command;
-    }
+    keyNameLen = lookupString(  // define keyboard symbol
+        &(event.xkey), keyName, 255, &keySymbol
+    );
 
-    if (commandFound) {
-        (this->*(command->method))();   // Perform the command
-        if (command->change) {
-            textChanged = true;         // Command changes the text
-        }
-    } else if ((state & ControlMask) == 0) {
+    // Look up the command in the keymap
+    bool inChord = keyMap.inChord();
+    int command = keyMap.lookup(keySymbol, state);
+
+    unsigned long t1 = LatencyStats::now();
+    LatencyStats::add(PHASE_LOOKUP, t1 - t0);
+
+    if (command >= VIEW_COMMAND_BASE) {
+        const struct ViewCommandDsc& dsc =
+            viewCommands[command - VIEW_COMMAND_BASE];
+        (this->*(dsc.method))();        // Perform the command
+    } else if (command >= 0) {
+        engine.execute(command);
+    } else if (
+        command == KeyMap::NO_BINDING && !inChord &&
+        (state & ControlMask) == 0
+    ) {
         // This is not a Control character
         if (keyNameLen > 0) {
             // Normal character (Latin letter, etc.)
-            lastChar = keyName[0];
-            onCharTyped();
-            textChanged = true;
+            engine.typeChar(keyName[0]);
         } else if ((keySymbol & 0x8000) == 0) {
             // This is not a special character. Probably, it is a Russian letter
-            lastChar = (keySymbol & 0xff);
-            onCharTyped();
-            textChanged = true;
+            engine.typeChar(keySymbol & 0xff);
         }
     }
+    LatencyStats::add(PHASE_EXECUTE, LatencyStats::now() - t1);
 
     postProcessCommand();
 }
@@ -506,7 +637,7 @@ void TextEdit::onKeyPress(XEvent& event) {
 // Actions to be performed before any command
 void TextEdit::preProcessCommand() {
     inputDisabled = true; // Disable any input while command is not completed
-    drawCursor(cursorX, cursorY, false, true);  // Remove cursor
+    drawCursor(engine.getCursorX(), engine.getCursorY(), false, true);
 }
 
 // Actions to be performed after any command
@@ -514,36 +645,40 @@ void TextEdit::postProcessCommand() {
     if (m_Window == 0)  // Window is destroyed => return
         return;
 
-    if (textChanged)
-        textSaved = false;
-
     // Scroll the window to the cursor, if necessary
-    if (
-        cursorX < windowX || cursorX > windowX + windowWidth - 1 ||
-        cursorY < windowY || cursorY > windowY + windowHeight - 1
-    ) {
+    if (!engine.cursorInWindow()) {
         // Cursor is removed at the moment!
-        scrollToCursor();
+        LatencyTimer timer(PHASE_SCROLL);
+        engine.scrollToCursor();
     }
 
-    // Set pointer in the text
-    text.setPointer(cursorY);
+    engine.commandDone();
 
     inputDisabled = false;
 
-    drawCursor(cursorX, cursorY, true, true);
+    drawCursor(engine.getCursorX(), engine.getCursorY(), true, true);
+
+    LatencyTimer timer(PHASE_STATUS_LINE);
     drawStatusLine(true);
 }
 
 void TextEdit::onFocusIn(XEvent& /* event */) {
     focusIn = true;
     if (!inputDisabled)
-        drawCursor(cursorX, cursorY, true, true);
+        drawCursor(engine.getCursorX(), engine.getCursorY(), true, true);
 }
 
 void TextEdit::onFocusOut(XEvent& /* event */) {
     focusIn = false;
-    drawCursor(cursorX, cursorY, false, true);
+    drawCursor(engine.getCursorX(), engine.getCursorY(), false, true);
+}
+
+// The keys processed since the last flush are on the screen now
+void TextEdit::onFlushed() {
+    unsigned long t = LatencyStats::now();
+    for (size_t i = 0; i < pendingKeys.size(); ++i)
+        LatencyStats::add(PHASE_KEY_PRESS, t - pendingKeys[i]);
+    pendingKeys.clear();
 }
 
 void TextEdit::onButtonPress(XEvent& event) {
@@ -554,102 +689,67 @@ void TextEdit::onButtonPress(XEvent& event) {
     int x = event.xbutton.x;
     int y = event.xbutton.y;
     int cx = (x - leftMargin) / dx;
-    if (cx >= windowWidth)
-        cx = windowWidth - 1;
-    cx += windowX;
+    if (cx >= engine.getWindowWidth())
+        cx = engine.getWindowWidth() - 1;
+    cx += engine.getWindowX();
 
     int cy = (y - topMargin) / dy;
-    if (cy >= windowHeight)
-        cy = windowHeight - 1;
-    cy += windowY;
-    if (cy > text.size())
-        cy = text.size();
+    if (cy >= engine.getWindowHeight())
+        cy = engine.getWindowHeight() - 1;
+    cy += engine.getWindowY();
 
     // Erase the old curson and draw the new one
-    drawCursor(cursorX, cursorY, false, true);
-    cursorX = cx; cursorY = cy;
-    drawCursor(cursorX, cursorY, true, true);
+    drawCursor(engine.getCursorX(), engine.getCursorY(), false, true);
+    engine.setCursor(cx, cy);
+    drawCursor(engine.getCursorX(), engine.getCursorY(), true, true);
 }
 
 void TextEdit::onResize(XEvent& /* event */) {
     int w = m_IWinRect.width();
-    windowWidth = (w - leftMargin) / dx;
+    int windowWidth = (w - leftMargin) / dx;
     rightMargin = w - leftMargin - windowWidth * dx;
     if (windowWidth <= 0) {
         windowWidth = 1; rightMargin = 0;
     }
 
     int h = m_IWinRect.height();
-    windowHeight = (h - topMargin) / dy;
+    int windowHeight = (h - topMargin) / dy;
     bottomMargin = h - topMargin - windowHeight * dy;
     if (windowHeight <= 0) {
         windowHeight = 1; bottomMargin = 0;
     }
+    engine.setWindowSize(windowWidth, windowHeight);
 
     //... redraw();
 }
 
-void TextEdit::onDown() {
-    if (cursorY < text.size())
-        ++cursorY;
-}
-
-void TextEdit::onUp() {
-    if (cursorY > 0)
-        --cursorY;
-}
+void TextEdit::onWindowScrolled(int columns, int lines) {
+    if (columns < 0)
+        scrollLeft(-columns);
+    else if (columns > 0)
+        scrollRight(columns);
 
-void TextEdit::onLeft() {
-    if (cursorX > 0)
-        --cursorX;
-}
-
-void TextEdit::onRight() {
-    ++cursorX;
-}
-
-void TextEdit::onPageUp() {
-    cursorY -= windowHeight;
-    if (cursorY < 0)
-        cursorY = 0;
-}
-
-void TextEdit::onPageDown() {
-    cursorY += windowHeight;
-    if (cursorY > text.size())
-        cursorY = text.size();
-}
-
-void TextEdit::scrollToCursor() {
-    if (cursorX < windowX) {
-        scrollLeft(windowX - cursorX);
-    } else if (cursorX > windowX + windowWidth - 1) {
-        scrollRight(cursorX - (windowX + windowWidth - 1));
-    }
-
-    if (cursorY < windowY) {
-        scrollUp(windowY - cursorY);
-    } else if (cursorY > windowY + windowHeight - 1) {
-        scrollDown(cursorY - (windowY + windowHeight - 1));
-    }
+    if (lines < 0)
+        scrollUp(-lines);
+    else if (lines > 0)
+        scrollDown(lines);
 }
 
 void TextEdit::scrollLeft(int n) {
     if (n == 0)
         return;
-    if (n > windowX) 
-        n = windowX;
-    windowX -= n;
+    int windowWidth = engine.getWindowWidth();
+    int windowHeight = engine.getWindowHeight();
     if (n > windowWidth / 2) {
         redraw();
     } else {
         int shift = dx * n;
-        XCopyArea(
-            m_Display, m_Window, m_Window, m_GC,
+        copyArea(
             leftMargin, topMargin,
             windowWidth * dx - shift, windowHeight * dy,
             leftMargin + shift, topMargin
         );
+        scrollInvalidRegion(shift, 0);
         redrawRectangle(
             I2Rectangle(
                 leftMargin, topMargin,
@@ -662,17 +762,18 @@ void TextEdit::scrollLeft(int n) {
 void TextEdit::scrollRight(int n) {
     if (n == 0)
         return;
-    windowX += n;
+    int windowWidth = engine.getWindowWidth();
+    int windowHeight = engine.getWindowHeight();
     if (n > windowWidth / 2) {
         redraw();
     } else {
         int shift = dx * n;
-        XCopyArea(
-            m_Display, m_Window, m_Window, m_GC,
+        copyArea(
             leftMargin + shift, topMargin,
             windowWidth * dx - shift, windowHeight * dy,
             leftMargin, topMargin
         );
+        scrollInvalidRegion(-shift, 0);
         redrawRectangle(
             I2Rectangle(
                 leftMargin + windowWidth*dx - shift, topMargin,
@@ -685,19 +786,18 @@ void TextEdit::scrollRight(int n) {
 void TextEdit::scrollUp(int n) {
     if (n == 0)
         return;
-    if (n > windowY)
-        n = windowY;
-    windowY -= n;
+    int windowWidth = engine.getWindowWidth();
+    int windowHeight = engine.getWindowHeight();
     if (n > windowHeight / 2) {
         redraw();
     } else {
         int shift = dy * n;
-        XCopyArea(
-            m_Display, m_Window, m_Window, m_GC,
+        copyArea(
             leftMargin, topMargin,
             windowWidth * dx, windowHeight * dy - shift,
             leftMargin, topMargin + shift
         );
+        scrollInvalidRegion(0, shift);
         redrawRectangle(
             I2Rectangle(
                 leftMargin, topMargin,
@@ -710,17 +810,18 @@ void TextEdit::scrollUp(int n) {
 void TextEdit::scrollDown(int n) {
     if (n == 0)
         return;
-    windowY += n;
+    int windowWidth = engine.getWindowWidth();
+    int windowHeight = engine.getWindowHeight();
     if (n > windowHeight / 2) {
         redraw();
     } else {
         int shift = dy * n;
-        XCopyArea(
-            m_Display, m_Window, m_Window, m_GC,
+        copyArea(
             leftMargin, topMargin + shift,
             windowWidth * dx, windowHeight * dy - shift,
             leftMargin, topMargin
         );
+        scrollInvalidRegion(0, -shift);
         redrawRectangle(
             I2Rectangle(
                 leftMargin, topMargin + windowHeight * dy - shift,
@@ -730,148 +831,25 @@ void TextEdit::scrollDown(int n) {
     }
 }
 
-void TextEdit::onHome() {
-    cursorX = 0;
-}
-
-void TextEdit::onEnd() {
-    if (cursorY >= text.size()) {
-        cursorX = 0;
-    } else {
-        cursorX = text.getLine(cursorY).length();
-    }
-}
-
-void TextEdit::onTextBeg() {
-    cursorX = 0;
-    cursorY = 0;
-}
-
-void TextEdit::onTextEnd() {
-    cursorX = 0;
-    cursorY = text.size();
-}
-
-static const int TAB_DX = 4;
-
-void TextEdit::onTab() {
-    ++cursorX;
-    if ((cursorX % TAB_DX) != 0)
-        cursorX += TAB_DX - (cursorX % TAB_DX);
-}
-
-void TextEdit::onTabLeft() {
-    if (cursorX > 0) {
-        --cursorX;
-        if ((cursorX % TAB_DX) != 0)
-            cursorX -= (cursorX % TAB_DX);
-    }
-}
-
-void TextEdit::onBackSpace() { // Delete previous character
-    if (cursorX <= 0 || cursorY >= text.size())
-        return;
-    --cursorX;
-    onDelete();
-}
-
-void TextEdit::onDelete() { // Delete current character
-    if (cursorY >= text.size())
-        return;
-    TextLine& line = text.getLine(cursorY);
-    if (cursorX < line.length()) {
-        line.removeAt(cursorX);
-    }
-    line.trim();
-    redrawTextRectangle(cursorX, cursorY, INT_MAX, 1);
-}
-
-void TextEdit::onInsert() { // Insert a space
-    lastChar = ' ';
-    onCharTyped();
-    --cursorX;
-}
-
-void TextEdit::onCharTyped() {
-    if (lastChar == 0) 
-        return;
-
-    if (cursorY == text.size()) 
-        onInsertLine();
-    text.setPointer(cursorY);
-    TextLine& line = text.getLine(cursorY);
-
-    if (cursorX > line.length()) {
-        int extraSpaces = cursorX - line.length();
-        line.ensureCapacity(line.length() + extraSpaces + 2);
-        while(--extraSpaces >= 0)
-            line.append(' ');   // Add space to the end of line
-    }
-    line.insert(cursorX, lastChar);
-    line.trim();
-    cursorX++;
-    redrawTextRectangle(cursorX - 1, cursorY, INT_MAX, 1, true);
-}
-
-void TextEdit::onDeleteLine() {
-    if (cursorY >= text.size())
-        return;
-    text.setPointer(cursorY);
-    text.removeAfter();
-    redrawTextRectangle(0, cursorY, INT_MAX, INT_MAX);
-}
-
-void TextEdit::onInsertLine() {
-    text.setPointer(cursorY);
-    text.addAfter(new TextLine());
-    redrawTextRectangle(0, cursorY, INT_MAX, INT_MAX);
+void TextEdit::onTextDamaged(int x, int y, int w, int h) {
+    // Changes inside one line are painted at once,
+    // larger areas are repainted on Expose
+    redrawTextRectangle(x, y, w, h, h == 1);
 }
 
-void TextEdit::onEnter() {
-    text.setPointer(cursorY);
-    if (cursorY < text.size()) {
-        TextLine& line = text.getLine(cursorY);
-        text.moveForward();
-        int l = line.length();
-        if (cursorX >= l) {
-            text.addBefore(new TextLine());
-        } else {
-            text.addBefore(
-                new TextLine(line.getString() + cursorX)
-            );
-            line.truncate(cursorX);
-            line.trim();
-        }
-    } else {
-        text.addBefore(new TextLine());
-    }
-    cursorX = 0;
-    ++cursorY;
-    redrawTextRectangle(0, cursorY - 1, INT_MAX, INT_MAX);
-}
-
-void TextEdit::onSave() {
-    if (textChanged) {
-        if (text.save(fileName)) {
-            textChanged = false;
-            textSaved = true;
-        }
-    }
-}
-
-void TextEdit::onQuit() {
+void TextEdit::onQuitRequested() {
     if (processQuit())
         close();
 }
 
 bool TextEdit::processQuit() {
     bool quit = true;
-    if (textChanged) {
+    if (engine.isTextChanged()) {
         SaveDialog saveDialog(this);
         saveDialog.create();
         saveDialog.doModal();
         if (saveDialog.buttonPressed == SaveDialog::BUTTON_YES) {
-            onSave();
+            engine.save();
         } else if (saveDialog.buttonPressed == SaveDialog::BUTTON_NO) {
             // Nothing to do.
         } else if (saveDialog.buttonPressed == SaveDialog::BUTTON_CANCEL) {
@@ -901,6 +879,12 @@ void TextEdit::redrawTextRectangle(
     if (h == INT_MAX) 
         y1 = INT_MAX;
 
+    Text& text = engine.getText();
+    int windowX = engine.getWindowX();
+    int windowY = engine.getWindowY();
+    int windowWidth = engine.getWindowWidth();
+    int windowHeight = engine.getWindowHeight();
+
     int x0 = x;
     if (x0 < windowX) 
         x0 = windowX;
@@ -915,11 +899,13 @@ void TextEdit::redrawTextRectangle(
     if (x1 <= x || y1 <= y) 
         return;
 
-    GC savedGC;
+    LatencyTimer timer(PHASE_REDRAW);
+
+    GC savedGC = 0;
     if (createGC) {
         // Save the previous graphic contex, create a temporary GC
         savedGC = m_GC;
-        m_GC = XCreateGC(m_Display, m_Window, 0, 0);
+        m_GC = GWindow::createGC();
         setFont(textFont);
     }
 
@@ -946,6 +932,7 @@ void TextEdit::redrawTextRectangle(
 
         // Draw a text in a window
         setForeground(fgColor);
+        setBackground(bgColor);
         int iy = top + ascent;
         for (int yy = y0; yy < y1; yy++, iy += dy) {
             const TextLine* currentLine;
@@ -972,7 +959,7 @@ void TextEdit::redrawTextRectangle(
 
     if (createGC) {
         // Release the temporary graphic contex, restore the previous GC
-        XFreeGC(m_Display, m_GC);
+        freeGC(m_GC);
         m_GC = savedGC;
     }
 }
@@ -990,6 +977,8 @@ SaveDialog::SaveDialog(TextEdit* e):
     buttonHeight(0),
     dialogWidth(0),
     dialogHeight(0),
+    bgColor(0),
+    textColor(0),
     buttonColor1(0),
     buttonColor2(0),
     buttonPressed(SaveDialog::BUTTON_CANCEL)
@@ -1035,6 +1024,7 @@ void SaveDialog::create() {
 
     setFont(editor->textFont);
 
+    bgColor = getBackground();
     textColor = allocateColor("black");
     buttonColor1 = allocateColor("white");
     buttonColor2 = textColor;
@@ -1073,6 +1063,7 @@ void SaveDialog::drawButton(
     drawLineTo(rect.left(), rect.bottom());
 
     setForeground(textColor);
+    setBackground(buttonColor3);
     int len = strlen(text);
     int skip = (rect.width() - editor->dx * len) / 2;
     if (skip < 2)
@@ -1083,6 +1074,7 @@ void SaveDialog::drawButton(
         rect.top() + editor->statusLineMargin + editor->ascent,
         text
     );
+    setBackground(bgColor);
 }
 
 void SaveDialog::onButtonPress(XEvent& event) {
@@ -1105,8 +1097,14 @@ void SaveDialog::onButtonPress(XEvent& event) {
     }
 }
 
-void TextEdit::onDeleteWord() {
-    TextLine& line = text.getLine(cursorY);
-    char atCursor = line.at(cursorX);
-    printf("Delete word. Current cursor: %d %d, char: %c\n", cursorX, cursorY, atCursor);
+void TextEdit::onToggleTextBackend() {
+    if (getTextBackend() == TEXT_BACKEND_CORE)
+        setTextBackend(TEXT_BACKEND_ATLAS);
+    else
+        setTextBackend(TEXT_BACKEND_CORE);
+    redraw();
+}
+
+void TextEdit::onToggleLatencyOverlay() {
+    latencyOverlay = !latencyOverlay;
 }
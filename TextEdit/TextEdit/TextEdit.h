@@ -9,25 +9,17 @@
 
 #include "GWindow/gwindow.h"    // Graphic window interface
 #include <X11/keysym.h>
+#include <vector>
 
 #include "Text.h"               // Text based on L2List
+#include "EditorEngine.h"       // Editing model
+#include "KeyMap.h"             // Hashed key bindings
 
 /**
- * Simple text editor.
+ * Simple text editor: an X11 view of the editor engine.
  */
-class TextEdit: public GWindow {
-    Text text;          // Text storage
-
-    int cursorX;        // Cursor position in the text
-    int cursorY;
-
-    int windowX;        // Window position in the text
-    int windowY;
-
-    int windowWidth;    // Window size in characters (dx, dy)
-    int windowHeight;
-
-    int lastChar;       // The character typed
+class TextEdit: public GWindow, public EditorListener {
+    EditorEngine engine;    // Text, cursor, window position, commands
 
     Font textFont;          // Font used
     XFontStruct fontStruct; // Font properties
@@ -45,12 +37,8 @@ class TextEdit: public GWindow {
     int rightMargin;
     int bottomMargin;
 
-    TextLine fileName;      // Path to a file
-    bool fileNameSet;       // File name is assigned
     TextLine endOfText;     // "[* End of text *]" line
 
-    bool textChanged;
-    bool textSaved;
     bool inputDisabled;
     bool focusIn;
 
@@ -60,6 +48,11 @@ class TextEdit: public GWindow {
     unsigned long bgStatusLineColor;    // Status line colors
     unsigned long fgStatusLineColor;
 
+    KeyMap keyMap;          // Compiled key bindings
+
+    bool latencyOverlay;    // Show latency statistics in the status line
+    std::vector<unsigned long> pendingKeys; // Times of keys not yet shown
+
 public:
     TextEdit();
     void setFileName(const char* filePath);
@@ -75,11 +68,17 @@ protected:
     virtual void onResize(XEvent& event);
     virtual void onFocusIn(XEvent& event);
     virtual void onFocusOut(XEvent& event);
+    virtual void onFlushed();
 
     virtual bool onWindowClosing();
 
-    // Scrolling methods
-    void scrollToCursor();
+    // Notifications of the editor engine
+    virtual void onTextDamaged(int x, int y, int w, int h);
+    virtual void onWindowScrolled(int columns, int lines);
+    virtual void onQuitRequested();
+
+    // Scrolling methods: shift the window contents after the window
+    // position in the text has been changed by n characters
     void scrollLeft(int n);
     void scrollRight(int n);
     void scrollUp(int n);
@@ -96,48 +95,14 @@ protected:
     void preProcessCommand();
     void postProcessCommand();
 
-    // Editor commands
-
-    // Cursor movement
-    void onDown();      // Down arrow
-    void onUp();        // Up arrow
-    void onLeft();      // Left arrow
-    void onRight();     // Right arrow
-    void onHome();      // To the beginning of line
-    void onEnd();       // To the end of line
-    void onTextBeg();   // To the beginning of text
-    void onTextEnd();   // To the end of text
-    void onTab();       // Tabulation
-    void onTabLeft();   // Tabulation to the left
-    void onPageUp();    // Page Up
-    void onPageDown();  // Page Down
-
-    // "Horizontal" (inline) text changing commands
-    void onBackSpace(); // Delete previous character
-    void onDelete();    // Delete current character
-    void onInsert();    // Insert a space
-    void onCharTyped(); // Insert a character typed
-
-    // "Vertical" text changing commands
-    void onDeleteLine();   // Delete a complete line
-    void onInsertLine();   // Insert an empty above the current
-    void onEnter();        // Divide a current line in two pieces
-
-    // Save file
-    void onSave();      // Save a text in a file
-    void onSaveAs();    // ...not implemented yet...
-
-    void onQuit();      // Ask user, if text was changed, save, and quit
+    // Commands of the view (editing commands are in the engine)
     void close();       // Close editor (quit without questions)
 
     bool processQuit(); // Process the "Quit" request. Returns "true"
                         // if window should be closed
 
-    // Create new text / open new file
-    void onNew();       // ...not implemented yet...
-    void onOpen();      // ...not implemented yet...
-
-    void onDeleteWord();
+    void onToggleTextBackend();  // Switch between core and atlas text
+    void onToggleLatencyOverlay();
 
     // Redraw a rectangle in a text
     void redrawTextRectangle(
@@ -148,17 +113,34 @@ private:
     void initialize();
     void loadTextFont();
 
-    // Command description
-    struct CommandDsc {
+    // Description of a command of the view
+    struct ViewCommandDsc {
+        const char* name;       // Command name used in keymap files
+        void (TextEdit::*method)(); // Pointer to method processing the command
+    };
+
+    // Key binding description
+    struct KeyBindingDsc {
         KeySym keysym;          // X11 Key (see "/usr/include/X11/keysymdef.h")
         unsigned int state;     // State of Shift, Control, Alt, etc.
         unsigned int stateMask; // Which bits in "state" to consider
-        bool change;            // A command changes a text
-        void (TextEdit::*method)(); // Pointer to method processing the command
+        const char* command;    // Command name
     };
 
-    // Table of commands
-    static const struct CommandDsc editorCommands[];
+    // Numbers of view commands start here, engine commands are below
+    enum { VIEW_COMMAND_BASE = 1000 };
+
+    // Table of view commands
+    static const struct ViewCommandDsc viewCommands[];
+
+    // Default key bindings
+    static const struct KeyBindingDsc defaultKeyBindings[];
+
+    // Returns the number of an engine or view command, or -1
+    static int findCommand(const char* name);
+
+    // Compile the default bindings and the user keymap file
+    void buildKeyMap();
 
     friend class SaveDialog;
 };
@@ -0,0 +1,295 @@
+//
+// File "batchTst.cpp"
+// Test of the batch mode: script parsing, atomic saving
+// and processing of files, bytes of the lines kept
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "BatchEdit.h"
+#include "Text.h"
+
+static int numErrors = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s: %s\n", what, ok? "ok" : "FAILED");
+    if (!ok)
+        ++numErrors;
+}
+
+static std::string testDir;
+
+static std::string testPath(const char* name) {
+    return testDir + "/" + name;
+}
+
+static bool writeFile(const std::string& path, const char* contents) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (f == 0)
+        return false;
+    fputs(contents, f);
+    return (fclose(f) == 0);
+}
+
+static std::string readFile(const std::string& path) {
+    std::string contents;
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == 0)
+        return contents;
+    int c;
+    while ((c = getc(f)) != EOF)
+        contents += (char) c;
+    fclose(f);
+    return contents;
+}
+
+// Number of files in the test directory
+static int countFiles() {
+    DIR* d = opendir(testDir.c_str());
+    if (d == 0)
+        return (-1);
+    int n = 0;
+    struct dirent* e;
+    while ((e = readdir(d)) != 0) {
+        if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0)
+            ++n;
+    }
+    closedir(d);
+    return n;
+}
+
+static void testScript() {
+    printf("BatchScript::load\n");
+    std::string path = testPath("good.script");
+    writeFile(
+        path,
+        "# A comment\n"
+        "\n"
+        "text-end\n"
+        "type \"a \\\"quoted\\\" word\\n\"\n"
+        "search needle\n"
+        "replace \"\\t\" \"    \"\n"
+        "save\n"
+        "quit\n"
+    );
+    BatchScript script;
+    bool res = script.load(path.c_str());
+    check(res && script.ops.size() == 6, "valid script");
+    if (script.ops.size() == 6) {
+        check(
+            script.ops[0].type == BatchScript::OP_COMMAND &&
+            script.ops[0].command >= 0,
+            "editor command"
+        );
+        check(
+            script.ops[1].type == BatchScript::OP_TYPE &&
+            script.ops[1].arg1 == "a \"quoted\" word\n",
+            "quoted string with escapes"
+        );
+        check(
+            script.ops[2].type == BatchScript::OP_SEARCH &&
+            script.ops[2].arg1 == "needle",
+            "unquoted argument"
+        );
+        check(
+            script.ops[3].type == BatchScript::OP_REPLACE &&
+            script.ops[3].arg1 == "\t" && script.ops[3].arg2 == "    ",
+            "two arguments"
+        );
+        check(
+            script.ops[4].type == BatchScript::OP_SAVE &&
+            script.ops[5].type == BatchScript::OP_QUIT,
+            "save and quit"
+        );
+    }
+
+    // Errors are reported on stderr, the valid lines are kept
+    path = testPath("bad.script");
+    writeFile(
+        path,
+        "no-such-command\n"
+        "replace one\n"
+        "type \"unterminated\n"
+        "save extra\n"
+        "text-begin\n"
+    );
+    printf("(5 errors are expected below)\n");
+    fflush(stdout);
+    res = script.load(path.c_str());
+    check(!res && script.ops.size() == 1, "invalid lines are rejected");
+
+    check(
+        !script.load(testPath("missing.script").c_str()),
+        "missing script"
+    );
+}
+
+static void testSaveAtomically() {
+    printf("BatchEditor::saveAtomically\n");
+    std::string path = testPath("atomic.txt");
+    writeFile(path, "old line\n");
+    chmod(path.c_str(), 0640);
+    int numFiles = countFiles();
+
+    Text text;
+    text.load(path.c_str());
+    text.getLine(0) = "new line";
+    bool res = BatchEditor::saveAtomically(text, path.c_str());
+    check(
+        res && readFile(path) == "new line\n",
+        "contents replaced"
+    );
+
+    struct stat st;
+    check(
+        stat(path.c_str(), &st) == 0 && (st.st_mode & 07777) == 0640,
+        "permissions kept"
+    );
+    check(countFiles() == numFiles, "no temporary file left");
+
+    std::string noDir = testPath("no-such-dir/file.txt");
+    res = BatchEditor::saveAtomically(text, noDir.c_str());
+    check(!res && countFiles() == numFiles, "directory does not exist");
+}
+
+static void testProcessFile() {
+    printf("BatchEditor::processFile\n");
+    std::string scriptPath = testPath("replace.script");
+    writeFile(scriptPath, "replace foo bar\n");
+    BatchScript script;
+    script.load(scriptPath.c_str());
+    BatchEditor editor(script, 1);
+
+    std::string path = testPath("foo.txt");
+    writeFile(path, "foo foo\nfoo\n");
+    BatchFileResult result;
+    editor.processFile(path.c_str(), result);
+    check(
+        result.ok && result.saved && result.replacements == 3 &&
+        readFile(path) == "bar bar\nbar\n",
+        "replaced and saved"
+    );
+
+    editor.processFile(path.c_str(), result);
+    check(
+        result.ok && !result.saved && result.replacements == 0,
+        "unchanged file is not saved"
+    );
+
+    // Changes after the last "save" are dropped on "quit"
+    writeFile(scriptPath, "replace bar baz\nquit\n");
+    script.load(scriptPath.c_str());
+    editor.processFile(path.c_str(), result);
+    check(
+        result.ok && !result.saved && readFile(path) == "bar bar\nbar\n",
+        "quit drops changes"
+    );
+
+    editor.processFile(testPath("missing.txt").c_str(), result);
+    check(!result.ok, "missing file");
+}
+
+// Apply a script to a file; returns the contents saved
+static std::string runScript(const char* script, const char* contents) {
+    std::string scriptPath = testPath("exact.script");
+    writeFile(scriptPath, script);
+    BatchScript s;
+    s.load(scriptPath.c_str());
+    BatchEditor editor(s, 1);
+
+    std::string path = testPath("exact.txt");
+    writeFile(path, contents);
+    BatchFileResult result;
+    editor.processFile(path.c_str(), result);
+    if (!result.ok)
+        return "(failed)";
+    return readFile(path);
+}
+
+static void testExactBytes() {
+    printf("Lines are saved as they were read\n");
+    check(
+        runScript(
+            "replace foo bar\n",
+            "int main() {\r\n\treturn foo;  \r\n}"
+        ) == "int main() {\r\n\treturn bar;  \r\n}",
+        "tabs, CRLF, trailing spaces, no final newline"
+    );
+    check(
+        runScript(
+            "replace x y\n",
+            "\tx = 1;   \n  \t \n\tz;\t\n"
+        ) == "\ty = 1;   \n  \t \n\tz;\t\n",
+        "tabs and trailing spaces"
+    );
+    check(
+        runScript(
+            "replace one two\n",
+            "one\r\nmixed\nlast\r\n"
+        ) == "two\r\nmixed\nlast\r\n",
+        "mixed line endings"
+    );
+    check(
+        runScript("replace x y\n", "x\r\n\r\nlast") == "y\r\n\r\nlast",
+        "missing final newline"
+    );
+    check(
+        runScript("replace in out\n", "cr\rinside\n") == "cr\routside\n",
+        "carriage return inside a line"
+    );
+
+    check(
+        runScript("right\ndelete-word\ndelete-word\n", "a  word, b\n") ==
+            "a b\n",
+        "delete-word"
+    );
+    check(
+        runScript("text-end\ndelete-word\n", "text\n") == "text\n",
+        "delete-word at the end of text"
+    );
+
+    // New lines get the ending of the first line
+    check(
+        runScript(
+            "text-begin\nend\ntype \"\\nnew\"\n",
+            "first\r\nsecond"
+        ) == "first\r\nnew\r\nsecond",
+        "new line in a CRLF file"
+    );
+    check(
+        runScript("down\nend\ntype \"!\\nnext\"\n", "a\nlast") ==
+            "a\nlast!\nnext",
+        "line split at the end of a file without final newline"
+    );
+}
+
+int main() {
+    char dirName[] = "/tmp/batchTst.XXXXXX";
+    if (mkdtemp(dirName) == 0) {
+        perror("Cannot create a directory");
+        return 1;
+    }
+    testDir = dirName;
+
+    testScript();
+    testSaveAtomically();
+    testProcessFile();
+    testExactBytes();
+
+    std::string command = "rm -rf " + testDir;
+    if (system(command.c_str()) != 0)
+        perror(testDir.c_str());
+
+    if (numErrors > 0) {
+        printf("%d test(s) failed\n", numErrors);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,250 @@
+//
+// File "keyMapTst.cpp"
+// Test of class KeyMap: lookup of keys and chords,
+// parsing of key descriptions and keymap files
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "KeyMap.h"
+
+extern "C" {
+#include <X11/keysym.h>
+}
+
+static int numErrors = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s: %s\n", what, ok? "ok" : "FAILED");
+    if (!ok)
+        ++numErrors;
+}
+
+enum {
+    CMD_SAVE,
+    CMD_KILL,
+    CMD_QUIT,
+    CMD_WORD_LEFT,
+    CMD_LEFT
+};
+
+static int resolveCommand(const char* name) {
+    static const char* const names[] = {
+        "save", "kill", "quit", "word-left", "left"
+    };
+    for (int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); ++i) {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return (-1);
+}
+
+// Bind "key1 key2" with the modifiers that must be pressed
+static void bindChord(
+    KeyMap& keyMap,
+    KeySym key1, unsigned int state1, KeySym key2, unsigned int state2,
+    int command
+) {
+    KeySym keys[2] = { key1, key2 };
+    unsigned int states[2] = { state1, state2 };
+    unsigned int masks[2] = { state1, state2 };
+    keyMap.bind(keys, states, masks, 2, command);
+}
+
+static void testSingleKeys() {
+    printf("Single keys\n");
+    KeyMap keyMap;
+    keyMap.bind(XK_Left, 0, ControlMask, CMD_LEFT);
+    keyMap.bind(XK_Left, ControlMask, ControlMask, CMD_WORD_LEFT);
+
+    check(keyMap.lookup(XK_Left, 0) == CMD_LEFT, "plain key");
+    check(
+        keyMap.lookup(XK_Left, ControlMask) == CMD_WORD_LEFT,
+        "key with a modifier"
+    );
+    check(
+        keyMap.lookup(XK_Left, ShiftMask) == CMD_LEFT,
+        "modifier not mentioned is ignored"
+    );
+    check(
+        keyMap.lookup(XK_Left, ControlMask | LockMask | Mod2Mask) ==
+            CMD_WORD_LEFT,
+        "Lock and NumLock are ignored"
+    );
+    check(
+        keyMap.lookup(XK_Right, 0) == KeyMap::NO_BINDING,
+        "unbound key"
+    );
+
+    keyMap.bind(XK_Left, 0, ControlMask, CMD_QUIT, false);
+    check(
+        keyMap.lookup(XK_Left, 0) == CMD_LEFT,
+        "first binding wins without replace"
+    );
+    keyMap.bind(XK_Left, 0, ControlMask, CMD_QUIT);
+    check(keyMap.lookup(XK_Left, 0) == CMD_QUIT, "binding replaced");
+}
+
+static void testChords() {
+    printf("Chords\n");
+    KeyMap keyMap;
+    bindChord(keyMap, XK_x, ControlMask, XK_s, ControlMask, CMD_SAVE);
+    bindChord(keyMap, XK_x, ControlMask, XK_k, 0, CMD_KILL);
+    bindChord(keyMap, XK_x, ControlMask, XK_c, ControlMask, CMD_QUIT);
+
+    bool ok = (
+        keyMap.lookup(XK_x, ControlMask) == KeyMap::PREFIX_KEY &&
+        keyMap.inChord() &&
+        keyMap.lookup(XK_s, ControlMask) == CMD_SAVE &&
+        !keyMap.inChord()
+    );
+    check(ok, "Ctrl+x Ctrl+s");
+
+    ok = (
+        keyMap.lookup(XK_x, ControlMask) == KeyMap::PREFIX_KEY &&
+        keyMap.lookup(XK_k, 0) == CMD_KILL
+    );
+    check(ok, "Ctrl+x k");
+
+    ok = (
+        keyMap.lookup(XK_x, ControlMask) == KeyMap::PREFIX_KEY &&
+        keyMap.lookup(XK_Control_L, ControlMask) == KeyMap::PREFIX_KEY &&
+        keyMap.lookup(XK_c, ControlMask) == CMD_QUIT
+    );
+    check(ok, "modifier key inside a chord");
+
+    ok = (
+        keyMap.lookup(XK_x, ControlMask) == KeyMap::PREFIX_KEY &&
+        keyMap.lookup(XK_q, 0) == KeyMap::CHORD_ABORTED &&
+        !keyMap.inChord()
+    );
+    check(ok, "unknown key aborts a chord");
+
+    check(
+        keyMap.lookup(XK_s, ControlMask) == KeyMap::NO_BINDING,
+        "second key alone is not bound"
+    );
+
+    keyMap.lookup(XK_x, ControlMask);
+    keyMap.resetChord();
+    check(
+        !keyMap.inChord() && keyMap.lookup(XK_k, 0) == KeyMap::NO_BINDING,
+        "resetChord"
+    );
+
+    // Many bindings make the table grow; the chords must survive
+    for (int i = 0; i < 26; ++i) {
+        for (unsigned int s = 0; s < 8; ++s) {
+            unsigned int state = (
+                ((s & 1)? ShiftMask : 0) | ((s & 2)? ControlMask : 0) |
+                ((s & 4)? Mod1Mask : 0)
+            );
+            keyMap.bind(XK_F1 + i % 12, state, KeyMap::MODIFIER_MASK, i);
+        }
+    }
+    ok = (
+        keyMap.lookup(XK_x, ControlMask) == KeyMap::PREFIX_KEY &&
+        keyMap.lookup(XK_s, ControlMask) == CMD_SAVE
+    );
+    check(ok, "chord after rehash");
+
+    keyMap.clear();
+    check(
+        keyMap.size() == 0 &&
+        keyMap.lookup(XK_x, ControlMask) == KeyMap::NO_BINDING,
+        "clear"
+    );
+}
+
+static void testParseKey() {
+    printf("KeyMap::parseKey\n");
+    KeySym keysym;
+    unsigned int state, mask;
+
+    bool res = KeyMap::parseKey("Ctrl+Shift+Left", keysym, state, mask);
+    check(
+        res && keysym == XK_Left &&
+        state == (ControlMask | ShiftMask) &&
+        mask == (ControlMask | ShiftMask),
+        "Ctrl+Shift+Left"
+    );
+    res = KeyMap::parseKey("-Ctrl+Left", keysym, state, mask);
+    check(
+        res && keysym == XK_Left && state == 0 && mask == ControlMask,
+        "released modifier"
+    );
+    res = KeyMap::parseKey("Alt+q", keysym, state, mask);
+    check(
+        res && keysym == XK_q && state == Mod1Mask && mask == Mod1Mask,
+        "Alt+q"
+    );
+    res = KeyMap::parseKey("Ctrl+plus", keysym, state, mask);
+    check(res && keysym == XK_plus && state == ControlMask, "Ctrl+plus");
+    check(
+        !KeyMap::parseKey("Hyper+x", keysym, state, mask),
+        "unknown modifier"
+    );
+    check(
+        !KeyMap::parseKey("NoSuchKey", keysym, state, mask),
+        "unknown key"
+    );
+}
+
+static void testLoad() {
+    printf("KeyMap::load\n");
+    char path[] = "/tmp/keyMapTst.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("Cannot create a file");
+        ++numErrors;
+        return;
+    }
+    const char* contents =
+        "# Emacs-like bindings\n"
+        "Ctrl+x Ctrl+s save\n"
+        "Ctrl+x k kill\n"
+        "-Ctrl+Left left\n"
+        "Ctrl+Left word-left\n"
+        "F5 no-such-command\n"
+        "NoSuchKey quit\n"
+        "quit\n";
+    if (write(fd, contents, strlen(contents)) != (ssize_t) strlen(contents))
+        perror(path);
+    close(fd);
+
+    KeyMap keyMap;
+    printf("(3 errors are expected below)\n");
+    fflush(stdout);
+    int n = keyMap.load(path, &resolveCommand);
+    unlink(path);
+    check(n == 4, "valid lines loaded");
+
+    bool ok = (
+        keyMap.lookup(XK_x, ControlMask) == KeyMap::PREFIX_KEY &&
+        keyMap.lookup(XK_s, ControlMask) == CMD_SAVE &&
+        keyMap.lookup(XK_Left, 0) == CMD_LEFT &&
+        keyMap.lookup(XK_Left, ControlMask) == CMD_WORD_LEFT &&
+        keyMap.lookup(XK_F5, 0) == KeyMap::NO_BINDING
+    );
+    check(ok, "loaded bindings");
+
+    check(
+        keyMap.load("/nonexistent/keymap", &resolveCommand) == (-1),
+        "missing file"
+    );
+}
+
+int main() {
+    testSingleKeys();
+    testChords();
+    testParseKey();
+    testLoad();
+    if (numErrors > 0) {
+        printf("%d test(s) failed\n", numErrors);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}